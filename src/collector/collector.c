@@ -36,6 +36,7 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,6 +49,7 @@
 #include <unistd.h>
 
 #include "bookkeeper.h"
+#include "khash.h"
 #include "nfconf.h"
 #include "nfdump.h"
 #include "nffile.h"
@@ -55,9 +57,27 @@
 #include "util.h"
 
 /* local variables */
-static uint32_t exporter_sysid = 0;
+// exporters may get registered by concurrent nfcapd workers
+static _Atomic uint32_t exporter_sysid = ATOMIC_VAR_INIT(0);
 static char *DynamicSourcesDir = NULL;
 
+// exporters of a flow source are identified by version, exporter ID and IP
+typedef struct exporterKey_s {
+    ip_addr_t ip;
+    uint32_t version;
+    uint32_t id;
+} exporterKey_t;
+
+static kh_inline khint_t __ExporterHashFunc(exporterKey_t key) {
+    uint64_t h = key.ip.V6[0] ^ key.ip.V6[1] ^ ((uint64_t)key.version << 32 | key.id);
+    return kh_int64_hash_func(h);
+}
+
+#define __ExporterHashEqual(k1, k2) \
+    ((k1).id == (k2).id && (k1).version == (k2).version && (k1).ip.V6[0] == (k2).ip.V6[0] && (k1).ip.V6[1] == (k2).ip.V6[1])
+
+KHASH_INIT(exporterIndex, exporterKey_t, exporter_t *, 1, __ExporterHashFunc, __ExporterHashEqual)
+
 /* local prototypes */
 static uint32_t AssignExporterID(void);
 
@@ -65,12 +85,13 @@ static uint32_t AssignExporterID(void);
 
 /* local functions */
 static uint32_t AssignExporterID(void) {
-    if (exporter_sysid >= 0xFFFF) {
+    uint32_t sysid = atomic_fetch_add(&exporter_sysid, 1) + 1;
+    if (sysid > 0xFFFF) {
         LogError("Too many exporters (id > 65535). Flow records collected but without reference to exporter");
         return 0;
     }
 
-    return ++exporter_sysid;
+    return sysid;
 
 }  // End of AssignExporterID
 
@@ -260,7 +281,7 @@ FlowSource_t *AddDynamicSource(FlowSource_t **FlowSource, struct sockaddr_storag
     (*source)->bookkeeper = NULL;
     (*source)->any_source = 0;
     (*source)->exporter_data = NULL;
-    (*FlowSource)->exporter_count = 0;
+    (*source)->exporter_count = 0;
 
     switch (ss->ss_family) {
         case PF_INET: {
@@ -385,6 +406,53 @@ int FlushInfoExporter(FlowSource_t *fs, exporter_info_record_t *exporter) {
 
 }  // End of FlushInfoExporter
 
+// return the exporter of the current IP of fs with this version and exporter ID
+exporter_t *LookupExporter(FlowSource_t *fs, uint32_t version, uint32_t id) {
+    khash_t(exporterIndex) *exporterIndex = (khash_t(exporterIndex) *)fs->exporterIndex;
+    if (!exporterIndex) return NULL;
+
+    exporterKey_t key = {.ip = fs->ip, .version = version, .id = id};
+    khiter_t k = kh_get(exporterIndex, exporterIndex, key);
+    if (k == kh_end(exporterIndex)) return NULL;
+
+    return kh_value(exporterIndex, k);
+
+}  // End of LookupExporter
+
+// free the exporter index of fs - the exporters stay in the exporter list
+void DisposeExporterIndex(FlowSource_t *fs) {
+    if (fs->exporterIndex) kh_destroy(exporterIndex, (khash_t(exporterIndex) *)fs->exporterIndex);
+    fs->exporterIndex = NULL;
+
+}  // End of DisposeExporterIndex
+
+// append a new exporter to the exporter list of fs and add it to the index
+int InsertExporter(FlowSource_t *fs, exporter_t *exporter) {
+    khash_t(exporterIndex) *exporterIndex = (khash_t(exporterIndex) *)fs->exporterIndex;
+    if (!exporterIndex) {
+        exporterIndex = kh_init(exporterIndex);
+        fs->exporterIndex = (void *)exporterIndex;
+    }
+
+    int ret;
+    exporterKey_t key = {.ip = exporter->info.ip, .version = exporter->info.version, .id = exporter->info.id};
+    khiter_t k = kh_put(exporterIndex, exporterIndex, key, &ret);
+    if (ret < 0) {
+        LogError("kh_put() error in %s line %d", __FILE__, __LINE__);
+        return 0;
+    }
+    kh_value(exporterIndex, k) = exporter;
+
+    // keep the order of the exporter records in the file
+    exporter_t **e = &(fs->exporter_data);
+    while (*e) e = &((*e)->next);
+    exporter->next = NULL;
+    *e = exporter;
+
+    return 1;
+
+}  // End of InsertExporter
+
 void FlushStdRecords(FlowSource_t *fs) {
     exporter_t *e = fs->exporter_data;
 
@@ -434,6 +502,11 @@ void FlushExporterStats(FlowSource_t *fs) {
         exporter_stats->stat[i].sequence_failure = e->sequence_failure;
         exporter_stats->stat[i].packets = e->packets;
         exporter_stats->stat[i].flows = e->flows;
+        if (e->sequence_failure) {
+            LogInfo("Ident: '%s' exporter SysID: %u, version: %u, ID: %u, Sequence Errors: %u in %llu packets (%.2f%%)", fs->Ident, e->info.sysid,
+                    e->info.version, e->info.id, e->sequence_failure, (unsigned long long)e->packets,
+                    e->packets ? (100.0 * e->sequence_failure) / e->packets : 0.0);
+        }
 #ifdef DEVEL
         printf("Stat: SysID: %u, version: %u, ID: %2u, Packets: %llu, Flows: %llu, Sequence Failures: %u\n", e->info.sysid, e->info.version,
                e->info.id, e->packets, e->flows, e->sequence_failure);
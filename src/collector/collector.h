@@ -66,6 +66,9 @@ typedef struct common_flow_header {
     uint16_t count;
 } common_flow_header_t;
 
+/* max number of output files per flow source and time slot */
+#define MAXSHARDS 16
+
 typedef struct FlowSource_s {
     // link
     struct FlowSource_s *next;
@@ -83,6 +86,9 @@ typedef struct FlowSource_s {
     char *datadir;     // where to store data for this source
     char *current;     // current file name - typically nfcad.current.pid
     nffile_t *nffile;  // the writing file handle
+    // sharded output: all writing files of this source, shard[0] == nffile
+    nffile_t *shard[MAXSHARDS];
+    int numShards;
 
     // statistical data per source
     uint32_t bad_packets;
@@ -92,6 +98,7 @@ typedef struct FlowSource_s {
     // Any exporter specific data
     exporter_t *exporter_data;
     uint32_t exporter_count;
+    void *exporterIndex;  // hash index of exporter_data
     struct timeval received;
 
 } FlowSource_t;
@@ -99,6 +106,9 @@ typedef struct FlowSource_s {
 /* input buffer size, to read data from the network */
 #define NETWORK_INPUT_BUFF_SIZE 65535  // Maximum UDP message size
 
+/* max number of datagrams received with a single system call */
+#define RECV_BATCH_SIZE 32
+
 #define UpdateFirstLast(fs, First, Last) \
     if ((First) < (fs)->msecFirst) {     \
         (fs)->msecFirst = (First);       \
@@ -124,6 +134,12 @@ void FlushExporterStats(FlowSource_t *fs);
 
 int FlushInfoExporter(FlowSource_t *fs, exporter_info_record_t *exporter);
 
+exporter_t *LookupExporter(FlowSource_t *fs, uint32_t version, uint32_t id);
+
+int InsertExporter(FlowSource_t *fs, exporter_t *exporter);
+
+void DisposeExporterIndex(FlowSource_t *fs);
+
 int ScanExtension(char *extensionList);
 
 #endif  //_COLLECTOR_H
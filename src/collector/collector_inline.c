@@ -29,7 +29,15 @@
  *
  */
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss) {
+// hash index of the flow sources by IP address. Each receiving thread searches its own
+// flow source list, therefore the index is built per thread, as sources are found.
+#define __SourceHashFunc(ip) kh_int64_hash_func((ip).V6[0] ^ (ip).V6[1])
+#define __SourceHashEqual(ip1, ip2) ((ip1).V6[0] == (ip2).V6[0] && (ip1).V6[1] == (ip2).V6[1])
+KHASH_INIT(sourceIndex, ip_addr_t, FlowSource_t *, 1, __SourceHashFunc, __SourceHashEqual)
+
+static __thread khash_t(sourceIndex) *sourceIndex = NULL;
+
+static inline FlowSource_t *GetFlowSource(FlowSource_t *sourceList, struct sockaddr_storage *ss) {
     FlowSource_t *fs;
     void *ptr;
     ip_addr_t ip;
@@ -92,21 +100,32 @@ static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss) {
     printf("Flow Source IP: %s\n", as);
 #endif
 
-    fs = FlowSource;
+    // if we match any source, store the current IP address - works as faster cache next time
+    // and identifies the current source by IP. Any source can not be mixed with other sources
+    fs = sourceList;
+    if (fs && fs->any_source) {
+        fs->ip = ip;
+        fs->port = port;
+        fs->sa_family = ss->ss_family;
+        return fs;
+    }
+
+    if (!sourceIndex) sourceIndex = kh_init(sourceIndex);
+    khiter_t k = kh_get(sourceIndex, sourceIndex, ip);
+    if (k != kh_end(sourceIndex)) {
+        fs = kh_value(sourceIndex, k);
+        fs->port = port;
+        return fs;
+    }
+
     while (fs) {
         if (ip.V6[0] == fs->ip.V6[0] && ip.V6[1] == fs->ip.V6[1]) {
+            int ret;
+            k = kh_put(sourceIndex, sourceIndex, ip, &ret);
+            kh_value(sourceIndex, k) = fs;
             fs->port = port;
             return fs;
         }
-
-        // if we match any source, store the current IP address - works as faster cache next time
-        // and identifies the current source by IP
-        if (fs->any_source) {
-            fs->ip = ip;
-            fs->port = port;
-            fs->sa_family = ss->ss_family;
-            return fs;
-        }
         fs = fs->next;
     }
 
@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -65,8 +66,20 @@ static uint32_t timeout = 0;
 
 static void PrepareDirLists(channel_t *channel);
 
+// remove the nfdump element stat cache/rollup <file>.stat of an expired flow file
+static void UnlinkStatCache(char *path) {
+    char cacheName[MAXPATHLEN];
+    snprintf(cacheName, MAXPATHLEN, "%s.stat", path);
+    cacheName[MAXPATHLEN - 1] = '\0';
+    if (unlink(cacheName) < 0 && errno != ENOENT) {
+        LogError("unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+    }
+}  // End of UnlinkStatCache
+
 static int compare(const FTSENT **f1, const FTSENT **f2);
 
+static int NfcapdTime(char *name, char *timestring);
+
 static void IntHandler(int signal) {
     switch (signal) {
         case SIGALRM:
@@ -252,6 +265,37 @@ uint64_t ParseTimeDef(char *s, uint64_t *value) {
 
 static int compare(const FTSENT **f1, const FTSENT **f2) { return strcmp((*f1)->fts_name, (*f2)->fts_name); }  // End of compare
 
+/*
+ * Check for a valid nfcapd file name and copy its time string
+ * nfcapd.200604301200     strlen = 19
+ * nfcapd.20190430120010   strlen = 21
+ * nfcapd.200604301200.1   shard of nfcapd -K
+ */
+static int NfcapdTime(char *name, char *timestring) {
+    if (strncmp(name, "nfcapd.", 7) != 0) return 0;
+
+    // make sure, we have only digits
+    char *p = &name[7];
+    char *s = p;
+    while (isdigit((int)*s)) s++;
+    size_t len = s - p;
+    if (len != 12 && len != 14) return 0;
+
+    // optional shard number
+    if (*s == '.') {
+        s++;
+        if (!isdigit((int)*s)) return 0;
+        while (isdigit((int)*s)) s++;
+    }
+    // otherwise skip
+    if (*s) return 0;
+
+    memcpy(timestring, p, len);
+    timestring[len] = '\0';
+    return 1;
+
+}  // End of NfcapdTime
+
 void RescanDir(char *dir, dirstat_t *dirstat) {
     FTS *fts;
     FTSENT *ftsent;
@@ -270,28 +314,14 @@ void RescanDir(char *dir, dirstat_t *dirstat) {
         return;
     }
     while ((ftsent = fts_read(fts)) != NULL) {
-        if (ftsent->fts_info == FTS_F && ((ftsent->fts_namelen == 19) || (ftsent->fts_namelen == 21))) {
-            // nfcapd.200604301200   strlen = 19
-            // nfcapd.20190430120010 strlen = 21
-            if (strncmp(ftsent->fts_name, "nfcapd.", 7) == 0) {
-                char *s, *p = &(ftsent->fts_name[7]);
-
-                // make sure, we have only digits
-                s = p;
-                while (*s) {
-                    if (*s < '0' || *s > '9') break;
-                    s++;
-                }
-                // otherwise skip
-                if (*s) continue;
-
+        if (ftsent->fts_info == FTS_F) {
+            char p[16];
+            if (NfcapdTime(ftsent->fts_name, p)) {
                 if (strcmp(p, first_timestring) < 0) {
-                    first_timestring[0] = '\0';
-                    strncat(first_timestring, p, 15);
+                    memcpy(first_timestring, p, sizeof(first_timestring));
                 }
                 if (strcmp(p, last_timestring) > 0) {
-                    last_timestring[0] = '\0';
-                    strncat(last_timestring, p, 15);
+                    memcpy(last_timestring, p, sizeof(last_timestring));
                 }
 
                 dirstat->filesize += 512 * ftsent->fts_statp->st_blocks;
@@ -393,26 +423,14 @@ void ExpireDir(char *dir, dirstat_t *dirstat, uint64_t maxsize, uint64_t maxlife
     while (!done && ((ftsent = fts_read(fts)) != NULL)) {
         if (ftsent->fts_info == FTS_F) {
             dir_files++;  // count files in directories
-            if ((ftsent->fts_namelen == 19 || ftsent->fts_namelen == 21) && strncmp(ftsent->fts_name, "nfcapd.", 7) == 0) {
-                // nfcapd.200604301200   strlen = 19
-                // nfcapd.20190430120010 strlen = 21
-                char *s, *p = &(ftsent->fts_name[7]);
-
-                // process only nfcapd. files
-                // make sure it's really an nfcapd. file and we have
-                // only digits in the rest of the file name
-                s = p;
-                while (*s) {
-                    if (*s < '0' || *s > '9') break;
-                    s++;
-                }
-                // otherwise skip
-                if (*s) continue;
-
+            // process only nfcapd. files
+            char p[16];
+            if (NfcapdTime(ftsent->fts_name, p)) {
                 // expire size-wise if needed
                 if (!size_done) {
                     if (dirstat->filesize > sizelimit) {
                         if (unlink(ftsent->fts_path) == 0) {
+                            UnlinkStatCache(ftsent->fts_path);
                             dirstat->filesize -= 512 * ftsent->fts_statp->st_blocks;
                             num_expired++;
                             dir_files--;
@@ -431,6 +449,7 @@ void ExpireDir(char *dir, dirstat_t *dirstat, uint64_t maxsize, uint64_t maxlife
                 if (!lifetime_done) {
                     if (expire_timelimit && strcmp(p, expire_timelimit) < 0) {
                         if (unlink(ftsent->fts_path) == 0) {
+                            UnlinkStatCache(ftsent->fts_path);
                             dirstat->filesize -= 512 * ftsent->fts_statp->st_blocks;
                             num_expired++;
                             dir_files--;
@@ -528,9 +547,8 @@ static void PrepareDirLists(channel_t *channel) {
             current_channel->ftsent->fts_number++;
 
             // if ftsent points to first valid file, break
-            if ((current_channel->ftsent->fts_namelen == 19 || current_channel->ftsent->fts_namelen == 21) &&
-                strncmp(current_channel->ftsent->fts_name, "nfcapd.", 7) == 0)
-                break;
+            char timestring[16];
+            if (NfcapdTime(current_channel->ftsent->fts_name, timestring)) break;
 
             // otherwise loop
             current_channel->ftsent = fts_read(current_channel->fts);
@@ -567,7 +585,7 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
     PrepareDirLists(channel);
     if (runtime) alarm(runtime);
     while (!done) {
-        char *p;
+        char p[16];
         int file_removed;
 
         // search for the channel with oldest file. If all channel have same age,
@@ -599,7 +617,7 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
 
         // expire_channel now points to the channel with oldest file
         // do expire
-        p = &(expire_channel->ftsent->fts_name[7]);
+        NfcapdTime(expire_channel->ftsent->fts_name, p);
         dbg_printf("File: %s\n", expire_channel->ftsent->fts_path);
 
         if (!size_done) {
@@ -608,6 +626,7 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
             if (current_stat->filesize > sizelimit) {
                 // need to delete this file
                 if (unlink(expire_channel->ftsent->fts_path) == 0) {
+                    UnlinkStatCache(expire_channel->ftsent->fts_path);
                     // Update profile stat
                     current_stat->filesize -= 512 * expire_channel->ftsent->fts_statp->st_blocks;
                     current_stat->numfiles--;
@@ -636,6 +655,7 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
             if (strcmp(p, expire_timelimit) < 0) {
                 // need to delete this file
                 if (unlink(expire_channel->ftsent->fts_path) == 0) {
+                    UnlinkStatCache(expire_channel->ftsent->fts_path);
                     // Update profile stat
                     current_stat->filesize -= 512 * expire_channel->ftsent->fts_statp->st_blocks;
                     current_stat->numfiles--;
@@ -668,10 +688,8 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
             while (expire_channel->ftsent) {
                 if (expire_channel->ftsent->fts_info == FTS_F) {  // entry is a file
                     expire_channel->ftsent->fts_number++;
-                    if ((expire_channel->ftsent->fts_namelen == 19 || expire_channel->ftsent->fts_namelen == 21) &&
-                        strncmp(expire_channel->ftsent->fts_name, "nfcapd.", 7) == 0) {
+                    if (NfcapdTime(expire_channel->ftsent->fts_name, p)) {
                         // if ftsent points to next valid file
-                        char *p = &(expire_channel->ftsent->fts_name[7]);
                         // next file is first (oldest) for channel and for profile - update first mark
                         expire_channel->dirstat->first = current_stat->first = ISO2UNIX(p);
                         break;
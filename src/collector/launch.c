@@ -30,6 +30,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -43,6 +44,7 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "bookkeeper.h"
 #include "config.h"
@@ -98,9 +100,11 @@ static void cmd_parse(char *buf, char **args);
 
 static void cmd_execute(char **args);
 
+static void cmd_rollup(char *rollup, launcher_args_t *launcher_args);
+
 static void processMessage(message_t *message, launcher_args_t *launcher_args);
 
-static void launcher(messageQueue_t *messageQueue, char *launch_process, int expire);
+static void launcher(messageQueue_t *messageQueue, char *launch_process, char *rollup, int expire);
 
 static void do_expire(char *datadir);
 
@@ -241,6 +245,65 @@ static void cmd_execute(char **args) {
 
 }  // End of cmd_execute
 
+/*
+ * cmd_rollup
+ * build the element stat rollup <file>.stat of the new flow file
+ * by running nfdump -k with the comma separated list of -s stats
+ */
+static void cmd_rollup(char *rollup, launcher_args_t *launcher_args) {
+    char path[MAXPATHLEN];
+    snprintf(path, MAXPATHLEN, "%s/%s", launcher_args->flowdir, launcher_args->filename);
+    path[MAXPATHLEN - 1] = '\0';
+
+    char *stats = strdup(rollup);
+    if (!stats) {
+        LogError("strdup() error in %s:%i: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    char *args[MAXARGS];
+    int argnum = 0;
+    args[argnum++] = NFDUMP_BIN;
+    args[argnum++] = "-q";
+    args[argnum++] = "-k";
+    args[argnum++] = "-n";
+    args[argnum++] = "1";
+    args[argnum++] = "-r";
+    args[argnum++] = path;
+    char *stat = strtok(stats, ",");
+    while (stat && argnum < (MAXARGS - 2)) {
+        args[argnum++] = "-s";
+        args[argnum++] = stat;
+        stat = strtok(NULL, ",");
+    }
+    args[argnum] = NULL;
+
+    LogVerbose("Launcher: ident: %s build rollup for '%s'", launcher_args->ident, path);
+
+    int pid;
+    if ((pid = fork()) < 0) {
+        LogError("Can't fork: %s", strerror(errno));
+        free(stats);
+        return;
+    }
+
+    if (pid == 0) {
+        // child process - the rollup is written to <file>.stat, discard stat output
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        execv(args[0], args);
+        LogError("Can't execv: %s: %s", args[0], strerror(errno));
+        _exit(1);
+    }
+
+    // parent process
+    free(stats);
+
+}  // End of cmd_rollup
+
 static void do_expire(char *datadir) {
     bookkeeper_t *books;
     dirstat_t *dirstat, oldstat;
@@ -348,7 +411,7 @@ void processMessage(message_t *message, launcher_args_t *launcher_args) {
 
 }  // End of processMessage
 
-static void launcher(messageQueue_t *messageQueue, char *launch_process, int expire) {
+static void launcher(messageQueue_t *messageQueue, char *launch_process, char *rollup, int expire) {
     while (!done) {
         message_t *message = getMessage(messageQueue);
         if (message == (message_t *)-1) {
@@ -380,6 +443,7 @@ static void launcher(messageQueue_t *messageQueue, char *launch_process, int exp
 
             free(cmd);
         }
+        if (rollup) cmd_rollup(rollup, &launcher_args);
         if (expire) do_expire(launcher_args.flowdir);
 
         if (child_exit) {
@@ -473,8 +537,8 @@ int SendLauncherMessage(int pfd, time_t t_start, char *subdir, char *fmt, char *
     return ret;
 }
 
-int StartupLauncher(char *launch_process, int expire) {
-    LogInfo("StartupLauncher(): %s, expire: %d", launch_process, expire);
+int StartupLauncher(char *launch_process, char *rollup, int expire) {
+    LogInfo("StartupLauncher(): %s, rollup: %s, expire: %d", launch_process ? launch_process : "none", rollup ? rollup : "none", expire);
 
     messageQueue_t *messageQueue = NewMessageQueue();
     if (!messageQueue) return 0;
@@ -499,7 +563,7 @@ int StartupLauncher(char *launch_process, int expire) {
     }
     tid = killtid;
 
-    launcher(messageQueue, launch_process, expire);
+    launcher(messageQueue, launch_process, rollup, expire);
     err = pthread_join(tid, NULL);
     if (err) {
         LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
@@ -38,7 +38,7 @@
 #include "collector.h"
 #include "config.h"
 
-int StartupLauncher(char *launch_process, int expire);
+int StartupLauncher(char *launch_process, char *rollup, int expire);
 
 int SendLauncherMessage(int pfd, time_t t_start, char *subdir, char *fmt, char *datadir, char *ident);
 
@@ -47,23 +47,58 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "khash.h"
 #include "nffile.h"
 #include "nfxV3.h"
 #include "util.h"
 
+// number of counters in metric_record_t
+#define METRIC_COUNTERS 14
+
+/*
+ * Each thread, which updates metrics, owns a slot per ident. Only the owner thread
+ * writes the counters of a slot, therefore no lock is needed. MetricThread reads the
+ * counters at the end of each interval and adds the difference to the last read to
+ * the metric record of the ident. Slots are cache line aligned to avoid false sharing.
+ */
+typedef struct metricSlot_s {
+    // written by the owner thread only
+    _Atomic uint64_t counter[METRIC_COUNTERS];
+    _Atomic uint64_t histogram[METRIC_HISTOGRAMS][METRIC_BUCKETS];
+
+    // read by MetricThread only
+    uint64_t lastCounter[METRIC_COUNTERS] __attribute__((aligned(64)));
+    uint64_t lastHistogram[METRIC_HISTOGRAMS][METRIC_BUCKETS];
+    metric_record_t *record;
+    struct metricSlot_s *next;
+} __attribute__((aligned(64))) metricSlot_t;
+
+KHASH_MAP_INIT_STR(metricHash, metricSlot_t *);
+
 static char *socket_path = NULL;
 static _Atomic unsigned tstart = ATOMIC_VAR_INIT(0);
 
 // list of chained metric records
 static metric_chain_t *metric_list = NULL;
-
-// cache last metric record
-static metric_record_t *metricCache = NULL;
 static uint32_t numMetrics = 0;
 
+// list of all slots of all threads
+static metricSlot_t *slotList = NULL;
+
+// receive path stats of all receiving threads
+static _Atomic uint64_t recvDatagrams = ATOMIC_VAR_INIT(0);
+static _Atomic uint64_t recvDrops = ATOMIC_VAR_INIT(0);
+static _Atomic uint32_t recvMaxBatchTime = ATOMIC_VAR_INIT(0);
+static _Atomic uint32_t recvMaxRcvbufUsage = ATOMIC_VAR_INIT(0);
+
+// protects the lists above. Taken only, when a thread adds a new slot and by MetricThread
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t tid = 0;
 
+// slots of the current thread
+static __thread khash_t(metricHash) *threadSlots = NULL;
+static __thread metricSlot_t *slotCache = NULL;
+
 static int OpenSocket(void) {
     struct sockaddr_un addr;
 
@@ -85,6 +120,7 @@ static int OpenSocket(void) {
     return fd;
 }
 
+// must be called with mutex locked
 static inline metric_record_t *GetMetric(char *ident, uint32_t exporterID) {
     metric_chain_t *metric_chain = metric_list;
     while (metric_chain && strncmp(metric_chain->record->ident, ident, 128)) metric_chain = metric_chain->next;
@@ -111,6 +147,71 @@ static inline metric_record_t *GetMetric(char *ident, uint32_t exporterID) {
 
 }  // End of GetMetric
 
+// add a new slot for ident to the current thread
+static metricSlot_t *NewSlot(char *ident, uint32_t exporterID) {
+    if (!threadSlots) {
+        threadSlots = kh_init(metricHash);
+        if (!threadSlots) {
+            LogError("kh_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return NULL;
+        }
+    }
+
+    metricSlot_t *slot = NULL;
+    if (posix_memalign((void **)&slot, 64, sizeof(metricSlot_t)) != 0) {
+        LogError("posix_memalign() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    memset((void *)slot, 0, sizeof(metricSlot_t));
+
+    pthread_mutex_lock(&mutex);
+    slot->record = GetMetric(ident, exporterID);
+    if (slot->record) {
+        slot->next = slotList;
+        slotList = slot;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (!slot->record) {
+        free(slot);
+        return NULL;
+    }
+
+    // the key lives as long as the metric record
+    int ret;
+    khiter_t k = kh_put(metricHash, threadSlots, slot->record->ident, &ret);
+    kh_value(threadSlots, k) = slot;
+
+    return slot;
+
+}  // End of NewSlot
+
+// get the slot of the current thread for ident
+static inline metricSlot_t *GetSlot(char *ident, uint32_t exporterID) {
+    metricSlot_t *slot = slotCache;
+    if (slot && strncmp(slot->record->ident, ident, 127) == 0) return slot;
+
+    slot = NULL;
+    if (threadSlots) {
+        char key[128];
+        strncpy(key, ident, 127);
+        key[127] = '\0';
+        khiter_t k = kh_get(metricHash, threadSlots, key);
+        if (k != kh_end(threadSlots)) slot = kh_value(threadSlots, k);
+    }
+    if (!slot) slot = NewSlot(ident, exporterID);
+
+    slotCache = slot;
+    return slot;
+
+}  // End of GetSlot
+
+static inline void SlotAdd(_Atomic uint64_t *counter, uint64_t val) {
+    // single writer - no atomic read-modify-write required
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + val, memory_order_relaxed);
+
+}  // End of SlotAdd
+
 int OpenMetric(char *path, int interval) {
     socket_path = path;
     int fd = OpenSocket();
@@ -154,62 +255,124 @@ int CloseMetric(void) {
         free(elem);
     }
     metric_list = NULL;
+
+    metricSlot_t *slot = slotList;
+    while (slot) {
+        metricSlot_t *next = slot->next;
+        free(slot);
+        slot = next;
+    }
+    slotList = NULL;
     pthread_mutex_unlock(&mutex);
 
+    // all other threads are terminated - drop the slot index of this thread
+    if (threadSlots) kh_destroy(metricHash, threadSlots);
+    threadSlots = NULL;
+    slotCache = NULL;
+
     return 0;
 
 }  // End of CloseMetric
 
+int MetricActive(void) {
+    return atomic_load_explicit(&tstart, memory_order_relaxed) != 0;
+
+}  // End of MetricActive
+
 void UpdateMetric(char *ident, uint32_t exporterID, EXgenericFlow_t *genericFlow) {
     dbg_printf("Update metric: exporter ID: %x\n", exporterID);
 
     // if no MetricThread is running
     if (atomic_load(&tstart) == 0) return;
 
-    dbg_printf("Update metric\n");
-    pthread_mutex_lock(&mutex);
-    metric_record_t *metric_record = metricCache;
-    if (metric_record == NULL || strncmp(metric_record->ident, ident, 128) != 0) {
-        dbg_printf("Get metric\n");
-        metric_record = GetMetric(ident, exporterID);
-        if (!metric_record) {
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
-        metricCache = metric_record;
-    }
-#ifdef DEVEL
-    else {
-        printf("Cached metric\n");
-    }
-#endif
-    // fill metric
+    metricSlot_t *slot = GetSlot(ident, exporterID);
+    if (!slot) return;
+
+    // counter layout corresponds to metric_record_t: flows, bytes, packets for tcp, udp, icmp, other
+    int index;
     switch (genericFlow->proto) {
         case IPPROTO_ICMPV6:
         case IPPROTO_ICMP:
-            metric_record->numflows_icmp++;
-            metric_record->numpackets_icmp += genericFlow->inPackets;
-            metric_record->numbytes_icmp += genericFlow->inBytes;
+            index = 2;
             break;
         case IPPROTO_TCP:
-            metric_record->numflows_tcp++;
-            metric_record->numpackets_tcp += genericFlow->inPackets;
-            metric_record->numbytes_tcp += genericFlow->inBytes;
+            index = 0;
             break;
         case IPPROTO_UDP:
-            metric_record->numflows_udp++;
-            metric_record->numpackets_udp += genericFlow->inPackets;
-            metric_record->numbytes_udp += genericFlow->inBytes;
+            index = 1;
             break;
         default:
-            metric_record->numflows_other++;
-            metric_record->numpackets_other += genericFlow->inPackets;
-            metric_record->numbytes_other += genericFlow->inBytes;
+            index = 3;
     }
-    pthread_mutex_unlock(&mutex);
+    SlotAdd(&slot->counter[index], 1);
+    SlotAdd(&slot->counter[index + 4], genericFlow->inBytes);
+    SlotAdd(&slot->counter[index + 8], genericFlow->inPackets);
 
 }  // End of UpdateMetric
 
+void UpdateMetricCounter(char *ident, unsigned counter, uint64_t value) {
+    // if no MetricThread is running
+    if (atomic_load(&tstart) == 0 || counter >= METRIC_COUNTERS) return;
+
+    metricSlot_t *slot = GetSlot(ident, 0);
+    if (!slot) return;
+
+    SlotAdd(&slot->counter[counter], value);
+
+}  // End of UpdateMetricCounter
+
+void UpdateMetricHistogram(char *ident, unsigned histogram, uint64_t value) {
+    // if no MetricThread is running
+    if (atomic_load(&tstart) == 0 || histogram >= METRIC_HISTOGRAMS) return;
+
+    metricSlot_t *slot = GetSlot(ident, 0);
+    if (!slot) return;
+
+    // bucket 0: value 0, bucket n: 2^(n-1) <= value < 2^n, last bucket: all larger values
+    unsigned bucket = value ? 64 - __builtin_clzll(value) : 0;
+    if (bucket >= METRIC_BUCKETS) bucket = METRIC_BUCKETS - 1;
+    SlotAdd(&slot->histogram[histogram][bucket], 1);
+
+}  // End of UpdateMetricHistogram
+
+// called once per receive batch by each receiving thread
+void UpdateMetricReceive(uint32_t datagrams, uint32_t drops, uint32_t batchTime, uint32_t rcvbufUsage) {
+    // if no MetricThread is running
+    if (atomic_load(&tstart) == 0) return;
+
+    atomic_fetch_add_explicit(&recvDatagrams, datagrams, memory_order_relaxed);
+    if (drops) atomic_fetch_add_explicit(&recvDrops, drops, memory_order_relaxed);
+
+    uint32_t max = atomic_load_explicit(&recvMaxBatchTime, memory_order_relaxed);
+    while (batchTime > max && !atomic_compare_exchange_weak(&recvMaxBatchTime, &max, batchTime))
+        ;
+    max = atomic_load_explicit(&recvMaxRcvbufUsage, memory_order_relaxed);
+    while (rcvbufUsage > max && !atomic_compare_exchange_weak(&recvMaxRcvbufUsage, &max, rcvbufUsage))
+        ;
+
+}  // End of UpdateMetricReceive
+
+// add the changes of all slots since the last interval to their metric records
+static void CollectSlots(void) {
+    for (metricSlot_t *slot = slotList; slot; slot = slot->next) {
+        metric_record_t *metric_record = slot->record;
+        uint64_t *counter = &metric_record->numflows_tcp;
+        for (int i = 0; i < METRIC_COUNTERS; i++) {
+            uint64_t val = atomic_load_explicit(&slot->counter[i], memory_order_relaxed);
+            counter[i] += val - slot->lastCounter[i];
+            slot->lastCounter[i] = val;
+        }
+        for (int i = 0; i < METRIC_HISTOGRAMS; i++) {
+            for (int j = 0; j < METRIC_BUCKETS; j++) {
+                uint64_t val = atomic_load_explicit(&slot->histogram[i][j], memory_order_relaxed);
+                metric_record->histogram[i][j] += val - slot->lastHistogram[i][j];
+                slot->lastHistogram[i][j] = val;
+            }
+        }
+    }
+
+}  // End of CollectSlots
+
 __attribute__((noreturn)) void *MetricThread(void *arg) {
     dbg_printf("Started MetricThread\n");
     void *message = malloc(sizeof(message_header_t) + sizeof(metric_record_t));
@@ -220,7 +383,7 @@ __attribute__((noreturn)) void *MetricThread(void *arg) {
     time_t interval = 60;
     message_header_t *message_header = (message_header_t *)message;
     message_header->prefix = '@';
-    message_header->version = 1;
+    message_header->version = METRIC_VERSION;
     message_header->size = sizeof(metric_record_t);
     message_header->numMetrics = 1;
     message_header->timeStamp = 0;
@@ -247,7 +410,9 @@ __attribute__((noreturn)) void *MetricThread(void *arg) {
         uint64_t _tstart = atomic_load(&tstart);
         if (_tstart == 0) break;
 
+        pthread_mutex_lock(&mutex);
         if (numMetrics == 0) {
+            pthread_mutex_unlock(&mutex);
             dbg_printf("No metric available\n");
             sleepTime.tv_sec = interval - (te.tv_sec % interval) - 1;
             sleepTime.tv_nsec = 1000000000LL - 1000LL * te.tv_usec;
@@ -255,7 +420,6 @@ __attribute__((noreturn)) void *MetricThread(void *arg) {
         }
 
         dbg_printf("Process %u metrics\n", numMetrics);
-        pthread_mutex_lock(&mutex);
         if (numMetrics > cnt) {
             dbg_printf("Expand message: %u -> %u\n", cnt, numMetrics);
             void *_message = realloc(message, numMetrics * sizeof(metric_record_t) + sizeof(message_header_t));
@@ -271,6 +435,14 @@ __attribute__((noreturn)) void *MetricThread(void *arg) {
             message_header->numMetrics = cnt;
         }
 
+        CollectSlots();
+
+        // update receive path stats
+        message_header->datagrams = atomic_exchange(&recvDatagrams, 0);
+        message_header->kernelDrops = atomic_exchange(&recvDrops, 0);
+        message_header->maxBatchTime = atomic_exchange(&recvMaxBatchTime, 0);
+        message_header->maxRcvbufUsage = atomic_exchange(&recvMaxRcvbufUsage, 0);
+
         // update uptime
         message_header->uptime = te.tv_sec - _tstart;
         // update timestamp rounded correctly to the interval slot
@@ -34,6 +34,19 @@
 #include "nffile.h"
 #include "nfxV3.h"
 
+#define METRIC_VERSION 2
+
+// latency histograms
+#define METRIC_DECODETIME 0  // nanoseconds to decode a datagram
+#define METRIC_QUEUEDEPTH 1  // data blocks waiting for the writer thread
+#define METRIC_ROTATETIME 2  // microseconds to close and rename a rotated file
+#define METRIC_HISTOGRAMS 3
+#define METRIC_BUCKETS 32
+
+// counters of metric_record_t, which are not flow stats
+#define METRIC_DATAGRAMS 12
+#define METRIC_SEQFAILURES 13
+
 typedef struct message_header_s {
     char prefix;
     uint8_t version;
@@ -42,6 +55,12 @@ typedef struct message_header_s {
     uint16_t interval;
     uint64_t timeStamp;
     uint64_t uptime;
+
+    // receive path of the collector
+    uint64_t datagrams;
+    uint64_t kernelDrops;     // datagrams dropped by the kernel - SO_RXQ_OVFL
+    uint32_t maxBatchTime;    // max processing time of a receive batch in usec
+    uint32_t maxRcvbufUsage;  // max receive buffer occupancy in percent
 } message_header_t;
 
 typedef struct metric_record_s {
@@ -64,6 +83,14 @@ typedef struct metric_record_s {
     uint64_t numpackets_udp;
     uint64_t numpackets_icmp;
     uint64_t numpackets_other;
+
+    // datagram stat
+    uint64_t datagrams;
+    uint64_t sequence_failures;
+
+    // histograms - bucket 0: value 0, bucket n: 2^(n-1) <= value < 2^n
+    // the last bucket counts all larger values
+    uint64_t histogram[METRIC_HISTOGRAMS][METRIC_BUCKETS];
 } metric_record_t;
 
 typedef struct metric_chain_s {
@@ -75,8 +102,16 @@ int OpenMetric(char *path, int interval);
 
 int CloseMetric(void);
 
+int MetricActive(void);
+
 void UpdateMetric(char *ident, uint32_t exporterID, EXgenericFlow_t *genericFlow);
 
+void UpdateMetricCounter(char *ident, unsigned counter, uint64_t value);
+
+void UpdateMetricHistogram(char *ident, unsigned histogram, uint64_t value);
+
+void UpdateMetricReceive(uint32_t datagrams, uint32_t drops, uint32_t batchTime, uint32_t rcvbufUsage);
+
 void *MetricThread(void *arg);
 
 #define MetricExpporterID(r) (((r)->exporterID << 16) | (((r)->engineType << 8) | (r)->engineID))
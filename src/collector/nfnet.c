@@ -29,22 +29,38 @@
  *
  */
 
+// recvmmsg()
+#define _GNU_SOURCE
+
 #include "nfnet.h"
 
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "config.h"
+
+#ifdef HAVE_LINUX_SOCK_DIAG_H
+#include <linux/sock_diag.h>
+#endif
+
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
+#include "metric.h"
 #include "util.h"
 
 /* at least this number of byytes required, if we change the socket buffer */
@@ -57,9 +73,50 @@ static int isMulticast(struct sockaddr_storage *addr);
 
 static int joinGroup(int sockfd, int loopBack, int mcastTTL, struct sockaddr_storage *addr);
 
+static void EnableDropCounter(int sockfd);
+
+/*
+ * Batched receive
+ * Up to batchSize datagrams are read with a single recvmmsg() call into a ring
+ * of receive buffers and handed out one by one by RecvPacket(). The time stamp is
+ * taken once per batch. Without recvmmsg(), datagrams are read one by one with recvfrom().
+ */
+struct recvBatch_s {
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr *msgs;
+    struct iovec *iov;
+#endif
+    struct sockaddr_storage *sender;  // sender address of each datagram
+    socklen_t *senderSize;            // size of sender address
+    uint32_t *length;                 // length of each datagram
+    void *buffer;                     // batchSize receive buffers
+    size_t bufferSize;                // size of each receive buffer
+    uint32_t batchSize;               // number of receive buffers
+    uint32_t count;                   // number of datagrams in current batch
+    uint32_t next;                    // next datagram to hand out
+    struct timeval tv;                // time stamp of current batch
+#ifdef SO_RXQ_OVFL
+    void *control;                    // batchSize control buffers for the drop counter
+    uint32_t overflow;                // last SO_RXQ_OVFL drop counter of the socket
+#endif
+    uint32_t batchDrops;              // datagrams dropped before the current batch
+    uint32_t rcvbufUsage;             // receive buffer sample of the current batch
+    time_t lastSample;                // last receive buffer sample
+    // receive stats, read and reset by RecvStat()
+    _Atomic uint64_t datagrams;
+    _Atomic uint64_t batches;
+    _Atomic uint64_t drops;
+    _Atomic uint64_t batchTime;
+    _Atomic uint32_t maxBatchTime;
+    _Atomic uint32_t maxRcvbufUsage;
+};
+
+// size of a control buffer for the SO_RXQ_OVFL drop counter
+#define CONTROLSIZE CMSG_SPACE(sizeof(uint32_t))
+
 /* function definitions */
 
-int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen) {
+int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen, int reusePort) {
     struct addrinfo hints, *res, *ressave;
     socklen_t optlen;
     int error, p, sockfd;
@@ -107,6 +164,18 @@ int Unicast_receive_socket(const char *bindhost, const char *listenport, int fam
         if (!(sockfd < 0)) {
             // socket call was successful
 
+            // multiple sockets bound to the same port share the load
+            if (reusePort) {
+#ifdef SO_REUSEPORT
+                int one = 1;
+                if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+                    LogError("setsockopt(SO_REUSEPORT) failed: %s", strerror(errno));
+                }
+#else
+                LogError("SO_REUSEPORT not supported on this platform");
+#endif
+            }
+
             if (bind(sockfd, res->ai_addr, res->ai_addrlen) == 0) {
                 if (res->ai_family == AF_INET) LogInfo("Bound to IPv4 host/IP: %s, Port: %s", bindhost == NULL ? "any" : bindhost, listenport);
                 if (res->ai_family == AF_INET6) LogInfo("Bound to IPv6 host/IP: %s, Port: %s", bindhost == NULL ? "any" : bindhost, listenport);
@@ -149,11 +218,57 @@ int Unicast_receive_socket(const char *bindhost, const char *listenport, int fam
             LogInfo("System set setsockopt, SO_RCVBUF to %d bytes", p);
         }
     }
+    EnableDropCounter(sockfd);
 
     return sockfd;
 
 } /* End of Unicast_receive_socket */
 
+/*
+ * SO_REUSEPORT hashes the 4-tuple of a datagram to a socket of the group. Exporters, which
+ * send from several source ports, would be split over the sockets. Steer the datagrams by
+ * the source address only: hash the IPv4 address or the xor of the IPv6 address words.
+ */
+int ReusePortBySource(int sockfd, int numSockets) {
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 2, 0),
+        // IPv4
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+        BPF_JUMP(BPF_JMP | BPF_JA, 10, 0, 0),
+        // IPv6
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        // socket index
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 2654435761),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, numSockets),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = {.len = sizeof(code) / sizeof(code[0]), .filter = code};
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        LogError("setsockopt(SO_ATTACH_REUSEPORT_CBPF) failed: %s", strerror(errno));
+        return 0;
+    }
+    return 1;
+#else
+    LogError("SO_ATTACH_REUSEPORT_CBPF not supported on this platform");
+    return 0;
+#endif
+
+}  // End of ReusePortBySource
+
 int Unicast_send_socket(const char *hostname, const char *sendport, int family, unsigned int wmem_size, struct sockaddr_storage *addr, int *addrlen) {
     struct addrinfo hints, *res, *ressave;
     int error, sockfd;
@@ -230,6 +345,114 @@ int Unicast_send_socket(const char *hostname, const char *sendport, int family,
 
 }  // End of Unicast_send_socket
 
+/*
+ * TCP listen socket for nfd flow streams. Every accepted connection inherits
+ * the receive buffer size of the listen socket.
+ */
+int Stream_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen) {
+    struct addrinfo hints, *res, *ressave;
+
+    if (!listenport) {
+        LogError("listen port required!");
+        return -1;
+    }
+
+    if (bindhost == NULL && family == AF_UNSPEC) family = AF_INET;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_flags = AI_PASSIVE;
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int error = getaddrinfo(bindhost, listenport, &hints, &res);
+    if (error) {
+        LogError("getaddrinfo error: [%s]", gai_strerror(error));
+        return -1;
+    }
+
+    ressave = res;
+    int sockfd = -1;
+    for (; res; res = res->ai_next) {
+        if (res->ai_family != AF_INET && res->ai_family != AF_INET6) continue;
+
+        sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (sockfd < 0) continue;
+
+        int one = 1;
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(sockfd, res->ai_addr, res->ai_addrlen) == 0 && listen(sockfd, LISTEN_QUEUE) == 0) {
+            LogInfo("Accept flow streams on host/IP: %s, Port: %s", bindhost == NULL ? "any" : bindhost, listenport);
+            break;
+        }
+        close(sockfd);
+        sockfd = -1;
+    }
+    freeaddrinfo(ressave);
+
+    if (sockfd < 0) {
+        LogError("Stream socket error: could not open the requested socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (sockbuflen) {
+        if (sockbuflen < Min_SOCKBUFF_LEN) sockbuflen = Min_SOCKBUFF_LEN;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &sockbuflen, sizeof(sockbuflen)) != 0) {
+            LogError("setsockopt(SO_RCVBUF,%d): %s", sockbuflen, strerror(errno));
+        }
+    }
+
+    return sockfd;
+
+}  // End of Stream_receive_socket
+
+/*
+ * Connected TCP socket to send nfd flow streams. A full socket buffer blocks the
+ * sender, which is the back-pressure of a slow collector. The send buffer is left
+ * to the kernel autotuning.
+ */
+int Stream_send_socket(const char *hostname, const char *sendport, int family) {
+    struct addrinfo hints, *res, *ressave;
+
+    if (!hostname || !sendport) {
+        LogError("hostname and listen port required!");
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int error = getaddrinfo(hostname, sendport, &hints, &res);
+    if (error) {
+        LogError("getaddrinfo() error: %s", gai_strerror(error));
+        return -1;
+    }
+
+    ressave = res;
+    int sockfd = -1;
+    for (; res; res = res->ai_next) {
+        sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (sockfd < 0) continue;
+        if (connect(sockfd, res->ai_addr, res->ai_addrlen) == 0) break;
+        close(sockfd);
+        sockfd = -1;
+    }
+    freeaddrinfo(ressave);
+
+    if (sockfd < 0) {
+        LogError("connect() error: could not connect to %s port %s: %s", hostname, sendport, strerror(errno));
+        return -1;
+    }
+
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    return sockfd;
+
+}  // End of Stream_send_socket
+
 int Multicast_receive_socket(const char *hostname, const char *listenport, int family, int sockbuflen) {
     struct addrinfo hints, *res, *ressave;
     socklen_t optlen;
@@ -320,6 +543,7 @@ int Multicast_receive_socket(const char *hostname, const char *listenport, int f
             LogInfo("System set setsockopt, SO_RCVBUF to %d bytes", p);
         }
     }
+    EnableDropCounter(sockfd);
 
     return sockfd;
 
@@ -505,3 +729,226 @@ int LookupHost(char *hostname, char *port, struct sockaddr_in *addr) {
     }
     return res ? 0 : -1;
 }  // End of LookupHost
+
+// let the kernel report the number of dropped datagrams with each datagram
+static void EnableDropCounter(int sockfd) {
+#ifdef SO_RXQ_OVFL
+    int one = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) {
+        LogError("setsockopt(SO_RXQ_OVFL) failed: %s", strerror(errno));
+    }
+#endif
+}  // End of EnableDropCounter
+
+recvBatch_t *NewRecvBatch(uint32_t batchSize, size_t bufferSize) {
+#ifndef HAVE_RECVMMSG
+    batchSize = 1;
+#endif
+    if (batchSize == 0) batchSize = 1;
+
+    recvBatch_t *recvBatch = calloc(1, sizeof(recvBatch_t));
+    if (!recvBatch) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    recvBatch->batchSize = batchSize;
+    recvBatch->bufferSize = bufferSize;
+    recvBatch->buffer = malloc(batchSize * bufferSize);
+    recvBatch->sender = calloc(batchSize, sizeof(struct sockaddr_storage));
+    recvBatch->senderSize = calloc(batchSize, sizeof(socklen_t));
+    recvBatch->length = calloc(batchSize, sizeof(uint32_t));
+#ifdef HAVE_RECVMMSG
+    recvBatch->msgs = calloc(batchSize, sizeof(struct mmsghdr));
+    recvBatch->iov = calloc(batchSize, sizeof(struct iovec));
+#ifdef SO_RXQ_OVFL
+    recvBatch->control = calloc(batchSize, CONTROLSIZE);
+    if (!recvBatch->control) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        FreeRecvBatch(recvBatch);
+        return NULL;
+    }
+#endif
+    if (!recvBatch->msgs || !recvBatch->iov) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        FreeRecvBatch(recvBatch);
+        return NULL;
+    }
+#endif
+    if (!recvBatch->buffer || !recvBatch->sender || !recvBatch->senderSize || !recvBatch->length) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        FreeRecvBatch(recvBatch);
+        return NULL;
+    }
+
+#ifdef HAVE_RECVMMSG
+    for (int i = 0; i < batchSize; i++) {
+        recvBatch->iov[i].iov_base = recvBatch->buffer + i * bufferSize;
+        recvBatch->iov[i].iov_len = bufferSize;
+        recvBatch->msgs[i].msg_hdr.msg_iov = &recvBatch->iov[i];
+        recvBatch->msgs[i].msg_hdr.msg_iovlen = 1;
+        recvBatch->msgs[i].msg_hdr.msg_name = &recvBatch->sender[i];
+#ifdef SO_RXQ_OVFL
+        recvBatch->msgs[i].msg_hdr.msg_control = recvBatch->control + i * CONTROLSIZE;
+#endif
+    }
+#endif
+
+    return recvBatch;
+
+}  // End of NewRecvBatch
+
+void FreeRecvBatch(recvBatch_t *recvBatch) {
+    if (!recvBatch) return;
+#ifdef HAVE_RECVMMSG
+    free(recvBatch->msgs);
+    free(recvBatch->iov);
+#ifdef SO_RXQ_OVFL
+    free(recvBatch->control);
+#endif
+#endif
+    free(recvBatch->buffer);
+    free(recvBatch->sender);
+    free(recvBatch->senderSize);
+    free(recvBatch->length);
+    free(recvBatch);
+
+}  // End of FreeRecvBatch
+
+static inline void UpdateMax(_Atomic uint32_t *max, uint32_t val) {
+    if (val > atomic_load_explicit(max, memory_order_relaxed)) atomic_store_explicit(max, val, memory_order_relaxed);
+}  // End of UpdateMax
+
+// sample the receive buffer occupancy of the socket in percent
+static uint32_t RcvbufUsage(int sockfd) {
+#if defined(SO_MEMINFO) && defined(HAVE_LINUX_SOCK_DIAG_H)
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(meminfo);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0 && meminfo[SK_MEMINFO_RCVBUF]) {
+        return (100ULL * meminfo[SK_MEMINFO_RMEM_ALLOC]) / meminfo[SK_MEMINFO_RCVBUF];
+    }
+#endif
+    return 0;
+}  // End of RcvbufUsage
+
+// account the processing time of the current batch
+static void BatchDone(recvBatch_t *recvBatch) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t usec = 1000000LL * (now.tv_sec - recvBatch->tv.tv_sec) + now.tv_usec - recvBatch->tv.tv_usec;
+    atomic_fetch_add_explicit(&recvBatch->batches, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&recvBatch->batchTime, usec, memory_order_relaxed);
+    UpdateMax(&recvBatch->maxBatchTime, usec);
+
+    UpdateMetricReceive(recvBatch->count, recvBatch->batchDrops, usec, recvBatch->rcvbufUsage);
+
+}  // End of BatchDone
+
+/*
+ * return the next datagram of the current batch in buffer. Receive the next
+ * batch, if the current batch is exhausted. Returns the length of the datagram
+ * or -1 on error with errno set, as recvfrom().
+ */
+ssize_t RecvPacket(recvBatch_t *recvBatch, int sockfd, void **buffer, struct sockaddr_storage *sender, socklen_t *senderSize, struct timeval *tv) {
+    if (recvBatch->next == recvBatch->count) {
+        if (recvBatch->count) BatchDone(recvBatch);
+        recvBatch->next = recvBatch->count = 0;
+        recvBatch->batchDrops = 0;
+        recvBatch->rcvbufUsage = 0;
+#ifdef HAVE_RECVMMSG
+        for (int i = 0; i < recvBatch->batchSize; i++) {
+            recvBatch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+#ifdef SO_RXQ_OVFL
+            recvBatch->msgs[i].msg_hdr.msg_controllen = CONTROLSIZE;
+#endif
+        }
+        int ret = recvmmsg(sockfd, recvBatch->msgs, recvBatch->batchSize, MSG_WAITFORONE, NULL);
+        int err = errno;
+        for (int i = 0; i < ret; i++) {
+            recvBatch->length[i] = recvBatch->msgs[i].msg_len;
+            recvBatch->senderSize[i] = recvBatch->msgs[i].msg_hdr.msg_namelen;
+        }
+#ifdef SO_RXQ_OVFL
+        if (ret > 0) {
+            // the drop counter of the socket is sent with every datagram - the last one is the most recent
+            struct msghdr *msg_hdr = &recvBatch->msgs[ret - 1].msg_hdr;
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg_hdr); cmsg; cmsg = CMSG_NXTHDR(msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                    uint32_t overflow;
+                    memcpy(&overflow, CMSG_DATA(cmsg), sizeof(uint32_t));
+                    recvBatch->batchDrops = overflow - recvBatch->overflow;
+                    recvBatch->overflow = overflow;
+                    atomic_fetch_add_explicit(&recvBatch->drops, recvBatch->batchDrops, memory_order_relaxed);
+                }
+            }
+        }
+#endif
+#else
+        recvBatch->senderSize[0] = sizeof(struct sockaddr_storage);
+        ssize_t ret = recvfrom(sockfd, recvBatch->buffer, recvBatch->bufferSize, 0, (struct sockaddr *)recvBatch->sender, &recvBatch->senderSize[0]);
+        int err = errno;
+        if (ret >= 0) {
+            recvBatch->length[0] = ret;
+            ret = 1;
+        }
+#endif
+        // one time stamp per batch
+        gettimeofday(&recvBatch->tv, NULL);
+        *tv = recvBatch->tv;
+        if (ret < 0) {
+            errno = err;
+            return -1;
+        }
+        recvBatch->count = ret;
+        if (ret == 0) return 0;
+        atomic_fetch_add_explicit(&recvBatch->datagrams, ret, memory_order_relaxed);
+
+        // sample the backlog in the receive buffer once a second
+        if (recvBatch->tv.tv_sec != recvBatch->lastSample) {
+            recvBatch->lastSample = recvBatch->tv.tv_sec;
+            recvBatch->rcvbufUsage = RcvbufUsage(sockfd);
+            UpdateMax(&recvBatch->maxRcvbufUsage, recvBatch->rcvbufUsage);
+        }
+    }
+
+    uint32_t i = recvBatch->next++;
+    *buffer = recvBatch->buffer + i * recvBatch->bufferSize;
+    memcpy((void *)sender, (void *)&recvBatch->sender[i], recvBatch->senderSize[i]);
+    *senderSize = recvBatch->senderSize[i];
+    *tv = recvBatch->tv;
+
+    return recvBatch->length[i];
+
+}  // End of RecvPacket
+
+// account the exhausted batch now, before the caller blocks on other input
+void RecvBatchDone(recvBatch_t *recvBatch) {
+    if (recvBatch->count == 0 || recvBatch->next < recvBatch->count) return;
+    BatchDone(recvBatch);
+    recvBatch->next = recvBatch->count = 0;
+
+}  // End of RecvBatchDone
+
+// return the receive stats since the last call
+// datagrams of the current batch not yet returned by RecvPacket()
+int RecvPending(recvBatch_t *recvBatch) { return recvBatch->next < recvBatch->count; }  // End of RecvPending
+
+recvStat_t RecvStat(recvBatch_t *recvBatch) {
+    recvStat_t recvStat = {
+        .datagrams = atomic_exchange(&recvBatch->datagrams, 0),
+        .batches = atomic_exchange(&recvBatch->batches, 0),
+        .drops = atomic_exchange(&recvBatch->drops, 0),
+        .batchTime = atomic_exchange(&recvBatch->batchTime, 0),
+        .maxBatchTime = atomic_exchange(&recvBatch->maxBatchTime, 0),
+        .maxRcvbufUsage = atomic_exchange(&recvBatch->maxRcvbufUsage, 0),
+    };
+    return recvStat;
+
+}  // End of RecvStat
+
+void LogRecvStat(recvStat_t *recvStat) {
+    LogInfo("Received datagrams: %llu, Kernel drops: %llu, Batches: %llu, Avg batch time: %llu usec, Max batch time: %u usec, Max rcvbuf usage: %u%%",
+            (unsigned long long)recvStat->datagrams, (unsigned long long)recvStat->drops, (unsigned long long)recvStat->batches,
+            recvStat->batches ? (unsigned long long)(recvStat->batchTime / recvStat->batches) : 0ULL, recvStat->maxBatchTime, recvStat->maxRcvbufUsage);
+
+}  // End of LogRecvStat
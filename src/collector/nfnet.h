@@ -41,15 +41,32 @@
 #endif
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <stdint.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 /* Definitions */
 
 #define UDP_PACKET_SIZE 1472
 
+// opaque ring of receive buffers for batched receive
+typedef struct recvBatch_s recvBatch_t;
+
+// receive path stats of a recvBatch
+typedef struct recvStat_s {
+    uint64_t datagrams;       // received datagrams
+    uint64_t batches;         // processed batches
+    uint64_t drops;           // datagrams dropped by the kernel - SO_RXQ_OVFL
+    uint64_t batchTime;       // processing time of all batches in usec
+    uint32_t maxBatchTime;    // max processing time of a batch in usec
+    uint32_t maxRcvbufUsage;  // max receive buffer occupancy in percent
+} recvStat_t;
+
 /* Function prototypes */
 
-int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen);
+int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen, int reusePort);
+
+int ReusePortBySource(int sockfd, int numSockets);
 
 int Multicast_receive_socket(const char *hostname, const char *listenport, int family, int sockbuflen);
 
@@ -59,8 +76,26 @@ int Unicast_send_socket(const char *hostname, const char *listenport, int family
 int Multicast_send_socket(const char *hostname, const char *listenport, int family, unsigned int wmem_size, struct sockaddr_storage *addr,
                           int *addrlen);
 
+int Stream_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen);
+
+int Stream_send_socket(const char *hostname, const char *sendport, int family);
+
 int Raw_send_socket(int sockbuflen);
 
 int LookupHost(char *hostname, char *port, struct sockaddr_in *addr);
 
+recvBatch_t *NewRecvBatch(uint32_t batchSize, size_t bufferSize);
+
+void FreeRecvBatch(recvBatch_t *recvBatch);
+
+ssize_t RecvPacket(recvBatch_t *recvBatch, int sockfd, void **buffer, struct sockaddr_storage *sender, socklen_t *senderSize, struct timeval *tv);
+
+int RecvPending(recvBatch_t *recvBatch);
+
+void RecvBatchDone(recvBatch_t *recvBatch);
+
+recvStat_t RecvStat(recvBatch_t *recvBatch);
+
+void LogRecvStat(recvStat_t *recvStat);
+
 #endif  //_NFNET_H
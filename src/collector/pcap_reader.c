@@ -48,6 +48,7 @@
 #include <netinet/in.h>
 #include <netinet/in_systm.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
@@ -62,6 +63,18 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/mman.h>
+#ifdef TPACKET_V3
+#define PACKET_RING 1
+#endif
+#endif
+
 #include "pcap_reader.h"
 #include "util.h"
 
@@ -81,10 +94,29 @@
 #define PROTO_ERSPAN 0x88be
 #define PROTO_ERSPANIII 0x22be
 
+#ifndef ETHERTYPE_IPV6
+#define ETHERTYPE_IPV6 0x86DD
+#endif
+
 static pcap_t *pcap_handle;
 static int linktype = 0;
 static int linkoffset = 0;
 
+#ifdef PACKET_RING
+// TPACKET_V3 receive ring
+typedef struct packetRing_s {
+    int fd;
+    void *map;
+    struct tpacket_req3 req;
+    uint32_t blockNum;                   // current block
+    struct tpacket_block_desc *block;   // current block in user space or NULL
+    struct tpacket3_hdr *packet;        // next packet of current block
+    uint32_t packetsLeft;               // packets left in current block
+} packetRing_t;
+
+static packetRing_t packetRing = {0};
+#endif
+
 typedef struct vlan_hdr_s {
     uint16_t vlan_id;
     uint16_t type;
@@ -176,8 +208,14 @@ static int setup_pcap(char *filter) {
 
 } /* setup_pcap */
 
+/*
+ * decode a captured frame down to the UDP payload and copy the payload into buffer.
+ * The pcap file, pcap device and packet ring readers share this parse path.
+ * Returns the payload length, 0 for skipped frames and -1 for bad frames.
+ */
 static ssize_t decode_packet(struct pcap_pkthdr *hdr, u_char *pcap_pkgdata, void *buffer, size_t buffer_size, struct sockaddr *sock) {
     struct sockaddr_in *in_sock = (struct sockaddr_in *)sock;
+    struct sockaddr_in6 *in6_sock = (struct sockaddr_in6 *)sock;
     static unsigned pkg_cnt = 0;
 
     pkg_cnt++;
@@ -253,6 +291,7 @@ REDO_LINK:
     data += nextOffset;
 
     struct ip *ip = NULL;
+    struct ip6_hdr *ip6 = NULL;
 REDO_PROTO:
     if (data >= eodata) {
         dbg_printf("Short packet: %u, Check line: %u", hdr->caplen, __LINE__);
@@ -261,15 +300,29 @@ REDO_PROTO:
     switch (protocol) {
         case ETHERTYPE_IP:
             /* IPv4 */
+            if ((data + sizeof(struct ip)) > eodata) return -1;
             ip = (struct ip *)data;  // offset points to end of link layer
             in_sock->sin_family = AF_INET;
             in_sock->sin_addr = ip->ip_src;
 #ifdef HAVE_STRUCT_SOCKADDR_SA_LEN
             in_sock->sin_len = sizeof(struct sockaddr_in);
+#endif
+            break;
+        case ETHERTYPE_IPV6:
+            /* IPv6 */
+            // UDP without IPv6 extension headers only
+            if ((data + sizeof(struct ip6_hdr)) > eodata) return -1;
+            ip6 = (struct ip6_hdr *)data;
+            memset((void *)in6_sock, 0, sizeof(struct sockaddr_in6));
+            in6_sock->sin6_family = AF_INET6;
+            in6_sock->sin6_addr = ip6->ip6_src;
+#ifdef HAVE_STRUCT_SOCKADDR_SA_LEN
+            in6_sock->sin6_len = sizeof(struct sockaddr_in6);
 #endif
             break;
         case ETHERTYPE_VLAN:  // VLAN
             do {
+                if ((data + 4) > eodata) return -1;
                 vlan_hdr_t *vlan_hdr = (vlan_hdr_t *)data;
                 protocol = ntohs(vlan_hdr->type);
                 data += 4;
@@ -283,31 +336,40 @@ REDO_PROTO:
             break;
     }
 
-    /* for the moment we handle only IPv4 */
-    if (!ip || ip->ip_v != 4) return 0;
+    uint8_t nextProto;
+    if (ip6) {
+        nextProto = ip6->ip6_nxt;
+        data += sizeof(struct ip6_hdr);
+    } else {
+        if (!ip || ip->ip_v != 4) return 0;
 
-    // u_int version = ip->ip_v; /* ip version */
+        /* check header length */
+        if (ip->ip_hl < 5) {
+            LogError("bad-hlen %d", ip->ip_hl);
+            return 0;
+        }
 
-    /* check header length */
-    if (ip->ip_hl < 5) {
-        LogError("bad-hlen %d", ip->ip_hl);
-        return 0;
+        // add IP header length
+        nextProto = ip->ip_p;
+        data += (ip->ip_hl << 0x02);
     }
 
-    // add IP header length
-    data += (ip->ip_hl << 0x02);
-    switch (ip->ip_p) {
+    switch (nextProto) {
         case IPPROTO_UDP: {
             struct udphdr *udp = (struct udphdr *)((void *)data);
+            if ((data + sizeof(struct udphdr)) > eodata || ntohs(udp->uh_ulen) < sizeof(struct udphdr)) return -1;
             unsigned int packet_len = ntohs(udp->uh_ulen) - 8;
             void *payload = (void *)((void *)udp + sizeof(struct udphdr));
 
-            if (packet_len > buffer_size) {
+            if (packet_len > buffer_size || ((uint8_t *)payload + packet_len) > eodata) {
                 LogError("Buffer size error: %u > %zu", packet_len, buffer_size);
                 return -1;
             }
             memcpy(buffer, payload, packet_len);
-            in_sock->sin_port = udp->uh_sport;
+            if (ip6)
+                in6_sock->sin6_port = udp->uh_sport;
+            else
+                in_sock->sin_port = udp->uh_sport;
             return packet_len;
             // unreached
         } break;
@@ -436,6 +498,152 @@ int setup_pcap_offline(char *fname, char *filter) {
 
 } /* End of setup_pcap_offline */
 
+#ifdef PACKET_RING
+/*
+ * Packet ring device
+ * Read the flow datagrams from a TPACKET_V3 ring, shared with the kernel. The frames are
+ * parsed by decode_packet(). A syscall is only needed, if the ring is empty.
+ */
+int setup_ring_live(char *device, char *filter, int bufflen) {
+    unsigned int blocksiz = 1 << 22, framesiz = 1 << 11;
+    unsigned int blocknum = 16;
+
+    if (bufflen > 0) {
+        blocknum = bufflen / blocksiz;
+        if (blocknum < 4) blocknum = 4;
+    }
+
+    int fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        LogError("socket() failed: %s", strerror(errno));
+        return 0;
+    }
+
+    int v = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0) {
+        LogError("setsockopt(TPACKET_V3) failed: %s", strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    // let the kernel drop all other packets
+    if (filter) {
+        struct bpf_program filter_code;
+        pcap_t *p = pcap_open_dead(DLT_EN10MB, 1 << 16);
+        if (!p || pcap_compile(p, &filter_code, filter, 1, PCAP_NETMASK_UNKNOWN)) {
+            LogError("pcap_compile() failed: %s", p ? pcap_geterr(p) : "pcap_open_dead() failed");
+            if (p) pcap_close(p);
+            close(fd);
+            return 0;
+        }
+        struct sock_fprog fcode;
+        fcode.len = filter_code.bf_len;
+        fcode.filter = (struct sock_filter *)filter_code.bf_insns;
+        int err = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fcode, sizeof(fcode));
+        pcap_freecode(&filter_code);
+        pcap_close(p);
+        if (err < 0) {
+            LogError("setsockopt(SO_ATTACH_FILTER) failed: %s", strerror(errno));
+            close(fd);
+            return 0;
+        }
+    }
+
+    struct tpacket_req3 *req = &packetRing.req;
+    memset((void *)req, 0, sizeof(struct tpacket_req3));
+    req->tp_block_size = blocksiz;
+    req->tp_frame_size = framesiz;
+    req->tp_block_nr = blocknum;
+    req->tp_frame_nr = (blocksiz * blocknum) / framesiz;
+    req->tp_retire_blk_tov = 60;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, req, sizeof(struct tpacket_req3)) < 0) {
+        LogError("setsockopt(PACKET_RX_RING) failed: %s", strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    packetRing.map = mmap(NULL, req->tp_block_size * req->tp_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+    if (packetRing.map == MAP_FAILED) {
+        LogError("mmap() failed: %s", strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    struct sockaddr_ll ll;
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = PF_PACKET;
+    ll.sll_protocol = htons(ETH_P_ALL);
+    ll.sll_ifindex = if_nametoindex(device);
+    if (bind(fd, (struct sockaddr *)&ll, sizeof(ll)) < 0) {
+        LogError("bind() failed on %s: %s", device, strerror(errno));
+        munmap(packetRing.map, req->tp_block_size * req->tp_block_nr);
+        close(fd);
+        return 0;
+    }
+
+    packetRing.fd = fd;
+    packetRing.blockNum = 0;
+    packetRing.block = NULL;
+    packetRing.packetsLeft = 0;
+
+    linktype = DLT_EN10MB;
+    linkoffset = 14;
+
+    LogInfo("Packet ring on %s: %u blocks of %u bytes", device, blocknum, blocksiz);
+    return 1;
+
+}  // End of setup_ring_live
+
+ssize_t NextRingPacket(int fill1, void *buffer, size_t buffer_size, int fill2, struct sockaddr *sock, socklen_t *size) {
+    while (1) {
+        if (packetRing.packetsLeft == 0) {
+            // hand the current block back to the kernel
+            if (packetRing.block) {
+                __atomic_store_n(&packetRing.block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+                packetRing.block = NULL;
+                packetRing.blockNum = (packetRing.blockNum + 1) % packetRing.req.tp_block_nr;
+            }
+
+            struct tpacket_block_desc *block =
+                (struct tpacket_block_desc *)((uint8_t *)packetRing.map + packetRing.blockNum * packetRing.req.tp_block_size);
+            if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                // ring is empty - wait for the next block
+                struct pollfd pfd = {.fd = packetRing.fd, .events = POLLIN | POLLERR, .revents = 0};
+                int ready = poll(&pfd, 1, 1000);
+                if (ready < 0) return -1;
+                if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) return 0;
+            }
+
+            packetRing.block = block;
+            packetRing.packetsLeft = block->hdr.bh1.num_pkts;
+            packetRing.packet = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+            continue;
+        }
+
+        struct tpacket3_hdr *ppd = packetRing.packet;
+        packetRing.packetsLeft--;
+        packetRing.packet = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+
+        struct pcap_pkthdr phdr;
+        phdr.ts.tv_sec = ppd->tp_sec;
+        phdr.ts.tv_usec = ppd->tp_nsec / 1000;
+        phdr.caplen = ppd->tp_snaplen;
+        phdr.len = ppd->tp_len;
+
+        ssize_t len = decode_packet(&phdr, (u_char *)ppd + ppd->tp_mac, buffer, buffer_size, sock);
+        // skip all frames without flow data
+        if (len > 0) {
+            *size = sock->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+            return len;
+        }
+    }
+
+    // unreached
+
+}  // End of NextRingPacket
+#endif
+
 ssize_t NextPacket(int fill1, void *buffer, size_t buffer_size, int fill2, struct sockaddr *sock, socklen_t *size) {
     // ssize_t NextPacket(void *buffer, size_t buffer_size) {
     struct pcap_pkthdr *header;
@@ -445,6 +653,7 @@ ssize_t NextPacket(int fill1, void *buffer, size_t buffer_size, int fill2, struc
     i = pcap_next_ex(pcap_handle, &header, (const u_char **)&pkt_data);
     if (i != 1) return -2;
 
-    *size = sizeof(struct sockaddr_in);
-    return decode_packet(header, pkt_data, buffer, buffer_size, sock);
+    ssize_t len = decode_packet(header, pkt_data, buffer, buffer_size, sock);
+    *size = sock->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    return len;
 }
\ No newline at end of file
@@ -44,4 +44,10 @@ int setup_pcap_live(char *device, char *filter, int bufflen);
 
 ssize_t NextPacket(int fill1, void *buffer, size_t buffer_size, int fill2, struct sockaddr *sock, socklen_t *size);
 
+#ifdef __linux__
+int setup_ring_live(char *device, char *filter, int bufflen);
+
+ssize_t NextRingPacket(int fill1, void *buffer, size_t buffer_size, int fill2, struct sockaddr *sock, socklen_t *size);
+#endif
+
 #endif  //_PCAP_READER_H
\ No newline at end of file
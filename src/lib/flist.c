@@ -160,6 +160,12 @@
  * Example:
  * -M /path/to/source1:source2 -R 2006/03/31/nfcapd.200603312300:2006/04/01/nfcapd.200604010600
  *
+ * Sharded files
+ * -------------
+ * nfcapd -K writes a time slot into multiple files: nfcapd.200603312300, nfcapd.200603312300.1 ..
+ * The shards sort right after the first file of the slot. -r single_file also selects the
+ * shards of single_file and -R first_file:last_file includes the shards of last_file.
+ *
  */
 
 /*
@@ -227,6 +233,10 @@ static void *FileLister_thr(void *arg);
 
 static int CheckTimeWindow(char *filename, timeWindow_t *searchWindow);
 
+static int CompareLastFile(char *name, char *last);
+
+static void PushSingleFile(char *filename, timeWindow_t *searchWindow);
+
 /* Functions */
 
 static int compare(const FTSENT **f1, const FTSENT **f2) { return strcmp((*f1)->fts_name, (*f2)->fts_name); }  // End of compare
@@ -733,7 +743,7 @@ static void GetFileList(char *path) {
                 if (file_list_level &&
                     ((fts_level != file_list_level) ||
                      (dir_entry_filter[fts_level].first_entry && (strcmp(ftsent->fts_name, dir_entry_filter[fts_level].first_entry) < 0)) ||
-                     (dir_entry_filter[fts_level].last_entry && (strcmp(ftsent->fts_name, dir_entry_filter[fts_level].last_entry) > 0))))
+                     (dir_entry_filter[fts_level].last_entry && (CompareLastFile(ftsent->fts_name, dir_entry_filter[fts_level].last_entry) > 0))))
                     continue;
 
                 queue_push(file_queue, strdup(ftsent->fts_path));
@@ -855,9 +865,7 @@ static void *FileLister_thr(void *arg) {
 
         if (source_dirs.num_strings == 0) {
             // single file -r
-            if (CheckTimeWindow(single_file, flist->timeWindow)) {
-                queue_push(file_queue, strdup(single_file));
-            }
+            PushSingleFile(single_file, flist->timeWindow);
         } else {
             // single file -r in multiple dirs -M
             int i;
@@ -880,9 +888,7 @@ static void *FileLister_thr(void *arg) {
                         if (sub_dir) {  // subdir found
                             snprintf(s, MAXPATHLEN - 1, "%s/%s/%s", source_dirs.list[i], sub_dir, single_file);
                             s[MAXPATHLEN - 1] = '\0';
-                            if (CheckTimeWindow(s, flist->timeWindow)) {
-                                queue_push(file_queue, strdup(s));
-                            }
+                            PushSingleFile(s, flist->timeWindow);
                         } else {  // no subdir found
                             LogError("stat() error '%s': %s", s, "File not found!");
                         }
@@ -894,9 +900,7 @@ static void *FileLister_thr(void *arg) {
                     if (!S_ISREG(stat_buf.st_mode)) {
                         LogError("Skip non file entry: '%s'", s);
                     } else {
-                        if (CheckTimeWindow(s, flist->timeWindow)) {
-                            queue_push(file_queue, strdup(s));
-                        }
+                        PushSingleFile(s, flist->timeWindow);
                     }
                 }
             }
@@ -1131,3 +1135,38 @@ static int CheckTimeWindow(char *filename, timeWindow_t *searchWindow) {
     return 1;
 
 }  // End of CheckTimeWindow
+
+// compare a file name with the last file of a range. The shards of the last file count as equal
+static int CompareLastFile(char *name, char *last) {
+    size_t len = strlen(last);
+    if (strncmp(name, last, len) == 0 && name[len] == '.' && isdigit((int)name[len + 1])) {
+        char *p = &name[len + 1];
+        while (isdigit((int)*p)) p++;
+        if (*p == '\0') return 0;
+    }
+
+    return strcmp(name, last);
+
+}  // End of CompareLastFile
+
+// queue a single file and all shards of the same time slot, written by nfcapd -K
+static void PushSingleFile(char *filename, timeWindow_t *searchWindow) {
+    if (CheckTimeWindow(filename, searchWindow)) {
+        queue_push(file_queue, strdup(filename));
+    }
+
+    char *name = strrchr(filename, '/');
+    name = name ? name + 1 : filename;
+    if (strncmp(name, "nfcapd.", 7) != 0) return;
+
+    for (int i = 1; i < 1024; i++) {
+        char s[MAXPATHLEN];
+        snprintf(s, MAXPATHLEN - 1, "%s.%d", filename, i);
+        s[MAXPATHLEN - 1] = '\0';
+        if (TestPath(s, S_IFREG) != PATH_OK) break;
+        if (CheckTimeWindow(s, searchWindow)) {
+            queue_push(file_queue, strdup(s));
+        }
+    }
+
+}  // End of PushSingleFile
@@ -60,6 +60,11 @@
 
 #define SamplerRecordType 15
 
-#define MaxRecordID 15
+// nfdump element stat cache records
+#define StatCacheInfoType 16
+#define StatCacheRecordType 17
+#define StatCacheSketchType 18
+
+#define MaxRecordID 18
 
 #endif
\ No newline at end of file
@@ -1168,6 +1168,60 @@ int WriteBlock(nffile_t *nffile) {
 
 }  // End of WriteBlock
 
+/*
+ * A worker file appends data blocks to nffile from a different thread.
+ * It owns its data block and stat record, but shares the block queue and
+ * writer thread of nffile. The caller must make sure, no worker file appends
+ * data, while nffile is closed and re-opened.
+ */
+nffile_t *OpenWorkerFile(nffile_t *nffile) {
+    nffile_t *workerFile = calloc(1, sizeof(nffile_t));
+    if (!workerFile) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    workerFile->stat_record = calloc(1, sizeof(stat_record_t));
+    workerFile->block_header = NewDataBlock();
+    if (!workerFile->stat_record || !workerFile->block_header) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        DisposeWorkerFile(workerFile);
+        return NULL;
+    }
+    workerFile->stat_record->firstseen = 0x7fffffffffffffff;
+    workerFile->buff_size = BUFFSIZE;
+    workerFile->buff_ptr = (void *)((pointer_addr_t)workerFile->block_header + sizeof(dataBlock_t));
+    workerFile->processQueue = nffile->processQueue;
+    if (nffile->ident) workerFile->ident = strdup(nffile->ident);
+
+    return workerFile;
+
+}  // End of OpenWorkerFile
+
+// push the pending block of the worker file and add its stat record to nffile
+void FlushWorkerFile(nffile_t *workerFile, nffile_t *nffile) {
+    WriteBlock(workerFile);
+    SumStatRecords(nffile->stat_record, workerFile->stat_record);
+
+    memset((void *)workerFile->stat_record, 0, sizeof(stat_record_t));
+    workerFile->stat_record->firstseen = 0x7fffffffffffffff;
+
+}  // End of FlushWorkerFile
+
+// attach the worker file to the process queue of a new nffile after a file rotation
+void AttachWorkerFile(nffile_t *workerFile, nffile_t *nffile) {
+    workerFile->processQueue = nffile->processQueue;
+
+}  // End of AttachWorkerFile
+
+void DisposeWorkerFile(nffile_t *workerFile) {
+    if (workerFile->block_header) FreeDataBlock(workerFile->block_header);
+    if (workerFile->stat_record) free(workerFile->stat_record);
+    if (workerFile->ident) free(workerFile->ident);
+    free(workerFile);
+
+}  // End of DisposeWorkerFile
+
 static int nfwrite(nffile_t *nffile, dataBlock_t *block_header) {
     if (block_header->size == 0) {
         return 1;
@@ -276,6 +276,14 @@ int ReadBlock(nffile_t *nffile);
 
 int WriteBlock(nffile_t *nffile);
 
+nffile_t *OpenWorkerFile(nffile_t *nffile);
+
+void FlushWorkerFile(nffile_t *workerFile, nffile_t *nffile);
+
+void AttachWorkerFile(nffile_t *workerFile, nffile_t *nffile);
+
+void DisposeWorkerFile(nffile_t *workerFile);
+
 void SetIdent(nffile_t *nffile, char *Ident);
 
 void ModifyCompressFile(int compress);
@@ -41,6 +41,14 @@
 #include "nfdump.h"
 #include "util.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define HAVE_SHUFFLE 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_SHUFFLE 1
+#endif
+
 // sub template IDs
 #define subTemplateListType 292
 #define subTemplateMultiListType 293
@@ -75,6 +83,239 @@ static void CompactSequencer(sequencer_t *sequencer) {
 
 }  // End of CompactSequencer
 
+static inline void CopyNumber(const void *inBuff, uint16_t inLength, void *out, uint16_t outLength, uint16_t stackID, uint64_t *stack);
+
+#ifdef HAVE_SHUFFLE
+/*
+ * A compiled sequencer is a byte permutation from the input record into the output
+ * elements, as each number conversion is a byte swap with zero extension or truncation.
+ * Each 16 byte output chunk, with all its source bytes within a 16 byte input window,
+ * is converted by a single byte shuffle, merged with the preset element headers.
+ */
+typedef struct shuffleChunk_s {
+    int32_t inOffset;  // start of input window, -1: gather bytes
+    uint8_t mask[16];  // shuffle mask, 0x80: no input byte
+} shuffleChunk_t;
+
+typedef struct sequencerShuffle_s {
+    uint32_t numChunks;    // full 16 byte output chunks
+    uint32_t numStackOps;  // ops, which stack a value
+    sequenceOp_t *stackOps;
+    int32_t *byteMap;  // input offset of each output byte, -1: preset byte
+    shuffleChunk_t chunk[];
+} sequencerShuffle_t;
+
+static int ShuffleSupported(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("ssse3");
+#else
+    return 1;
+#endif
+}  // End of ShuffleSupported
+
+static void FreeShuffle(sequencerShuffle_t *shuffle) {
+    if (!shuffle) return;
+    free(shuffle->stackOps);
+    free(shuffle->byteMap);
+    free(shuffle);
+}  // End of FreeShuffle
+
+static sequencerShuffle_t *CompileShuffle(sequencer_t *sequencer) {
+    uint32_t inLength = sequencer->inLength;
+    uint32_t outLength = sequencer->outLength;
+    if (inLength < 16 || outLength < 16 || !ShuffleSupported()) return NULL;
+
+    uint32_t numChunks = outLength >> 4;
+    sequencerShuffle_t *shuffle = calloc(1, sizeof(sequencerShuffle_t) + numChunks * sizeof(shuffleChunk_t));
+    int32_t *byteMap = malloc(outLength * sizeof(int32_t));
+    sequenceOp_t *stackOps = calloc(sequencer->numOps, sizeof(sequenceOp_t));
+    if (!shuffle || !byteMap || !stackOps) {
+        LogError("CompileShuffle: calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        free(shuffle);
+        free(byteMap);
+        free(stackOps);
+        return NULL;
+    }
+    shuffle->numChunks = numChunks;
+    shuffle->byteMap = byteMap;
+    shuffle->stackOps = stackOps;
+    for (int i = 0; i < outLength; i++) byteMap[i] = -1;
+
+    // map each output byte to its input byte
+    for (int i = 0; i < sequencer->numOps; i++) {
+        sequenceOp_t *op = &(sequencer->opList[i]);
+        // the interpreter stacks numbers only
+        if (op->stackID && op->copyMode != ByteCopy && op->inLength <= 16) {
+            stackOps[shuffle->numStackOps] = *op;
+            stackOps[shuffle->numStackOps].outLength = 0;
+            shuffle->numStackOps++;
+        }
+        if (op->outLength == 0) continue;
+
+        if (op->copyMode == ByteCopy || op->inLength > 16) {
+            uint32_t copyLen = op->inLength < op->outLength ? op->inLength : op->outLength;
+            for (int j = 0; j < copyLen; j++) byteMap[op->outOffset + j] = op->inOffset + j;
+        } else {
+            if (op->outLength > 16) {
+                FreeShuffle(shuffle);
+                return NULL;
+            }
+            // convert numbered input bytes to find the position of each byte in the output
+            uint8_t in[16], out[16];
+            for (int j = 0; j < 16; j++) in[j] = j + 1;
+            memset(out, 0, sizeof(out));
+            CopyNumber(in, op->inLength, out, op->outLength, 0, NULL);
+            for (int j = 0; j < op->outLength; j++) byteMap[op->outOffset + j] = out[j] ? op->inOffset + out[j] - 1 : -1;
+        }
+    }
+
+    for (int i = 0; i < numChunks; i++) {
+        shuffleChunk_t *chunk = &(shuffle->chunk[i]);
+        int32_t *map = byteMap + (i << 4);
+        int32_t lo = INT32_MAX, hi = -1;
+        for (int j = 0; j < 16; j++) {
+            if (map[j] < 0) continue;
+            if (map[j] < lo) lo = map[j];
+            if (map[j] > hi) hi = map[j];
+        }
+        if (hi < 0) {
+            chunk->inOffset = 0;
+        } else if ((hi - lo) < 16) {
+            // keep the window within the input record
+            chunk->inOffset = (lo + 16) > inLength ? inLength - 16 : lo;
+        } else {
+            chunk->inOffset = -1;
+            continue;
+        }
+        for (int j = 0; j < 16; j++) chunk->mask[j] = map[j] < 0 ? 0x80 : map[j] - chunk->inOffset;
+    }
+
+    return shuffle;
+
+}  // End of CompileShuffle
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3")))
+#endif
+static void RunShuffle(sequencerShuffle_t *shuffle, const uint8_t *in, uint8_t *out, const uint8_t *image) {
+    uint32_t i = 0;
+    for (; i < shuffle->numChunks; i++) {
+        shuffleChunk_t *chunk = &(shuffle->chunk[i]);
+        uint32_t offset = i << 4;
+        if (chunk->inOffset < 0) {
+            int32_t *map = shuffle->byteMap + offset;
+            for (int j = 0; j < 16; j++) out[offset + j] = map[j] < 0 ? image[offset + j] : in[map[j]];
+            continue;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + chunk->inOffset)), _mm_loadu_si128((const __m128i *)chunk->mask));
+        v = _mm_or_si128(v, _mm_loadu_si128((const __m128i *)(image + offset)));
+        _mm_storeu_si128((__m128i *)(out + offset), v);
+#else
+        uint8x16_t v = vqtbl1q_u8(vld1q_u8(in + chunk->inOffset), vld1q_u8(chunk->mask));
+        vst1q_u8(out + offset, vorrq_u8(v, vld1q_u8(image + offset)));
+#endif
+    }
+
+}  // End of RunShuffle
+#endif
+
+/*
+ * Compile a fixed length template into a list of straight-line copy operations
+ * and a preset output image with all element headers. Templates with var length
+ * or sub template elements are processed by the sequencer interpreter
+ */
+static void CompileSequencer(sequencer_t *sequencer) {
+    if (sequencer->inLength == 0 || sequencer->outLength == 0) return;
+
+    for (int i = 0; i < sequencer->numSequences; i++) {
+        uint16_t type = sequencer->sequenceTable[i].inputType;
+        if (type == subTemplateListType || type == subTemplateMultiListType) return;
+    }
+
+    sequenceOp_t *opList = calloc(sequencer->numSequences, sizeof(sequenceOp_t));
+    uint8_t *outImage = calloc(1, sequencer->outLength);
+    if (!opList || !outImage) {
+        LogError("CompileSequencer: calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        free(opList);
+        free(outImage);
+        return;
+    }
+
+    // add elements in the same order as the interpreter does
+    int32_t extOffset[MAXEXTENSIONS];
+    for (int i = 0; i < MAXEXTENSIONS; i++) extOffset[i] = -1;
+    sequencer->numExtensions = 0;
+
+    uint32_t inOffset = 0;
+    uint32_t outSize = 0;
+    uint32_t numOps = 0;
+    for (int i = 0; i < sequencer->numSequences; i++) {
+        sequence_t *sequence = &(sequencer->sequenceTable[i]);
+        uint32_t ExtID = sequence->extensionID;
+        uint32_t inLength = sequence->inputLength;
+
+        // skip sequence
+        if (ExtID == EXnull && sequence->stackID == 0) {
+            inOffset += inLength;
+            continue;
+        }
+
+        if (ExtID != EXnull && extOffset[ExtID] < 0) {
+            elementHeader_t *elementHeader = (elementHeader_t *)(outImage + outSize);
+            elementHeader->type = extensionTable[ExtID].id;
+            elementHeader->length = sequencer->ExtSize[ExtID];
+            extOffset[ExtID] = outSize + sizeof(elementHeader_t);
+            outSize += sequencer->ExtSize[ExtID];
+            sequencer->extensionList[sequencer->numExtensions] = ExtID;
+            sequencer->extensionOffset[sequencer->numExtensions] = extOffset[ExtID];
+            sequencer->numExtensions++;
+        }
+
+        // placeholder sequence
+        if (inLength == 0) continue;
+
+        // CopyNumber converts at most 16 bytes
+        if (sequence->copyMode != ByteCopy && inLength > 16) {
+            dbg_printf("CompileSequencer() number length %u - use interpreter\n", inLength);
+            free(opList);
+            free(outImage);
+            return;
+        }
+
+        sequenceOp_t *op = &opList[numOps++];
+        op->inOffset = inOffset;
+        op->inLength = inLength;
+        op->copyMode = sequence->copyMode;
+        op->stackID = sequence->stackID;
+        if (ExtID == EXnull) {
+            // stack only
+            op->outOffset = 0;
+            op->outLength = 0;
+        } else {
+            op->outOffset = extOffset[ExtID] + sequence->offsetRel;
+            op->outLength = sequence->outputLength;
+        }
+        inOffset += inLength;
+    }
+
+    if (inOffset != sequencer->inLength || outSize != sequencer->outLength) {
+        dbg_printf("CompileSequencer() length mismatch - use interpreter\n");
+        free(opList);
+        free(outImage);
+        return;
+    }
+
+    sequencer->opList = opList;
+    sequencer->numOps = numOps;
+    sequencer->outImage = outImage;
+#ifdef HAVE_SHUFFLE
+    sequencer->shuffle = CompileShuffle(sequencer);
+#endif
+    dbg_printf("CompileSequencer() compiled %u sequences into %u ops\n", sequencer->numSequences, numOps);
+
+}  // End of CompileSequencer
+
 uint16_t *SetupSequencer(sequencer_t *sequencer, sequence_t *sequenceTable, uint32_t numSequences) {
     memset((void *)sequencer->ExtSize, 0, sizeof(sequencer->ExtSize));
 
@@ -129,6 +370,7 @@ uint16_t *SetupSequencer(sequencer_t *sequencer, sequence_t *sequenceTable, uint
     if (!hasVarInLength && !hasVarOutLength) {
         dbg_printf("SetupSequencer() Fixed length fields, found %u elements in %u sequences\n", sequencer->numElements, sequencer->numSequences);
         dbg_printf("SetupSequencer() Calculated input length: %lu, output length: %lu\n", sequencer->inLength, sequencer->outLength);
+        CompileSequencer(sequencer);
     }
 
     // dynamically create extension list
@@ -152,6 +394,11 @@ uint16_t *SetupSequencer(sequencer_t *sequencer, sequence_t *sequenceTable, uint
 
 void ClearSequencer(sequencer_t *sequencer) {
     if (sequencer->sequenceTable) free(sequencer->sequenceTable);
+    if (sequencer->opList) free(sequencer->opList);
+    if (sequencer->outImage) free(sequencer->outImage);
+#ifdef HAVE_SHUFFLE
+    FreeShuffle((sequencerShuffle_t *)sequencer->shuffle);
+#endif
 
     memset((void *)sequencer, 0, sizeof(sequencer_t));
 
@@ -242,10 +489,154 @@ static int ProcessSubTemplate(sequencer_t *sequencer, uint16_t type, const void
 
 }  // End of ProcessSubTemplate
 
+// convert a number of inLength bytes in network byte order into an outLength host number
+static inline void CopyNumber(const void *inBuff, uint16_t inLength, void *out, uint16_t outLength, uint16_t stackID, uint64_t *stack) {
+    uint64_t valBuff[2];
+    memset(valBuff, 0, sizeof(valBuff));
+    switch (inLength) {
+        case 1:
+            valBuff[0] = ((uint8_t *)inBuff)[0];
+            break;
+        case 2:
+            valBuff[0] = Get_val16(inBuff);
+            break;
+        case 3:
+            valBuff[0] = Get_val24(inBuff);
+            break;
+        case 4:
+            valBuff[0] = Get_val32(inBuff);
+            break;
+        case 5:
+            valBuff[0] = Get_val40(inBuff);
+            break;
+        case 6:
+            valBuff[0] = Get_val48(inBuff);
+            break;
+        case 7:
+            valBuff[0] = Get_val56(inBuff);
+            break;
+        case 8:
+            valBuff[0] = Get_val64(inBuff);
+            break;
+        case 16:
+            valBuff[0] = Get_val64(inBuff);
+            valBuff[1] = Get_val64(inBuff + 8);
+            break;
+        default:
+            // for length 9, 10, 11 and 12
+            memcpy(valBuff, inBuff, inLength < sizeof(valBuff) ? inLength : sizeof(valBuff));
+            break;
+    }
+#ifdef DEVEL
+    printf("Read length: %u, val: %llx %llx, outLength: %u\n", inLength, (long long unsigned)valBuff[0], (long long unsigned)valBuff[1], outLength);
+#endif
+    if (stackID && stack) {
+        stack[stackID] = valBuff[0];
+        dbg_printf("Stack value %llu in slot %u\n", (long long unsigned)valBuff[0], stackID);
+    }
+
+    switch (outLength) {
+        case 0:
+            // do not store this value - use this to stack a value
+            dbg_printf("No output for number\n");
+            break;
+        case 1: {
+            uint8_t *d = (uint8_t *)out;
+            *d = valBuff[0];
+        } break;
+        case 2: {
+            uint16_t *d = (uint16_t *)out;
+            *d = valBuff[0];
+        } break;
+        case 4: {
+            uint32_t *d = (uint32_t *)out;
+            *d = valBuff[0];
+        } break;
+        case 8: {
+            uint64_t *d = (uint64_t *)out;
+            *d = valBuff[0];
+        } break;
+        case 16: {
+            memcpy(out, valBuff, 16);
+        } break;
+        default: {
+            // for length 9, 10, 11 and 12
+            uint32_t copyLen = inLength < outLength ? inLength : outLength;
+            memcpy(out, valBuff, copyLen);
+        }
+    }
+
+}  // End of CopyNumber
+
+// run a compiled sequencer: preset all output elements and process the op list
+static int RunCompiledSequencer(sequencer_t *sequencer, const void *inBuff, size_t inSize, void *outBuff, size_t outSize, uint64_t *stack) {
+    if (sequencer->inLength > inSize) {
+        LogError("SequencerRun() ERROR - Attempt to read beyond input stream size");
+        dbg_printf("Attempt to read beyond input stream size: inLength: %zu, inSize: %zu\n", sequencer->inLength, inSize);
+        return SEQ_ERROR;
+    }
+
+    recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)outBuff;
+    if ((recordHeaderV3->size + sequencer->outLength) > outSize) {
+        dbg_printf("Size error add output elements: header size: %u, elements size: %zu, output size: %zu\n", recordHeaderV3->size,
+                   sequencer->outLength, outSize);
+        return SEQ_MEM_ERR;
+    }
+
+    uint8_t *out = (uint8_t *)outBuff + recordHeaderV3->size;
+    const uint8_t *in = (const uint8_t *)inBuff;
+
+    // set the offset cache as the interpreter does
+    memset((void *)sequencer->offsetCache, 0, MAXEXTENSIONS * sizeof(void *));
+    for (int i = 0; i < sequencer->numExtensions; i++) {
+        sequencer->offsetCache[sequencer->extensionList[i]] = out + sequencer->extensionOffset[i];
+    }
+
+#ifdef HAVE_SHUFFLE
+    sequencerShuffle_t *shuffle = (sequencerShuffle_t *)sequencer->shuffle;
+    if (shuffle) {
+        RunShuffle(shuffle, in, out, sequencer->outImage);
+        // trailing bytes of the last partial chunk
+        for (uint32_t j = shuffle->numChunks << 4; j < sequencer->outLength; j++) {
+            int32_t map = shuffle->byteMap[j];
+            out[j] = map < 0 ? ((uint8_t *)sequencer->outImage)[j] : in[map];
+        }
+        for (int i = 0; i < shuffle->numStackOps; i++) {
+            sequenceOp_t *op = &(shuffle->stackOps[i]);
+            CopyNumber(in + op->inOffset, op->inLength, NULL, 0, op->stackID, stack);
+        }
+
+        recordHeaderV3->size += sequencer->outLength;
+        recordHeaderV3->numElements += sequencer->numElements;
+        return SEQ_OK;
+    }
+#endif
+
+    memcpy(out, sequencer->outImage, sequencer->outLength);
+    for (int i = 0; i < sequencer->numOps; i++) {
+        sequenceOp_t *op = &(sequencer->opList[i]);
+        if (op->copyMode == ByteCopy || op->inLength > 16) {
+            size_t copyLen = op->inLength < op->outLength ? op->inLength : op->outLength;
+            memcpy(out + op->outOffset, in + op->inOffset, copyLen);
+        } else {
+            CopyNumber(in + op->inOffset, op->inLength, out + op->outOffset, op->outLength, op->stackID, stack);
+        }
+    }
+
+    recordHeaderV3->size += sequencer->outLength;
+    recordHeaderV3->numElements += sequencer->numElements;
+
+    return SEQ_OK;
+
+}  // End of RunCompiledSequencer
+
 // SequencerRun requires calling CalcOutRecordSize first
 int SequencerRun(sequencer_t *sequencer, const void *inBuff, size_t inSize, void *outBuff, size_t outSize, uint64_t *stack) {
     static int nestLevel = 0;
 
+    // straight-line decoder for fixed length templates
+    if (sequencer->opList && inSize) return RunCompiledSequencer(sequencer, inBuff, inSize, outBuff, outSize, stack);
+
     nestLevel++;
     dbg_printf("[%u] Run sequencer ID: %u, inSize: %zu, outSize: %zu\n", nestLevel, sequencer->templateID, inSize, outSize);
 
@@ -377,83 +768,7 @@ int SequencerRun(sequencer_t *sequencer, const void *inBuff, size_t inSize, void
                 memcpy(out, inBuff, copyLen);
             }
         } else {
-            uint64_t valBuff[2];
-            memset(valBuff, 0, sizeof(valBuff));
-            switch (inLength) {
-                case 1:
-                    valBuff[0] = ((uint8_t *)inBuff)[0];
-                    break;
-                case 2:
-                    valBuff[0] = Get_val16(inBuff);
-                    break;
-                case 3:
-                    valBuff[0] = Get_val24(inBuff);
-                    break;
-                case 4:
-                    valBuff[0] = Get_val32(inBuff);
-                    break;
-                case 5:
-                    valBuff[0] = Get_val40(inBuff);
-                    break;
-                case 6:
-                    valBuff[0] = Get_val48(inBuff);
-                    break;
-                case 7:
-                    valBuff[0] = Get_val56(inBuff);
-                    break;
-                case 8:
-                    valBuff[0] = Get_val64(inBuff);
-                    break;
-                case 16:
-                    valBuff[0] = Get_val64(inBuff);
-                    valBuff[1] = Get_val64(inBuff + 8);
-                    break;
-                default:
-                    // for length 9, 10, 11 and 12
-                    memcpy(valBuff, inBuff, inLength);
-                    break;
-            }
-#ifdef DEVEL
-            printf("[%i] Type: %u, read length: %u, val: %llx %llx, outLength: %u\n", i, sequencer->sequenceTable[i].inputType,
-                   sequencer->sequenceTable[i].inputLength, (long long unsigned)valBuff[0], (long long unsigned)valBuff[1], outLength);
-#endif
-            if (stackID && stack) {
-                stack[stackID] = valBuff[0];
-                dbg_printf("Stack value %llu in slot %u\n", (long long unsigned)valBuff[0], stackID);
-            }
-
-            switch (outLength) {
-                case 0:
-                    // do not store this value - use this to stack a value
-                    dbg_printf("No output for sequence %i\n", i);
-                    break;
-                case 1: {
-                    uint8_t *d = (uint8_t *)(outRecord + sequencer->sequenceTable[i].offsetRel);
-                    *d = valBuff[0];
-                } break;
-                case 2: {
-                    uint16_t *d = (uint16_t *)(outRecord + sequencer->sequenceTable[i].offsetRel);
-                    *d = valBuff[0];
-                } break;
-                case 4: {
-                    uint32_t *d = (uint32_t *)(outRecord + sequencer->sequenceTable[i].offsetRel);
-                    *d = valBuff[0];
-                } break;
-                case 8: {
-                    uint64_t *d = (uint64_t *)(outRecord + sequencer->sequenceTable[i].offsetRel);
-                    *d = valBuff[0];
-                } break;
-                case 16: {
-                    uint64_t *d = (uint64_t *)(outRecord + sequencer->sequenceTable[i].offsetRel);
-                    memcpy(d, valBuff, 16);
-                } break;
-                default: {
-                    // for length 9, 10, 11 and 12
-                    uint8_t *d = (uint8_t *)(outRecord + sequencer->sequenceTable[i].offsetRel);
-                    uint32_t copyLen = inLength < outLength ? inLength : outLength;
-                    memcpy(d, valBuff, copyLen);
-                }
-            }
+            CopyNumber(inBuff, inLength, outRecord + sequencer->sequenceTable[i].offsetRel, outLength, stackID, stack);
         }
 
         inBuff += inLength;
@@ -481,6 +796,7 @@ void PrintSequencer(sequencer_t *sequencer) {
     printf("Has VarOutLength : %s\n", sequencer->outLength == 0 ? "true" : "false");
     printf("Inlength         : %zu\n", sequencer->inLength);
     printf("Outlength        : %zu\n", sequencer->outLength);
+    printf("Compiled ops     : %u\n", sequencer->numOps);
     printf("Sequences\n");
     for (int i = 0; i < sequencer->numSequences; i++) {
         int extID = sequencer->sequenceTable[i].extensionID;
@@ -698,6 +698,16 @@ typedef struct sequence_s {
     uint16_t stackID;
 } sequence_t;
 
+// straight-line operation of a compiled sequencer
+typedef struct sequenceOp_s {
+    uint32_t inOffset;   // offset in input record
+    uint32_t outOffset;  // offset in output elements
+    uint16_t inLength;
+    uint16_t outLength;
+    uint16_t copyMode;
+    uint16_t stackID;
+} sequenceOp_t;
+
 typedef struct sequencer_s {
     struct sequencer_s *next;
     void *offsetCache[MAXEXTENSIONS];
@@ -708,6 +718,14 @@ typedef struct sequencer_s {
     uint32_t numElements;
     size_t inLength;
     size_t outLength;
+    // compiled sequencer for fixed length templates
+    sequenceOp_t *opList;
+    uint32_t numOps;
+    void *outImage;  // preset output elements
+    void *shuffle;   // SIMD byte shuffle of the compiled sequencer
+    uint32_t numExtensions;
+    uint16_t extensionList[MAXEXTENSIONS];    // extension IDs in outImage
+    uint16_t extensionOffset[MAXEXTENSIONS];  // offset of the extension data in outImage
 } sequencer_t;
 
 #define SEQ_OK 0
@@ -47,6 +47,7 @@
 #include "config.h"
 #include "exporter.h"
 #include "fnf.h"
+#include "khash.h"
 #include "metric.h"
 #include "nbar.h"
 #include "nfdump.h"
@@ -78,6 +79,8 @@ enum {
  * 	All Observation Domains from all exporter are stored in a linked list
  *	which uniquely can identify each exporter/Observation Domain
  */
+KHASH_MAP_INIT_INT(templateHash, templateList_t *)
+
 typedef struct exporterDomain_s {
     struct exporterDomain_s *next;  // linkes list to next exporter
 
@@ -117,6 +120,9 @@ typedef struct exporterDomain_s {
     // list of all templates of this exporter
     templateList_t *template;
 
+    // hash index of the template list by template ID
+    khash_t(templateHash) *templateHash;
+
 } exporterDomain_t;
 
 static int ExtensionsEnabled[MAXEXTENSIONS];
@@ -402,14 +408,8 @@ static int LookupElement(uint16_t type, uint32_t EnterpriseNumber) {
 static exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t ObservationDomain) {
 #define IP_STRING_LEN 40
     char ipstr[IP_STRING_LEN];
-    exporterDomain_t **e = (exporterDomain_t **)&(fs->exporter_data);
-
-    while (*e) {
-        if ((*e)->info.id == ObservationDomain && (*e)->info.version == 10 && (*e)->info.ip.V6[0] == fs->ip.V6[0] &&
-            (*e)->info.ip.V6[1] == fs->ip.V6[1])
-            return *e;
-        e = &((*e)->next);
-    }
+    exporterDomain_t *e = (exporterDomain_t *)LookupExporter(fs, 10, ObservationDomain);
+    if (e) return e;
 
     if (fs->sa_family == AF_INET) {
         uint32_t _ip = htonl(fs->ip.V4);
@@ -424,26 +424,32 @@ static exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t ObservationDomai
     }
 
     // nothing found
-    *e = (exporterDomain_t *)calloc(1, sizeof(exporterDomain_t));
-    if (!(*e)) {
+    e = (exporterDomain_t *)calloc(1, sizeof(exporterDomain_t));
+    if (!e) {
         LogError("Process_ipfix: Panic! malloc() %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return NULL;
     }
-    (*e)->info.header.type = ExporterInfoRecordType;
-    (*e)->info.header.size = sizeof(exporter_info_record_t);
-    (*e)->info.id = ObservationDomain;
-    (*e)->info.ip = fs->ip;
-    (*e)->info.sa_family = fs->sa_family;
-    (*e)->info.version = 10;
-    (*e)->info.sysid = 0;
-
-    (*e)->TemplateRecords = 0;
-    (*e)->DataRecords = 0;
-    (*e)->sequence_failure = 0;
-    (*e)->next = NULL;
-    (*e)->sampler = NULL;
-
-    FlushInfoExporter(fs, &((*e)->info));
+    e->info.header.type = ExporterInfoRecordType;
+    e->info.header.size = sizeof(exporter_info_record_t);
+    e->info.id = ObservationDomain;
+    e->info.ip = fs->ip;
+    e->info.sa_family = fs->sa_family;
+    e->info.version = 10;
+    e->info.sysid = 0;
+
+    e->TemplateRecords = 0;
+    e->DataRecords = 0;
+    e->sequence_failure = 0;
+    e->sampler = NULL;
+
+    e->templateHash = kh_init(templateHash);
+    if (!InsertExporter(fs, (exporter_t *)e)) {
+        kh_destroy(templateHash, e->templateHash);
+        free(e);
+        return NULL;
+    }
+
+    FlushInfoExporter(fs, &(e->info));
 
     if (defaultSampling < 0) {
         // map hard overwrite sampling into a static sampler
@@ -452,7 +458,7 @@ static exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t ObservationDomai
         sampler_record.packetInterval = 1;
         sampler_record.algorithm = 0;
         sampler_record.spaceInterval = (-defaultSampling) - 1;
-        InsertSampler(fs, (*e), &sampler_record);
+        InsertSampler(fs, e, &sampler_record);
         dbg_printf("Add static sampler for overwrite sampling: %d\n", -defaultSampling);
     } else if (defaultSampling > 1) {
         // map default sampling > 1 into a static sampler
@@ -461,15 +467,15 @@ static exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t ObservationDomai
         sampler_record.packetInterval = 1;
         sampler_record.algorithm = 0;
         sampler_record.spaceInterval = defaultSampling - 1;
-        InsertSampler(fs, (*e), &sampler_record);
+        InsertSampler(fs, e, &sampler_record);
         dbg_printf("Add static sampler for default sampling: %u\n", defaultSampling);
     }
 
-    dbg_printf("[%u] New ipfix exporter: SysID: %u, Observation domain %u from: %s:%u\n", ObservationDomain, (*e)->info.sysid, ObservationDomain,
+    dbg_printf("[%u] New ipfix exporter: SysID: %u, Observation domain %u from: %s:%u\n", ObservationDomain, e->info.sysid, ObservationDomain,
                ipstr, fs->port);
-    LogInfo("Process_ipfix: New ipfix exporter: SysID: %u, Observation domain %u from: %s", (*e)->info.sysid, ObservationDomain, ipstr);
+    LogInfo("Process_ipfix: New ipfix exporter: SysID: %u, Observation domain %u from: %s", e->info.sysid, ObservationDomain, ipstr);
 
-    return (*e);
+    return e;
 
 }  // End of getExporter
 
@@ -570,14 +576,12 @@ static templateList_t *getTemplate(exporterDomain_t *exporter, uint16_t id) {
 
     if (exporter->currentTemplate && (exporter->currentTemplate->id == id)) return exporter->currentTemplate;
 
-    template = exporter->template;
-    while (template) {
-        if (template->id == id) {
-            exporter->currentTemplate = template;
-            dbg_printf("[%u] Get template - found %u\n", exporter->info.id, id);
-            return template;
-        }
-        template = template->next;
+    khiter_t k = kh_get(templateHash, exporter->templateHash, id);
+    if (k != kh_end(exporter->templateHash)) {
+        template = kh_value(exporter->templateHash, k);
+        exporter->currentTemplate = template;
+        dbg_printf("[%u] Get template - found %u\n", exporter->info.id, id);
+        return template;
     }
 
     dbg_printf("[%u] Get template - not found %u\n", exporter->info.id, id);
@@ -596,6 +600,15 @@ static templateList_t *newTemplate(exporterDomain_t *exporter, uint16_t id) {
         return NULL;
     }
 
+    int ret;
+    khiter_t k = kh_put(templateHash, exporter->templateHash, id, &ret);
+    if (ret < 0) {
+        LogError("kh_put() error in %s line %d", __FILE__, __LINE__);
+        free(template);
+        return NULL;
+    }
+    kh_value(exporter->templateHash, k) = template;
+
     // init the new template
     template->next = exporter->template;
     template->updated = time(NULL);
@@ -629,6 +642,9 @@ static void removeTemplate(exporterDomain_t *exporter, uint16_t id) {
     // clear table cache, if this is the table to delete
     if (exporter->currentTemplate == template) exporter->currentTemplate = NULL;
 
+    khiter_t k = kh_get(templateHash, exporter->templateHash, id);
+    if (k != kh_end(exporter->templateHash)) kh_del(templateHash, exporter->templateHash, k);
+
     if (parent) {
         // remove temeplate from list
         parent->next = template->next;
@@ -669,6 +685,9 @@ static void removeAllTemplates(exporterDomain_t *exporter) {
 
         template = next;
     }
+    exporter->template = NULL;
+    exporter->currentTemplate = NULL;
+    kh_clear(templateHash, exporter->templateHash);
 
 }  // End of removeAllTemplates
 
@@ -45,6 +45,7 @@
 
 #include "bookkeeper.h"
 #include "collector.h"
+#include "lz4.h"
 #include "metric.h"
 #include "nfd_raw.h"
 #include "nfdump.h"
@@ -69,12 +70,14 @@ typedef struct exporter_nfd_s {
     sampler_t *sampler;  // list of samplers associated with this exporter
                          // end of struct exporter_s
 
+    uint32_t sequence;  // next expected stream frame - 0 if unknown
+
 } exporter_nfd_t;
 
 /* module limited globals */
 static int printRecord;
 
-static inline exporter_nfd_t *getExporter(FlowSource_t *fs, nfd_header_t *header);
+static inline exporter_nfd_t *getExporter(FlowSource_t *fs, uint16_t version);
 
 /* functions */
 
@@ -85,9 +88,8 @@ int Init_pcapd(int verbose) {
     return 1;
 }  // End of Init_pcapd
 
-static inline exporter_nfd_t *getExporter(FlowSource_t *fs, nfd_header_t *header) {
+static inline exporter_nfd_t *getExporter(FlowSource_t *fs, uint16_t version) {
     exporter_nfd_t **e = (exporter_nfd_t **)&(fs->exporter_data);
-    uint16_t version = ntohs(header->version);
 #define IP_STRING_LEN 40
     char ipstr[IP_STRING_LEN];
 
@@ -156,11 +158,56 @@ static void *GetExtension(recordHeaderV3_t *recordHeader, int extensionID) {
 
 }  // End of GetExtension
 
+static inline void UpdateFlowStat(FlowSource_t *fs, recordHeaderV3_t *recordHeaderV3, uint64_t msecReceived) {
+    EXgenericFlow_t *genericFlow = GetExtension(recordHeaderV3, EXgenericFlowID);
+    if (!genericFlow) return;
+
+    genericFlow->msecReceived = msecReceived;
+
+    // Update stats
+    switch (genericFlow->proto) {
+        case IPPROTO_ICMP:
+            fs->nffile->stat_record->numflows_icmp++;
+            fs->nffile->stat_record->numpackets_icmp += genericFlow->inPackets;
+            fs->nffile->stat_record->numbytes_icmp += genericFlow->inBytes;
+            // fix odd CISCO behaviour for ICMP port/type in src port
+            if (genericFlow->srcPort != 0) {
+                uint8_t *s1 = (uint8_t *)&(genericFlow->srcPort);
+                uint8_t *s2 = (uint8_t *)&(genericFlow->dstPort);
+                s2[0] = s1[1];
+                s2[1] = s1[0];
+                genericFlow->srcPort = 0;
+            }
+            break;
+        case IPPROTO_TCP:
+            fs->nffile->stat_record->numflows_tcp++;
+            fs->nffile->stat_record->numpackets_tcp += genericFlow->inPackets;
+            fs->nffile->stat_record->numbytes_tcp += genericFlow->inBytes;
+            break;
+        case IPPROTO_UDP:
+            fs->nffile->stat_record->numflows_udp++;
+            fs->nffile->stat_record->numpackets_udp += genericFlow->inPackets;
+            fs->nffile->stat_record->numbytes_udp += genericFlow->inBytes;
+            break;
+        default:
+            fs->nffile->stat_record->numflows_other++;
+            fs->nffile->stat_record->numpackets_other += genericFlow->inPackets;
+            fs->nffile->stat_record->numbytes_other += genericFlow->inBytes;
+    }
+    fs->nffile->stat_record->numflows++;
+    fs->nffile->stat_record->numpackets += genericFlow->inPackets;
+    fs->nffile->stat_record->numbytes += genericFlow->inBytes;
+
+    uint32_t exporterIdent = MetricExpporterID(recordHeaderV3);
+    UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
+
+}  // End of UpdateFlowStat
+
 void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
     // map pacpd data structure to input buffer
     nfd_header_t *pcapd_header = (nfd_header_t *)in_buff;
 
-    exporter_nfd_t *exporter = getExporter(fs, pcapd_header);
+    exporter_nfd_t *exporter = getExporter(fs, ntohs(pcapd_header->version));
     if (!exporter) {
         LogError("Process_nfd: NULL Exporter: Skip pcapd record processing");
         return;
@@ -243,47 +290,7 @@ void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
 
         dbg_printf("Record: %u elements, size: %u\n\n", copiedV3->numElements, copiedV3->size);
 
-        EXgenericFlow_t *genericFlow = GetExtension(recordHeaderV3, EXgenericFlowID);
-        if (genericFlow) {
-            genericFlow->msecReceived = msecReceived;
-
-            // Update stats
-            switch (genericFlow->proto) {
-                case IPPROTO_ICMP:
-                    fs->nffile->stat_record->numflows_icmp++;
-                    fs->nffile->stat_record->numpackets_icmp += genericFlow->inPackets;
-                    fs->nffile->stat_record->numbytes_icmp += genericFlow->inBytes;
-                    // fix odd CISCO behaviour for ICMP port/type in src port
-                    if (genericFlow->srcPort != 0) {
-                        uint8_t *s1 = (uint8_t *)&(genericFlow->srcPort);
-                        uint8_t *s2 = (uint8_t *)&(genericFlow->dstPort);
-                        s2[0] = s1[1];
-                        s2[1] = s1[0];
-                        genericFlow->srcPort = 0;
-                    }
-                    break;
-                case IPPROTO_TCP:
-                    fs->nffile->stat_record->numflows_tcp++;
-                    fs->nffile->stat_record->numpackets_tcp += genericFlow->inPackets;
-                    fs->nffile->stat_record->numbytes_tcp += genericFlow->inBytes;
-                    break;
-                case IPPROTO_UDP:
-                    fs->nffile->stat_record->numflows_udp++;
-                    fs->nffile->stat_record->numpackets_udp += genericFlow->inPackets;
-                    fs->nffile->stat_record->numbytes_udp += genericFlow->inBytes;
-                    break;
-                default:
-                    fs->nffile->stat_record->numflows_other++;
-                    fs->nffile->stat_record->numpackets_other += genericFlow->inPackets;
-                    fs->nffile->stat_record->numbytes_other += genericFlow->inBytes;
-            }
-            fs->nffile->stat_record->numflows++;
-            fs->nffile->stat_record->numpackets += genericFlow->inPackets;
-            fs->nffile->stat_record->numbytes += genericFlow->inBytes;
-
-            uint32_t exporterIdent = MetricExpporterID(recordHeaderV3);
-            UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
-        }
+        UpdateFlowStat(fs, recordHeaderV3, msecReceived);
 
         numRecords++;
         exporter->flows++;
@@ -313,3 +320,127 @@ void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
     return;
 
 } /* End of Process_nfd */
+
+/*
+ * Validate a stream frame header received from the wire and convert it to host byte order.
+ * Returns 0 for an invalid header - the stream is out of sync and must be dropped.
+ */
+int CheckFrame_nfd(nfd_frame_t *frame) {
+    frame->version = ntohs(frame->version);
+    frame->flags = ntohs(frame->flags);
+    frame->length = ntohl(frame->length);
+    frame->rawLength = ntohl(frame->rawLength);
+    frame->numRecord = ntohl(frame->numRecord);
+    frame->sequence = ntohl(frame->sequence);
+    frame->exportTime = ntohl(frame->exportTime);
+
+    if (frame->version != NFD_STREAM || frame->rawLength < sizeof(recordHeaderV3_t) || frame->rawLength > NFD_FRAMESIZE) {
+        LogError("Process_nfd: invalid stream frame - version: %u, length: %u", frame->version, frame->rawLength);
+        return 0;
+    }
+
+    if (frame->flags & NFD_FRAME_LZ4) {
+        if (frame->length == 0 || frame->length > LZ4_COMPRESSBOUND(NFD_FRAMESIZE)) {
+            LogError("Process_nfd: invalid compressed frame length: %u", frame->length);
+            return 0;
+        }
+    } else if (frame->length != frame->rawLength) {
+        LogError("Process_nfd: frame length mismatch: %u/%u", frame->length, frame->rawLength);
+        return 0;
+    }
+
+    return 1;
+
+}  // End of CheckFrame_nfd
+
+/*
+ * The sender of a stream reserves the EXipReceived extension in each record - fill in the
+ * exporter address. A v4 mapped IPv6 address of an IPv4 sender is stored as IPv4 address.
+ */
+static inline void SetReceivedIP(FlowSource_t *fs, recordHeaderV3_t *recordHeaderV3) {
+    EXipReceivedV4_t *ipReceivedV4 = GetExtension(recordHeaderV3, EXipReceivedV4ID);
+    if (ipReceivedV4) {
+        ipReceivedV4->ip = fs->ip.V4;
+        return;
+    }
+    EXipReceivedV6_t *ipReceivedV6 = GetExtension(recordHeaderV3, EXipReceivedV6ID);
+    if (ipReceivedV6) {
+        ipReceivedV6->ip[0] = fs->ip.V6[0];
+        ipReceivedV6->ip[1] = fs->ip.V6[1];
+    }
+
+}  // End of SetReceivedIP
+
+/*
+ * Process a complete stream frame. The records are copied or decompressed into the output
+ * data block and verified there. The exporter address is filled into the EXipReceived
+ * extension reserved by the sender.
+ * Returns 0 for a corrupt frame - the stream is out of sync and must be dropped.
+ */
+int ProcessFrame_nfd(FlowSource_t *fs, nfd_frame_t *frame, void *data) {
+    exporter_nfd_t *exporter = getExporter(fs, NFD_PROTOCOL);
+    if (!exporter) {
+        LogError("Process_nfd: NULL Exporter: Skip pcapd record processing");
+        return 0;
+    }
+    exporter->packets++;
+
+    // frames lost on a broken connection
+    if (exporter->sequence && frame->sequence != exporter->sequence) {
+        exporter->sequence_failure++;
+        fs->nffile->stat_record->sequence_failure++;
+        LogVerbose("Process_nfd: frame sequence error: expected %u, received %u", exporter->sequence, frame->sequence);
+    }
+    exporter->sequence = frame->sequence + 1;
+
+    if (CheckBufferSpace(fs->nffile, frame->rawLength) == 0) return 0;
+    if (frame->flags & NFD_FRAME_LZ4) {
+        int len = LZ4_decompress_safe(data, fs->nffile->buff_ptr, frame->length, frame->rawLength);
+        if (len != (int)frame->rawLength) {
+            LogError("Process_nfd: LZ4 decompress failed: %d", len);
+            return 0;
+        }
+    } else {
+        memcpy(fs->nffile->buff_ptr, data, frame->rawLength);
+    }
+
+    uint64_t msecReceived = ((uint64_t)fs->received.tv_sec * 1000LL) + (uint64_t)((uint64_t)fs->received.tv_usec / 1000LL);
+
+    void *buffPtr = fs->nffile->buff_ptr;
+    uint32_t size_left = frame->rawLength;
+    uint32_t numRecords = 0;
+    int ok = 1;
+    while (size_left >= sizeof(recordHeaderV3_t)) {
+        recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)buffPtr;
+        if (recordHeaderV3->size > size_left || VerifyV3Record(recordHeaderV3) == 0) {
+            LogError("Malformed nfd record received");
+            ok = 0;
+            break;
+        }
+
+        SetReceivedIP(fs, recordHeaderV3);
+        UpdateFlowStat(fs, recordHeaderV3, msecReceived);
+        numRecords++;
+        exporter->flows++;
+
+        if (printRecord) {
+            flow_record_short(stdout, recordHeaderV3);
+        }
+
+        size_left -= recordHeaderV3->size;
+        buffPtr += recordHeaderV3->size;
+    }
+
+    // account the verified records in the data block
+    uint32_t processed = frame->rawLength - size_left;
+    fs->nffile->buff_ptr += processed;
+    fs->nffile->block_header->size += processed;
+    fs->nffile->block_header->NumRecords += numRecords;
+
+    if (ok && size_left) LogInfo("ProcessFrame_nfd(): bytes left in frame: %u", size_left);
+
+    if (numRecords != frame->numRecord) LogInfo("ProcessFrame_nfd(): expected %u records, processd: %u", frame->numRecord, numRecords);
+
+    return ok;
+
+}  // End of ProcessFrame_nfd
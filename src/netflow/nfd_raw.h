@@ -46,9 +46,31 @@ typedef struct nfd_header {
     uint32_t numRecord;     // number of pcapd records in this packet
 } nfd_header_t;
 
+/*
+ * nfd flow stream over TCP: each frame carries up to NFD_FRAMESIZE bytes of V3 records,
+ * optionally LZ4 compressed. All header fields are in network byte order.
+ */
+#define NFD_STREAM 251
+#define NFD_FRAMESIZE (1024 * 1024)
+#define NFD_FRAME_LZ4 0x1
+
+typedef struct nfd_frame_s {
+    uint16_t version;     // set to 251 for nfd streams
+    uint16_t flags;       // NFD_FRAME_LZ4
+    uint32_t length;      // length of the frame data following this header
+    uint32_t rawLength;   // length of the uncompressed records
+    uint32_t numRecord;   // number of records in this frame
+    uint32_t sequence;    // incremental frame counter modulo 2^32
+    uint32_t exportTime;  // UNIX epoch export Time of frame
+} nfd_frame_t;
+
 /* prototypes */
 int Init_pcapd(int verbose);
 
 void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs);
 
+int CheckFrame_nfd(nfd_frame_t *frame);
+
+int ProcessFrame_nfd(FlowSource_t *fs, nfd_frame_t *frame, void *data);
+
 #endif  // _NFD_RAW_H
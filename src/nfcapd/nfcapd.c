@@ -35,6 +35,8 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -60,6 +62,7 @@
 #include "collector.h"
 #include "daemon.h"
 #include "flist.h"
+#include "khash.h"
 #include "ipfix.h"
 #include "launch.h"
 #include "metric.h"
@@ -99,9 +102,75 @@ static int verbose = 0;
 // Define a generic type to get data from socket or pcap file
 typedef ssize_t (*packet_function_t)(int, void *, size_t, int, struct sockaddr *, socklen_t *);
 
+// max number of -W receive workers
+#define MAXWORKERS 64
+
+typedef struct worker_s {
+    pthread_t tid;
+    int id;
+    int socket;
+    int rfd;
+    // held while a datagram gets processed
+    pthread_mutex_t mutex;
+    // worker copy of the flow sources
+    FlowSource_t *FlowSource;
+    uint32_t ignored_packets;
+    recvBatch_t *recvBatch;
+} worker_t;
+
+// number of rotated files, which may wait for the I/O thread
+#define CLOSEQUEUESIZE 1024
+
+// a rotated file, handed over to the I/O thread
+typedef struct closeJob_s {
+    FlowSource_t *fs;
+    nffile_t *nffile;
+    int shard;
+    time_t t_start;
+    int pfd;
+    uint32_t bad_packets;
+    char *subdir;
+    char fmt[32];
+    // name of the rotated file until it gets renamed
+    char closeName[MAXPATHLEN];
+} closeJob_t;
+
+// max number of concurrent nfpcapd flow streams -L
+#define MAXSTREAMS 16
+
+// a flow stream gets dropped, if a frame is not complete after this number of seconds
+#define STREAMTIMEOUT 10
+
+// an accepted nfpcapd flow stream - frames are received in pieces without blocking
+typedef struct stream_s {
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    time_t start;       // first data of the current frame
+    uint32_t fill;      // bytes received of the current frame incl. header
+    uint32_t size;      // size of the data buffer
+    nfd_frame_t frame;  // header of the current frame
+    void *data;         // data of the current frame
+} stream_t;
+
 /* module limited globals */
 static FlowSource_t *FlowSource;
 
+// serializes repeater messages of the workers
+static pthread_mutex_t repeaterMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// rotated files to be closed by the I/O thread
+static queue_t *closeQueue = NULL;
+static pthread_t ioThreadID;
+
+// number of output files per flow source -K
+static int numShards = 1;
+
+// TCP flow streams -L
+static int streamSock = 0;
+static int numStreams = 0;
+static stream_t streams[MAXSTREAMS];
+
 static int done = 0;
 static int gotSIGCHLD = 0;
 static int periodic_trigger;
@@ -113,11 +182,14 @@ static void signalPrivsepChild(pid_t child_pid, int pfd);
 
 static void IntHandler(int signal);
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss);
+static inline FlowSource_t *GetFlowSource(FlowSource_t *sourceList, struct sockaddr_storage *ss);
 
 static void run(packet_function_t receive_packet, int socket, int pfd, int rfd, time_t twin, time_t t_begin, int use_subdirs, char *time_extension,
                 int compress);
 
+static void runWorkers(int *sockets, int numWorkers, int pfd, int rfd, time_t twin, time_t t_begin, int use_subdirs, char *time_extension,
+                       int compress);
+
 /* Functions */
 static void usage(char *name) {
     printf(
@@ -129,9 +201,11 @@ static void usage(char *name) {
         "-b host\t\tbind socket to host/IP addr\n"
         "-J mcastgroup\tJoin multicast group <mcastgroup>\n"
         "-p portnum\tlisten on port portnum\n"
+        "-L portnum\tAccept nfpcapd flow streams over TCP on port portnum\n"
 #ifdef PCAP
         "-f pcapfile\tRead network data from pcap file.\n"
         "-d device\tRead network data from device (interface).\n"
+        "-r device\tRead network data from device (interface) using a packet ring.\n"
 #endif
         "-w flowdir \tset the output directory to store the flows.\n"
         "-C <file>\tRead optional config file.\n"
@@ -146,10 +220,13 @@ static void usage(char *name) {
         "-A\t\tEnable source address spoofing for packet repeater -R.\n"
         "-s rate\tset default sampling rate (default 1)\n"
         "-x process\tlaunch process after a new file becomes available\n"
+        "-k statlist\tBuild nfdump -k stat rollup <file>.stat for the comma separated -s stats\n"
         "-z\t\tLZO compress flows in output file.\n"
         "-y\t\tLZ4 compress flows in output file.\n"
         "-j\t\tBZ2 compress flows in output file.\n"
         "-B bufflen\tSet socket buffer to bufflen bytes\n"
+        "-W num\t\tReceive and decode with num worker threads on SO_REUSEPORT sockets.\n"
+        "-K num\t\tWrite the flows of each source into num files per time slot. Requires -W.\n"
         "-e\t\tExpire data at each cycle.\n"
         "-D\t\tFork to background\n"
         "-E\t\tPrint extended format of netflow data. For debugging purpose only.\n"
@@ -274,35 +351,49 @@ static int SendRepeaterMessage(int fd, void *in_buff, size_t cnt, struct sockadd
     return 0;
 }  // End of SendRepeaterMessage
 
-static void run(packet_function_t receive_packet, int socket, int pfd, int rfd, time_t twin, time_t t_begin, int use_subdirs, char *time_extension,
-                int compress) {
-    common_flow_header_t *nf_header;
-    FlowSource_t *fs;
-    struct sockaddr_storage nf_sender;
-    socklen_t nf_sender_size = sizeof(nf_sender);
-    time_t t_start, t_now;
-    uint32_t ignored_packets;
-    uint16_t version;
-    ssize_t cnt;
-    void *in_buff;
+/*
+ * Shard 0 keeps the plain file name, all other shards of a time slot get the
+ * shard number appended: nfcapd.202301011200, nfcapd.202301011200.1 etc.
+ */
+static void ShardName(char *buff, size_t len, char *name, int shard) {
+    int ret = shard ? snprintf(buff, len, "%s.%d", name, shard) : snprintf(buff, len, "%s", name);
+    if (ret < 0 || (size_t)ret >= len) LogError("File name truncated: %s", buff);
+
+}  // End of ShardName
+
+// open the writing files of a flow source
+static int OpenSourceFiles(FlowSource_t *fs, int compress) {
+    fs->numShards = numShards;
+    for (int i = 0; i < fs->numShards; i++) {
+        char current[MAXPATHLEN];
+        ShardName(current, sizeof(current), fs->current, i);
+        fs->shard[i] = OpenNewFile(current, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
+        if (!fs->shard[i]) return 0;
+        SetIdent(fs->shard[i], fs->Ident);
+    }
+    fs->nffile = fs->shard[0];
 
-    in_buff = malloc(NETWORK_INPUT_BUFF_SIZE);
-    if (!in_buff) {
-        LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return;
+    return 1;
+
+}  // End of OpenSourceFiles
+
+static void DisposeSourceFiles(FlowSource_t *fs) {
+    for (int i = 0; i < fs->numShards; i++) {
+        if (fs->shard[i]) DisposeFile(fs->shard[i]);
+        fs->shard[i] = NULL;
     }
+    fs->nffile = NULL;
 
-    nf_header = (common_flow_header_t *)in_buff;
+}  // End of DisposeSourceFiles
 
+static int OpenFlowFiles(int compress) {
     // Init each netflow source output data buffer
-    fs = FlowSource;
+    FlowSource_t *fs = FlowSource;
     while (fs) {
         // prepare file
-        fs->nffile = OpenNewFile(fs->current, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
-        if (!fs->nffile) {
-            return;
+        if (!OpenSourceFiles(fs, compress)) {
+            return 0;
         }
-        SetIdent(fs->nffile, fs->Ident);
 
         // init vars
         fs->bad_packets = 0;
@@ -313,6 +404,482 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
         fs = fs->next;
     }
 
+    return 1;
+
+}  // End of OpenFlowFiles
+
+/*
+ * Finish a rotated file: write the appendix, close and rename the file, update
+ * the books and trigger the launcher. Runs on the I/O thread, unless the file
+ * could not be handed over.
+ */
+static void CloseFlowFile(closeJob_t *job) {
+    FlowSource_t *fs = job->fs;
+    nffile_t *nffile = job->nffile;
+    char filename[MAXPATHLEN], nfcapd_filename[MAXPATHLEN];
+    char error[255];
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    // prepare filename
+    if (job->subdir) {
+        if (SetupSubDir(fs->datadir, job->subdir, error, 255)) {
+            snprintf(filename, MAXPATHLEN - 1, "%s/%s/nfcapd.%s", fs->datadir, job->subdir, job->fmt);
+        } else {
+            LogError("Ident: %s, Failed to create sub hier directories: %s", fs->Ident, error);
+            // skip subdir - put flows directly into current directory
+            snprintf(filename, MAXPATHLEN - 1, "%s/nfcapd.%s", fs->datadir, job->fmt);
+        }
+    } else {
+        snprintf(filename, MAXPATHLEN - 1, "%s/nfcapd.%s", fs->datadir, job->fmt);
+    }
+    ShardName(nfcapd_filename, MAXPATHLEN, filename, job->shard);
+
+    // Close file
+    CloseUpdateFile(nffile);
+
+    // if rename fails, we are in big trouble, as we need to get rid of the old file
+    // otherwise, we will loose flows
+    if (RenameAppend(job->closeName, nfcapd_filename) < 0) {
+        LogError("Ident: %s, Can't rename dump file: %s", fs->Ident, strerror(errno));
+
+        // we do not update the books here, as the file failed to rename properly
+        // otherwise the books may be wrong
+    } else {
+        struct stat fstat;
+
+        // Update books
+        stat(nfcapd_filename, &fstat);
+        UpdateBooks(fs->bookkeeper, job->t_start, 512 * fstat.st_blocks);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    UpdateMetricHistogram(fs->Ident, METRIC_ROTATETIME, 1000000LL * (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000);
+
+    // log stats
+    char shard[16] = "";
+    if (numShards > 1) snprintf(shard, sizeof(shard), " shard %d", job->shard);
+    LogInfo("Ident: '%s'%s Flows: %llu, Packets: %llu, Bytes: %llu, Sequence Errors: %u, Bad Packets: %u, Blocks: %u", fs->Ident, shard,
+            (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets,
+            (unsigned long long)nffile->stat_record->numbytes, nffile->stat_record->sequence_failure, job->bad_packets, ReportBlocks());
+    DisposeFile(nffile);
+
+    // trigger launcher if required
+    if (job->pfd) {
+        // Send launcher message
+        if (SendLauncherMessage(job->pfd, job->t_start, job->subdir, job->fmt, fs->datadir, fs->Ident) < 0) {
+            LogError("Failed to send launcher message");
+        } else {
+            LogVerbose("Send launcher message");
+        }
+    }
+
+    if (job->subdir) free(job->subdir);
+    free(job);
+
+}  // End of CloseFlowFile
+
+static void *ioThread(void *arg) {
+    queue_t *queue = (queue_t *)arg;
+
+    /* Signal handling */
+    sigset_t set = {0};
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    while (1) {
+        closeJob_t *job = queue_pop(queue);
+        if (job == QUEUE_CLOSED) break;
+        CloseFlowFile(job);
+    }
+
+    pthread_exit(NULL);
+
+}  // End of ioThread
+
+static void StartIOThread(void) {
+    closeQueue = queue_init(CLOSEQUEUESIZE);
+    if (!closeQueue) {
+        LogError("Failed to create I/O queue - rotate files inline");
+        return;
+    }
+
+    int err = pthread_create(&ioThreadID, NULL, ioThread, (void *)closeQueue);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        LogError("Rotate files inline");
+        queue_free(closeQueue);
+        closeQueue = NULL;
+    }
+
+}  // End of StartIOThread
+
+// wait until all rotated files are closed
+static void StopIOThread(void) {
+    if (!closeQueue) return;
+
+    queue_close(closeQueue);
+    pthread_join(ioThreadID, NULL);
+    queue_free(closeQueue);
+    closeQueue = NULL;
+
+}  // End of StopIOThread
+
+/*
+ * Periodic file renaming: for each flow source update the stats, move the file
+ * aside and open a new file, unless we are done. Closing, renaming and bookkeeping
+ * of the rotated files is done by the I/O thread, so no packets are lost meanwhile.
+ */
+static int RotateFlowFiles(time_t t_start, time_t twin, int pfd, int use_subdirs, char *time_extension, int compress) {
+    struct tm *now;
+    char *subdir, fmt[32];
+
+    now = localtime(&t_start);
+    strftime(fmt, sizeof(fmt), time_extension, now);
+
+    // prepare sub dir hierarchy
+    if (use_subdirs) {
+        subdir = GetSubDir(now);
+        if (!subdir) {
+            // failed to generate subdir path - put flows into base directory
+            LogError("Failed to create subdir path!");
+
+            // failed to generate subdir path - put flows into base directory
+            subdir = NULL;
+        }
+    } else {
+        subdir = NULL;
+    }
+
+    // for each flow source update the stats, hand over the files and open new files
+    FlowSource_t *fs = FlowSource;
+    while (fs) {
+        if (verbose > 1) {
+            format_file_block_header(fs->nffile->block_header);
+        }
+
+        // update stat record
+        // if no flows were collected, fs->msecLast is still 0
+        // set first_seen to start of this time slot, with twin window size.
+        if (fs->msecLast == 0) {
+            fs->msecFirst = 1000LL * (uint64_t)t_start;
+            fs->msecLast = 1000LL * (uint64_t)(t_start + twin);
+        }
+
+        // Flush Exporter Stat to file
+        FlushExporterStats(fs);
+
+        for (int i = 0; i < fs->numShards; i++) {
+            nffile_t *nffile = fs->shard[i];
+            nffile->stat_record->firstseen = fs->msecFirst;
+            nffile->stat_record->lastseen = fs->msecLast;
+
+            closeJob_t *job = calloc(1, sizeof(closeJob_t));
+            if (!job) {
+                LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                return 0;
+            }
+            job->fs = fs;
+            job->nffile = nffile;
+            job->shard = i;
+            job->t_start = t_start;
+            // the launcher gets triggered, when the last shard of the time slot is closed
+            job->pfd = i == fs->numShards - 1 ? pfd : 0;
+            job->bad_packets = i == 0 ? fs->bad_packets : 0;
+            job->subdir = subdir ? strdup(subdir) : NULL;
+            snprintf(job->fmt, sizeof(job->fmt), "%s", fmt);
+
+            // move the file aside, so the new file can be opened as .current
+            char current[MAXPATHLEN], closeName[MAXPATHLEN];
+            ShardName(current, sizeof(current), fs->current, i);
+            snprintf(closeName, MAXPATHLEN - 1, "%s.%s", fs->current, fmt);
+            ShardName(job->closeName, MAXPATHLEN, closeName, i);
+            if (closeQueue && rename(current, job->closeName) == 0) {
+                queue_push(closeQueue, job);
+            } else {
+                if (closeQueue) LogError("Ident: %s, Can't move dump file aside: %s", fs->Ident, strerror(errno));
+                snprintf(job->closeName, MAXPATHLEN, "%s", current);
+                CloseFlowFile(job);
+            }
+            fs->shard[i] = NULL;
+        }
+        fs->nffile = NULL;
+
+        // reset stats
+        fs->bad_packets = 0;
+        fs->msecFirst = 0xffffffffffffLL;
+        fs->msecLast = 0;
+
+        if (!done) {
+            if (!OpenSourceFiles(fs, compress)) {
+                LogError("killed due to fatal error: ident: %s", fs->Ident);
+                return 0;
+            }
+
+            // Dump all exporters/samplers to the buffer
+            FlushStdRecords(fs);
+        }
+
+        // next flow source
+        fs = fs->next;
+
+    }  // end of while (fs)
+
+    return 1;
+
+}  // End of RotateFlowFiles
+
+static void DecodeDatagram(FlowSource_t *fs, void *in_buff, ssize_t cnt) {
+    /* check for too little data - cnt must be > 0 at this point */
+    if (cnt < sizeof(common_flow_header_t)) {
+        LogError("Ident: %s, Data length error: too little data for common netflow header. cnt: %i", fs->Ident, (int)cnt);
+        fs->bad_packets++;
+        return;
+    }
+
+    /* Process data - have a look at the common header */
+    common_flow_header_t *nf_header = (common_flow_header_t *)in_buff;
+    uint16_t version = ntohs(nf_header->version);
+    switch (version) {
+        case 1:
+            Process_v1(in_buff, cnt, fs);
+            break;
+        case 5:  // fall through
+        case 7:
+            Process_v5_v7(in_buff, cnt, fs);
+            break;
+        case 9:
+            Process_v9(in_buff, cnt, fs);
+            break;
+        case 10:
+            Process_IPFIX(in_buff, cnt, fs);
+            break;
+        case NFD_PROTOCOL:
+            Process_nfd(in_buff, cnt, fs);
+            break;
+        default:
+            // data error, while reading data from socket
+            LogError("Ident: %s, Error reading netflow header: Unexpected netflow version %i", fs->Ident, version);
+            fs->bad_packets++;
+            break;
+    }
+    // each Process_xx function has to process the entire input buffer, therefore it's empty
+    // now.
+
+}  // End of DecodeDatagram
+
+static void ProcessDatagram(FlowSource_t *fs, void *in_buff, ssize_t cnt) {
+    if (!MetricActive()) {
+        DecodeDatagram(fs, in_buff, cnt);
+        return;
+    }
+
+    uint32_t sequence_failure = fs->nffile->stat_record->sequence_failure;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    DecodeDatagram(fs, in_buff, cnt);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    uint64_t nsec = 1000000000LL * (t1.tv_sec - t0.tv_sec) + t1.tv_nsec - t0.tv_nsec;
+    UpdateMetricCounter(fs->Ident, METRIC_DATAGRAMS, 1);
+    UpdateMetricCounter(fs->Ident, METRIC_SEQFAILURES, fs->nffile->stat_record->sequence_failure - sequence_failure);
+    UpdateMetricHistogram(fs->Ident, METRIC_DECODETIME, nsec);
+    UpdateMetricHistogram(fs->Ident, METRIC_QUEUEDEPTH, queue_length(fs->nffile->processQueue));
+
+}  // End of ProcessDatagram
+
+static void AcceptStream(void) {
+    struct sockaddr_storage addr;
+    socklen_t addrLen = sizeof(addr);
+    int fd = accept(streamSock, (struct sockaddr *)&addr, &addrLen);
+    if (fd < 0) {
+        LogError("accept() error: %s", strerror(errno));
+        return;
+    }
+    if (numStreams == MAXSTREAMS) {
+        LogError("Reject flow stream: max %d streams", MAXSTREAMS);
+        close(fd);
+        return;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LogError("fcntl() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    stream_t *stream = &streams[numStreams++];
+    memset((void *)stream, 0, sizeof(stream_t));
+    stream->fd = fd;
+    stream->addr = addr;
+    stream->addrLen = addrLen;
+
+    char host[NI_MAXHOST];
+    if (getnameinfo((struct sockaddr *)&addr, addrLen, host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0) strcpy(host, "<unknown>");
+    LogInfo("Accepted flow stream from %s", host);
+
+}  // End of AcceptStream
+
+static void CloseStream(stream_t *stream) {
+    close(stream->fd);
+    free(stream->data);
+    *stream = streams[--numStreams];
+    LogInfo("Flow stream closed");
+
+}  // End of CloseStream
+
+/*
+ * Receive the pending data of a flow stream without blocking. Returns 1 if the current
+ * frame is complete, 0 if more data is needed and -1 if the stream is closed or broken.
+ */
+static int RecvStream(stream_t *stream) {
+    if (stream->fill == 0) stream->start = time(NULL);
+
+    while (1) {
+        void *buff;
+        size_t len;
+        if (stream->fill < sizeof(nfd_frame_t)) {
+            buff = (void *)&stream->frame + stream->fill;
+            len = sizeof(nfd_frame_t) - stream->fill;
+        } else {
+            uint32_t received = stream->fill - sizeof(nfd_frame_t);
+            if (received == stream->frame.length) return 1;
+            buff = stream->data + received;
+            len = stream->frame.length - received;
+        }
+
+        ssize_t ret = recv(stream->fd, buff, len, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (ret <= 0) {
+            if (ret < 0) LogError("Flow stream recv() error: %s", strerror(errno));
+            return -1;
+        }
+
+        stream->fill += ret;
+        if (stream->fill == sizeof(nfd_frame_t)) {
+            // header complete - check and size the data buffer
+            if (!CheckFrame_nfd(&stream->frame)) return -1;
+            if (stream->frame.length > stream->size) {
+                void *data = realloc(stream->data, stream->frame.length);
+                if (!data) {
+                    LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                    return -1;
+                }
+                stream->data = data;
+                stream->size = stream->frame.length;
+            }
+        }
+    }
+
+}  // End of RecvStream
+
+// drop the streams with a frame not completed in time - returns the poll timeout in ms for the others
+static int ExpireStreams(void) {
+    time_t now = time(NULL);
+    int timeout = -1;
+    int i = 0;
+    while (i < numStreams) {
+        stream_t *stream = &streams[i];
+        if (stream->fill == 0) {
+            i++;
+            continue;
+        }
+        time_t left = stream->start + STREAMTIMEOUT - now;
+        if (left <= 0) {
+            LogError("Flow stream timeout: incomplete frame after %ds", STREAMTIMEOUT);
+            CloseStream(stream);
+            continue;
+        }
+        if (timeout < 0 || left * 1000 < timeout) timeout = left * 1000;
+        i++;
+    }
+
+    return timeout;
+
+}  // End of ExpireStreams
+
+/*
+ * Wait for datagrams or flow stream data. Datagrams and streams are served alternately,
+ * so neither starves the other. Returns 1 if datagrams are waiting, 0 if a stream is ready,
+ * a new stream got accepted or a frame timed out and -1 if interrupted by a signal.
+ */
+static int WaitInput(int socket, stream_t **ready) {
+    static int nextStream = 0;
+    static int servedStream = 0;
+
+    int timeout = ExpireStreams();
+
+    struct pollfd pfd[MAXSTREAMS + 2];
+    pfd[0].fd = socket;
+    pfd[1].fd = streamSock;
+    for (int i = 0; i < numStreams; i++) pfd[i + 2].fd = streams[i].fd;
+    int nfds = numStreams + 2;
+    for (int i = 0; i < nfds; i++) pfd[i].events = POLLIN;
+
+    // a timeout drops the stalled streams with the next call
+    int ret = poll(pfd, nfds, timeout);
+    if (ret <= 0) return ret;
+
+    int active = numStreams;
+    if (pfd[1].revents & POLLIN) AcceptStream();
+
+    int datagrams = pfd[0].revents != 0;
+    if (datagrams && servedStream) {
+        servedStream = 0;
+        return 1;
+    }
+
+    for (int i = 0; i < active; i++) {
+        int s = (nextStream + i) % active;
+        if (pfd[s + 2].revents) {
+            nextStream = s + 1;
+            servedStream = 1;
+            *ready = &streams[s];
+            return 0;
+        }
+    }
+
+    servedStream = 0;
+    return datagrams;
+
+}  // End of WaitInput
+
+static void ProcessStream(FlowSource_t *fs, stream_t *stream) {
+    // next frame
+    stream->fill = 0;
+    if (!ProcessFrame_nfd(fs, &stream->frame, stream->data)) {
+        fs->bad_packets++;
+        CloseStream(stream);
+    }
+
+}  // End of ProcessStream
+
+static void run(packet_function_t receive_packet, int socket, int pfd, int rfd, time_t twin, time_t t_begin, int use_subdirs, char *time_extension,
+                int compress) {
+    FlowSource_t *fs;
+    struct sockaddr_storage nf_sender;
+    socklen_t nf_sender_size = sizeof(nf_sender);
+    time_t t_start, t_now;
+    uint32_t ignored_packets;
+    ssize_t cnt;
+    void *in_buff = NULL;
+
+    recvBatch_t *recvBatch = NewRecvBatch(RECV_BATCH_SIZE, NETWORK_INPUT_BUFF_SIZE);
+    if (!recvBatch) return;
+#ifdef PCAP
+    void *pcap_buff = malloc(NETWORK_INPUT_BUFF_SIZE);
+    if (!pcap_buff) {
+        LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+#endif
+
+    if (!OpenFlowFiles(compress)) return;
+    StartIOThread();
+
     t_start = t_begin;
 
     cnt = 0;
@@ -329,148 +896,54 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
      */
     while (1) {
         struct timeval tv;
+        stream_t *stream = NULL;
 
-        /* read next bunch of data into begin of input buffer */
+        /* get next datagram of the current batch or receive the next batch */
         if (!done) {
 #ifdef PCAP
             // Debug code to read from pcap file, or from socket
-            cnt = receive_packet(socket, in_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&nf_sender, &nf_sender_size);
-
-            // in case of reading from file EOF => -2
-            if (cnt == -2) done = 1;
-#else
-            cnt = recvfrom(socket, in_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&nf_sender, &nf_sender_size);
+            if (receive_packet != recvfrom) {
+                cnt = receive_packet(socket, pcap_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&nf_sender, &nf_sender_size);
+                in_buff = pcap_buff;
+                gettimeofday(&tv, NULL);
+
+                // in case of reading from file EOF => -2
+                if (cnt == -2) done = 1;
+            } else
 #endif
+            {
+                cnt = 1;
+                if (streamSock && !RecvPending(recvBatch)) {
+                    // the poll and the stream frames are no batch processing time
+                    RecvBatchDone(recvBatch);
+                    cnt = WaitInput(socket, &stream);
+                    if (cnt <= 0) gettimeofday(&tv, NULL);
+                }
+                if (cnt == 1) cnt = RecvPacket(recvBatch, socket, &in_buff, &nf_sender, &nf_sender_size, &tv);
+            }
 
             if (cnt == -1 && errno != EINTR) {
                 LogError("ERROR: recvfrom: %s", strerror(errno));
                 continue;
             }
+        } else {
+            gettimeofday(&tv, NULL);
         }
 
         /* Periodic file renaming, if time limit reached or if we are done.  */
-        // t_now = time(NULL);
-        gettimeofday(&tv, NULL);
+        // one time stamp per received batch
         t_now = tv.tv_sec;
 
         if (((t_now - t_start) >= twin) || done) {
-            struct tm *now;
-            char *subdir, fmt[32];
-
             alarm(0);
-            now = localtime(&t_start);
-            strftime(fmt, sizeof(fmt), time_extension, now);
-
-            // prepare sub dir hierarchy
-            if (use_subdirs) {
-                subdir = GetSubDir(now);
-                if (!subdir) {
-                    // failed to generate subdir path - put flows into base directory
-                    LogError("Failed to create subdir path!");
-
-                    // failed to generate subdir path - put flows into base directory
-                    subdir = NULL;
-                }
-            } else {
-                subdir = NULL;
-            }
-
-            // for each flow source update the stats, close the file and re-initialize the new file
-            fs = FlowSource;
-            while (fs) {
-                char nfcapd_filename[MAXPATHLEN];
-                char error[255];
-                nffile_t *nffile = fs->nffile;
-
-                if (verbose > 1) {
-                    format_file_block_header(nffile->block_header);
-                }
-
-                // prepare filename
-                if (subdir) {
-                    if (SetupSubDir(fs->datadir, subdir, error, 255)) {
-                        snprintf(nfcapd_filename, MAXPATHLEN - 1, "%s/%s/nfcapd.%s", fs->datadir, subdir, fmt);
-                    } else {
-                        LogError("Ident: %s, Failed to create sub hier directories: %s", fs->Ident, error);
-                        // skip subdir - put flows directly into current directory
-                        snprintf(nfcapd_filename, MAXPATHLEN - 1, "%s/nfcapd.%s", fs->datadir, fmt);
-                    }
-                } else {
-                    snprintf(nfcapd_filename, MAXPATHLEN - 1, "%s/nfcapd.%s", fs->datadir, fmt);
-                }
-                nfcapd_filename[MAXPATHLEN - 1] = '\0';
-
-                // update stat record
-                // if no flows were collected, fs->msecLast is still 0
-                // set first_seen to start of this time slot, with twin window size.
-                if (fs->msecLast == 0) {
-                    fs->msecFirst = 1000LL * (uint64_t)t_start;
-                    fs->msecLast = 1000LL * (uint64_t)(t_start + twin);
-                }
-                nffile->stat_record->firstseen = fs->msecFirst;
-                nffile->stat_record->lastseen = fs->msecLast;
-
-                // Flush Exporter Stat to file
-                FlushExporterStats(fs);
-                // Close file
-                CloseUpdateFile(nffile);
-
-                // if rename fails, we are in big trouble, as we need to get rid of the old .current
-                // file otherwise, we will loose flows and can not continue collecting new flows
-                if (RenameAppend(fs->current, nfcapd_filename) < 0) {
-                    LogError("Ident: %s, Can't rename dump file: %s", fs->Ident, strerror(errno));
-
-                    // we do not update the books here, as the file failed to rename properly
-                    // otherwise the books may be wrong
-                } else {
-                    struct stat fstat;
-
-                    // Update books
-                    stat(nfcapd_filename, &fstat);
-                    UpdateBooks(fs->bookkeeper, t_start, 512 * fstat.st_blocks);
-                }
-
-                // log stats
-                LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Sequence Errors: %u, Bad Packets: %u, Blocks: %u", fs->Ident,
-                        (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets,
-                        (unsigned long long)nffile->stat_record->numbytes, nffile->stat_record->sequence_failure, fs->bad_packets, ReportBlocks());
-
-                // reset stats
-                fs->bad_packets = 0;
-                fs->msecFirst = 0xffffffffffffLL;
-                fs->msecLast = 0;
-
-                if (!done) {
-                    fs->nffile = OpenNewFile(fs->current, fs->nffile, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
-                    if (!fs->nffile) {
-                        LogError("killed due to fatal error: ident: %s", fs->Ident);
-                        break;
-                    }
-                    SetIdent(fs->nffile, fs->Ident);
-
-                    // Dump all exporters/samplers to the buffer
-                    FlushStdRecords(fs);
-                }
-
-                // trigger launcher if required
-                if (pfd) {
-                    // Send launcher message
-                    if (SendLauncherMessage(pfd, t_start, subdir, fmt, fs->datadir, fs->Ident) < 0) {
-                        LogError("Failed to send launcher message");
-                    } else {
-                        LogVerbose("Send launcher message");
-                    }
-                }
-
-                // next flow source
-                fs = fs->next;
-
-            }  // end of while (fs)
+            int ok = RotateFlowFiles(t_start, twin, pfd, use_subdirs, time_extension, compress);
 
+            recvStat_t recvStat = RecvStat(recvBatch);
+            LogRecvStat(&recvStat);
             if (ignored_packets) LogInfo("Total ignored packets: %u", ignored_packets);
             ignored_packets = 0;
 
-            if (done) break;
+            if (done || !ok) break;
 
             // update alarm for next cycle
             t_start += twin;
@@ -500,106 +973,349 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
             }
         }
 
-        /* enough data? */
-        if (cnt == 0) continue;
-
-        // repeat this packet
-        if (rfd) {
-            if (SendRepeaterMessage(rfd, in_buff, cnt, &nf_sender, nf_sender_size) != 0) {
-                LogError("Disable packet repeater due to errors");
-                close(rfd);
-                rfd = 0;
+        if (stream) {
+            // process a flow stream frame, once it is complete
+            int ret = RecvStream(stream);
+            if (ret <= 0) {
+                if (ret < 0) CloseStream(stream);
+                continue;
+            }
+            memcpy(&nf_sender, &stream->addr, stream->addrLen);
+            nf_sender_size = stream->addrLen;
+        } else {
+            /* enough data? */
+            if (cnt == 0) continue;
+
+            // repeat this packet
+            if (rfd) {
+                if (SendRepeaterMessage(rfd, in_buff, cnt, &nf_sender, nf_sender_size) != 0) {
+                    LogError("Disable packet repeater due to errors");
+                    close(rfd);
+                    rfd = 0;
+                }
             }
         }
 
         // get flow source record for current packet, identified by sender IP address
-        fs = GetFlowSource(&nf_sender);
+        fs = GetFlowSource(FlowSource, &nf_sender);
         if (fs == NULL) {
             fs = AddDynamicSource(&FlowSource, &nf_sender);
             if (fs == NULL) {
                 LogError("Skip UDP packet. Ignored packets so far %u packets", ignored_packets);
                 ignored_packets++;
+                if (stream) CloseStream(stream);
                 continue;
             }
             if (InitBookkeeper(&fs->bookkeeper, fs->datadir, getpid()) != BOOKKEEPER_OK) {
                 LogError("Failed to initialise bookkeeper for new source");
                 // fatal error
+                StopIOThread();
                 return;
             }
-            fs->nffile = OpenNewFile(fs->current, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
-            if (!fs->nffile) {
+            if (!OpenSourceFiles(fs, compress)) {
                 LogError("Failed to open new collector file");
+                StopIOThread();
                 return;
             }
-            SetIdent(fs->nffile, fs->Ident);
-        }
-
-        /* check for too little data - cnt must be > 0 at this point */
-        if (cnt < sizeof(common_flow_header_t)) {
-            LogError("Ident: %s, Data length error: too little data for common netflow header. cnt: %i", fs->Ident, (int)cnt);
-            fs->bad_packets++;
-            continue;
         }
 
         fs->received = tv;
-        /* Process data - have a look at the common header */
-        version = ntohs(nf_header->version);
-        switch (version) {
-            case 1:
-                Process_v1(in_buff, cnt, fs);
-                break;
-            case 5:  // fall through
-            case 7:
-                Process_v5_v7(in_buff, cnt, fs);
-                break;
-            case 9:
-                Process_v9(in_buff, cnt, fs);
-                break;
-            case 10:
-                Process_IPFIX(in_buff, cnt, fs);
-                break;
-            case NFD_PROTOCOL:
-                Process_nfd(in_buff, cnt, fs);
-                break;
-            default:
-                // data error, while reading data from socket
-                LogError("Ident: %s, Error reading netflow header: Unexpected netflow version %i", fs->Ident, version);
-                fs->bad_packets++;
-                continue;
-
-                // not reached
-                break;
-        }
-        // each Process_xx function has to process the entire input buffer, therefore it's empty
-        // now.
+        if (stream)
+            ProcessStream(fs, stream);
+        else
+            ProcessDatagram(fs, in_buff, cnt);
     }
 
-    free(in_buff);
+    while (numStreams) CloseStream(&streams[0]);
+    FreeRecvBatch(recvBatch);
+#ifdef PCAP
+    free(pcap_buff);
+#endif
+
+    // wait for the I/O thread to close all rotated files
+    StopIOThread();
 
     fs = FlowSource;
     while (fs) {
-        DisposeFile(fs->nffile);
-        fs->nffile = NULL;
+        DisposeSourceFiles(fs);
+        DisposeExporterIndex(fs);
         fs = fs->next;
     }
 
 } /* End of run */
 
+/*
+ * Worker mode -W: each worker receives on its own SO_REUSEPORT socket. A reuseport
+ * BPF program selects the socket by the source address of the exporter, so an exporter,
+ * its templates and sequence counters stay with a single worker. Every worker decodes into its own copy of the
+ * flow source list, which appends data blocks to the files of the flow sources.
+ * The main thread only rotates the files, while all workers are held on their mutex.
+ */
+static void *workerThread(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    struct sockaddr_storage nf_sender;
+    socklen_t nf_sender_size = sizeof(nf_sender);
+    void *in_buff = NULL;
+    recvBatch_t *recvBatch = worker->recvBatch;
+
+    while (!done) {
+        struct timeval tv;
+        // the receive timeout of the socket checks for done every second
+        ssize_t cnt = RecvPacket(recvBatch, worker->socket, &in_buff, &nf_sender, &nf_sender_size, &tv);
+        if (cnt < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LogError("Worker %d: recvfrom() error: %s", worker->id, strerror(errno));
+            }
+            continue;
+        }
+        if (cnt == 0) continue;
+
+        if (worker->rfd) {
+            pthread_mutex_lock(&repeaterMutex);
+            int err = SendRepeaterMessage(worker->rfd, in_buff, cnt, &nf_sender, nf_sender_size);
+            pthread_mutex_unlock(&repeaterMutex);
+            if (err) {
+                LogError("Worker %d: disable packet repeater due to errors", worker->id);
+                worker->rfd = 0;
+            }
+        }
+
+        pthread_mutex_lock(&worker->mutex);
+        if (done) {
+            // the files may already be gone
+            pthread_mutex_unlock(&worker->mutex);
+            break;
+        }
+        FlowSource_t *fs = GetFlowSource(worker->FlowSource, &nf_sender);
+        if (fs) {
+            fs->received = tv;
+            ProcessDatagram(fs, in_buff, cnt);
+        } else {
+            LogError("Skip UDP packet. Ignored packets so far %u packets", worker->ignored_packets);
+            worker->ignored_packets++;
+        }
+        pthread_mutex_unlock(&worker->mutex);
+    }
+
+    pthread_exit(NULL);
+
+}  // End of workerThread
+
+// attach a worker copy of the flow source list to the current files
+static int AttachWorker(worker_t *worker) {
+    FlowSource_t **tail = &worker->FlowSource;
+    for (FlowSource_t *fs = FlowSource; fs; fs = fs->next) {
+        FlowSource_t *wfs = calloc(1, sizeof(FlowSource_t));
+        if (!wfs) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        *wfs = *fs;
+        wfs->next = NULL;
+        wfs->bookkeeper = NULL;
+        wfs->exporter_data = NULL;
+        wfs->exporter_count = 0;
+        wfs->exporterIndex = NULL;
+        // workers are spread over the shards of the flow source - an exporter stays in the shard of its worker
+        wfs->nffile = OpenWorkerFile(fs->shard[worker->id % fs->numShards]);
+        if (!wfs->nffile) {
+            free(wfs);
+            return 0;
+        }
+        *tail = wfs;
+        tail = &wfs->next;
+    }
+
+    return 1;
+
+}  // End of AttachWorker
+
+// merge the data of all workers into the flow sources before rotating
+static uint32_t FlushWorkers(worker_t *workers, int numWorkers) {
+    uint32_t ignored_packets = 0;
+    for (int i = 0; i < numWorkers; i++) {
+        FlowSource_t *wfs = workers[i].FlowSource;
+        for (FlowSource_t *fs = FlowSource; fs && wfs; fs = fs->next, wfs = wfs->next) {
+            FlushExporterStats(wfs);
+            FlushWorkerFile(wfs->nffile, fs->shard[i % fs->numShards]);
+
+            fs->bad_packets += wfs->bad_packets;
+            if (wfs->msecFirst < fs->msecFirst) fs->msecFirst = wfs->msecFirst;
+            if (wfs->msecLast > fs->msecLast) fs->msecLast = wfs->msecLast;
+
+            wfs->bad_packets = 0;
+            wfs->msecFirst = 0xffffffffffffLL;
+            wfs->msecLast = 0;
+        }
+        ignored_packets += workers[i].ignored_packets;
+        workers[i].ignored_packets = 0;
+    }
+
+    return ignored_packets;
+
+}  // End of FlushWorkers
+
+static void runWorkers(int *sockets, int numWorkers, int pfd, int rfd, time_t twin, time_t t_begin, int use_subdirs, char *time_extension,
+                       int compress) {
+    if (!OpenFlowFiles(compress)) return;
+    StartIOThread();
+
+    worker_t *workers = calloc(numWorkers, sizeof(worker_t));
+    if (!workers) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        StopIOThread();
+        return;
+    }
+
+    // workers inherit the blocked signals - signals are handled by the main thread only
+    sigset_t signalMask, origMask;
+    sigemptyset(&signalMask);
+    sigaddset(&signalMask, SIGTERM);
+    sigaddset(&signalMask, SIGINT);
+    sigaddset(&signalMask, SIGHUP);
+    sigaddset(&signalMask, SIGALRM);
+    sigaddset(&signalMask, SIGCHLD);
+    sigaddset(&signalMask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signalMask, &origMask);
+
+    int running = 0;
+    for (int i = 0; i < numWorkers; i++) {
+        worker_t *worker = &workers[i];
+        worker->id = i;
+        worker->socket = sockets[i];
+        worker->rfd = rfd;
+        pthread_mutex_init(&worker->mutex, NULL);
+
+        struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+        if (setsockopt(worker->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+            LogError("setsockopt(SO_RCVTIMEO) failed: %s", strerror(errno));
+        }
+
+        worker->recvBatch = NewRecvBatch(RECV_BATCH_SIZE, NETWORK_INPUT_BUFF_SIZE);
+        if (!worker->recvBatch) {
+            LogError("Worker %d: failed to allocate receive buffers", worker->id);
+            break;
+        }
+        if (!AttachWorker(worker)) break;
+        int err = pthread_create(&worker->tid, NULL, workerThread, (void *)worker);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            break;
+        }
+        running++;
+    }
+    if (running != numWorkers) done = 1;
+    LogInfo("Started %d workers", running);
+
+    time_t t_start = t_begin;
+    periodic_trigger = 0;
+
+    // wake up at least at next time slot (twin) + 1s
+    alarm(t_start + twin + 1 - time(NULL));
+    while (1) {
+        // wait for the alarm or a termination signal
+        while (!done && !periodic_trigger) {
+            sigsuspend(&origMask);
+            ChildDied();
+        }
+        periodic_trigger = 0;
+
+        time_t t_now = time(NULL);
+        if (((t_now - t_start) < twin) && !done) continue;
+
+        alarm(0);
+        if (done) {
+            // workers terminate within their receive timeout
+            for (int i = 0; i < running; i++) pthread_join(workers[i].tid, NULL);
+        } else {
+            for (int i = 0; i < running; i++) pthread_mutex_lock(&workers[i].mutex);
+        }
+
+        uint32_t ignored_packets = FlushWorkers(workers, running);
+        int ok = RotateFlowFiles(t_start, twin, pfd, use_subdirs, time_extension, compress);
+
+        if (!done && ok) {
+            // attach the workers to the new files and dump all exporters/samplers
+            for (int i = 0; i < running; i++) {
+                FlowSource_t *wfs = workers[i].FlowSource;
+                for (FlowSource_t *fs = FlowSource; fs && wfs; fs = fs->next, wfs = wfs->next) {
+                    AttachWorkerFile(wfs->nffile, fs->shard[i % fs->numShards]);
+                    FlushStdRecords(wfs);
+                }
+                pthread_mutex_unlock(&workers[i].mutex);
+            }
+        }
+
+        recvStat_t recvStat = {0};
+        for (int i = 0; i < running; i++) {
+            recvStat_t workerStat = RecvStat(workers[i].recvBatch);
+            recvStat.datagrams += workerStat.datagrams;
+            recvStat.batches += workerStat.batches;
+            recvStat.drops += workerStat.drops;
+            recvStat.batchTime += workerStat.batchTime;
+            if (workerStat.maxBatchTime > recvStat.maxBatchTime) recvStat.maxBatchTime = workerStat.maxBatchTime;
+            if (workerStat.maxRcvbufUsage > recvStat.maxRcvbufUsage) recvStat.maxRcvbufUsage = workerStat.maxRcvbufUsage;
+        }
+        LogRecvStat(&recvStat);
+        if (ignored_packets) LogInfo("Total ignored packets: %u", ignored_packets);
+
+        if (done) break;
+        if (!ok) {
+            done = 1;
+            for (int i = 0; i < running; i++) {
+                pthread_mutex_unlock(&workers[i].mutex);
+                pthread_join(workers[i].tid, NULL);
+            }
+            break;
+        }
+
+        // update alarm for next cycle
+        t_start += twin;
+        alarm(t_start + twin + 1 - t_now);
+    }
+    pthread_sigmask(SIG_SETMASK, &origMask, NULL);
+
+    for (int i = 0; i < numWorkers; i++) {
+        FlowSource_t *wfs = workers[i].FlowSource;
+        while (wfs) {
+            FlowSource_t *next = wfs->next;
+            DisposeWorkerFile(wfs->nffile);
+            DisposeExporterIndex(wfs);
+            free(wfs);
+            wfs = next;
+        }
+        FreeRecvBatch(workers[i].recvBatch);
+        pthread_mutex_destroy(&workers[i].mutex);
+    }
+    free(workers);
+
+    // wait for the I/O thread to close all rotated files
+    StopIOThread();
+
+    for (FlowSource_t *fs = FlowSource; fs; fs = fs->next) {
+        DisposeSourceFiles(fs);
+        DisposeExporterIndex(fs);
+    }
+
+}  // End of runWorkers
+
 int main(int argc, char **argv) {
-    char *bindhost, *datadir, *launch_process;
+    char *bindhost, *datadir, *launch_process, *rollup;
     char *userid, *groupid, *listenport, *mcastgroup;
     char *Ident, *dynFlowDir, *time_extension, *pidfile, *configFile, *metricSocket;
-    char *extensionList;
+    char *extensionList, *streamport;
     packet_function_t receive_packet;
     repeater_t repeater[MAX_REPEATERS];
     FlowSource_t *fs;
-    int family, bufflen, metricInterval;
+    int family, bufflen, metricInterval, numWorkers;
+    int sockets[MAXWORKERS];
     time_t twin;
     int sock, do_daemonize, expire, spec_time_extension;
     int subdir_index, sampling_rate, compress, srcSpoofing;
 #ifdef PCAP
     char *pcap_file = NULL;
     char *pcap_device = NULL;
+    char *ring_device = NULL;
 #endif
 
     receive_packet = recvfrom;
@@ -611,6 +1327,7 @@ int main(int argc, char **argv) {
     mcastgroup = NULL;
     pidfile = NULL;
     launch_process = NULL;
+    rollup = NULL;
     userid = groupid = NULL;
     twin = TIME_WINDOW;
     datadir = NULL;
@@ -629,9 +1346,11 @@ int main(int argc, char **argv) {
     metricSocket = NULL;
     metricInterval = 60;
     extensionList = NULL;
+    streamport = NULL;
+    numWorkers = 0;
 
     int c;
-    while ((c = getopt(argc, argv, "46AB:b:C:d:DeEf:g:hI:i:jJ:l:m:M:n:p:P:R:s:S:t:T:u:vVw:x:X:yzZ")) != EOF) {
+    while ((c = getopt(argc, argv, "46AB:b:C:d:DeEf:g:hI:i:jJ:k:K:l:L:m:M:n:p:P:r:R:s:S:t:T:u:vVw:W:x:X:yzZ")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -669,9 +1388,14 @@ int main(int argc, char **argv) {
                 CheckArgLen(optarg, 32);
                 pcap_device = strdup(optarg);
                 break;
+            case 'r':
+                CheckArgLen(optarg, 32);
+                ring_device = strdup(optarg);
+                break;
 #else
             case 'f':
             case 'd':
+            case 'r':
                 LogError("Reading data from pcap file/device not compiled! Option ignored!");
                 break;
 #endif
@@ -741,6 +1465,9 @@ int main(int argc, char **argv) {
             case 'p':
                 listenport = optarg;
                 break;
+            case 'L':
+                streamport = optarg;
+                break;
             case 'P':
                 pidfile = verify_pid(optarg);
                 if (!pidfile) {
@@ -798,6 +1525,20 @@ int main(int argc, char **argv) {
             case 'S':
                 subdir_index = atoi(optarg);
                 break;
+            case 'W':
+                numWorkers = atoi(optarg);
+                if (numWorkers < 1 || numWorkers > MAXWORKERS) {
+                    LogError("Number of workers out of range 1..%d", MAXWORKERS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'K':
+                numShards = atoi(optarg);
+                if (numShards < 1 || numShards > MAXSHARDS) {
+                    LogError("Number of shards out of range 1..%d", MAXSHARDS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'T':
                 printf("Option -T no longer supported and ignored\n");
                 break;
@@ -815,6 +1556,10 @@ int main(int argc, char **argv) {
                 CheckArgLen(optarg, 256);
                 launch_process = optarg;
                 break;
+            case 'k':
+                CheckArgLen(optarg, 256);
+                rollup = optarg;
+                break;
             case 'X':
                 CheckArgLen(optarg, 128);
                 extensionList = strdup(optarg);
@@ -874,7 +1619,7 @@ int main(int argc, char **argv) {
         if (strcmp(argv[optind], "privsep") == 0) {
             if (strcmp(argv[optind + 1], "launcher") == 0) {
                 dbg_printf("nfcapd privsep launched\n");
-                int ret = StartupLauncher(launch_process, expire);
+                int ret = StartupLauncher(launch_process, rollup, expire);
                 exit(ret);
             } else if (strcmp(argv[optind + 1], "repeater") == 0) {
                 dbg_printf("nfcapd repeater launched\n");
@@ -912,6 +1657,32 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (numShards > 1 && numWorkers < numShards) {
+        LogError("ERROR, -K needs at least as many -W workers as shards");
+        exit(EXIT_FAILURE);
+    }
+
+    if (numWorkers && (mcastgroup || dynFlowDir)) {
+        LogError("ERROR, -W does not support -J multicast or -M dynamic sources");
+        exit(EXIT_FAILURE);
+    }
+
+    if (numWorkers && streamport) {
+        LogError("ERROR, -W does not support -L flow streams");
+        exit(EXIT_FAILURE);
+    }
+#ifdef PCAP
+    if (numWorkers && (pcap_file || pcap_device || ring_device)) {
+        LogError("ERROR, -W does not support reading from pcap");
+        exit(EXIT_FAILURE);
+    }
+
+    if (streamport && (pcap_file || pcap_device || ring_device)) {
+        LogError("ERROR, -L does not support reading from pcap");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
     if (!Init_nffile(NULL)) exit(254);
 
     if (expire && spec_time_extension) {
@@ -936,18 +1707,54 @@ int main(int argc, char **argv) {
             exit(EXIT_FAILURE);
         }
         receive_packet = NextPacket;
+    } else if (ring_device) {
+#ifdef __linux__
+        char filter[32];
+        snprintf(filter, sizeof(filter), "udp dst port %s", listenport);
+        if (!setup_ring_live(ring_device, filter, bufflen)) {
+            LogError("Setup packet ring failed.");
+            exit(EXIT_FAILURE);
+        }
+        receive_packet = NextRingPacket;
+#else
+        LogError("Packet ring not supported on this platform.");
+        exit(EXIT_FAILURE);
+#endif
     } else
 #endif
         if (mcastgroup)
         sock = Multicast_receive_socket(mcastgroup, listenport, family, bufflen);
-    else
-        sock = Unicast_receive_socket(bindhost, listenport, family, bufflen);
+    else if (numWorkers) {
+        // one socket per worker, bound to the same port
+        sock = -1;
+        for (int i = 0; i < numWorkers; i++) {
+            sockets[i] = Unicast_receive_socket(bindhost, listenport, family, bufflen, 1);
+            if (sockets[i] == -1) {
+                for (int j = 0; j < i; j++) close(sockets[j]);
+                sock = -1;
+                break;
+            }
+            sock = sockets[0];
+        }
+        // keep all datagrams of an exporter with one worker
+        if (sock != -1 && numWorkers > 1 && !ReusePortBySource(sock, numWorkers))
+            LogError("Exporters sending from several source ports are split across workers");
+    } else
+        sock = Unicast_receive_socket(bindhost, listenport, family, bufflen, 0);
 
     if (sock == -1) {
         LogError("Terminated due to errors");
         exit(EXIT_FAILURE);
     }
 
+    if (streamport) {
+        streamSock = Stream_receive_socket(bindhost, streamport, family, bufflen);
+        if (streamSock < 0) {
+            LogError("Terminated due to errors");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     pid_t repeater_pid = 0;
     int rfd = 0;
     if (repeater[0].hostname) {
@@ -985,7 +1792,7 @@ int main(int argc, char **argv) {
 
     int launcher_pid = 0;
     int pfd = 0;
-    if (launch_process || expire) {
+    if (launch_process || rollup || expire) {
         pfd = PrivsepFork(argc, argv, &launcher_pid, "launcher");
     }
 
@@ -1024,10 +1831,15 @@ int main(int argc, char **argv) {
     sigaction(SIGPIPE, &act, NULL);
 
     LogInfo("Startup nfcapd.");
-    run(receive_packet, sock, pfd, rfd, twin, t_start, subdir_index, time_extension, compress);
+    if (numWorkers)
+        runWorkers(sockets, numWorkers, pfd, rfd, twin, t_start, subdir_index, time_extension, compress);
+    else
+        run(receive_packet, sock, pfd, rfd, twin, t_start, subdir_index, time_extension, compress);
 
     // shutdown
     close(sock);
+    if (streamSock) close(streamSock);
+    for (int i = 1; i < numWorkers; i++) close(sockets[i]);
     signalPrivsepChild(launcher_pid, pfd);
     signalPrivsepChild(repeater_pid, rfd);
     CloseMetric();
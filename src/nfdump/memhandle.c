@@ -1,5 +1,5 @@
 /*
- *  Copyright (c) 2021, Peter Haag
+ *  Copyright (c) 2021-2023, Peter Haag
  *  All rights reserved.
  *
  *  Redistribution and use in source and binary forms, with or without
@@ -28,16 +28,18 @@
  *
  */
 
-#ifdef __x86_64
-#define ALIGN_MASK 0xFFFFFFF8
-#else
-#define ALIGN_MASK 0xFFFFFFFC
-#endif
-
-#include "spin_lock.h"
+/*
+ * Bump allocator for the flow cache and element stat records
+ * Each thread allocates from its own arena without any locking. An arena is a
+ * list of memory blocks, which grows without a fixed limit. New arenas are linked
+ * lock-free into the list of arenas of the MemHandler. Single allocations cannot be
+ * released - all memory is released in bulk by nfalloc_free().
+ * Memory blocks are mmap()ed and advised to be backed by transparent huge pages,
+ * if supported and enabled by the system.
+ */
 
-#define GetLock(a) spin_lock(((a)->lock))
-#define ReleaseLock(a) spin_unlock(((a)->lock))
+#include <stdatomic.h>
+#include <sys/mman.h>
 
 #define ALIGN_BYTES      \
     (offsetof(           \
@@ -51,23 +53,37 @@
 // Each pre-allocated memory block is 10M
 #define DefaultMemBlockSize 10 * 1024 * 1024
 
-typedef struct MemHandler_s {
-    size_t BlockSize; /* max size of each pre-allocated memblock */
+// memory blocks are a multiple of the huge page size
+#define HugePageSize (2 * 1024 * 1024)
+
+typedef struct memBlock_s {
+    struct memBlock_s *next;  // next memory block of arena
+    size_t size;              // size of memory block including header
+} memBlock_t;
 
-    /* memory blocks - containing the flow records and keys */
-    void **memblock;     /* array holding all NumBlocks allocated memory blocks */
-    size_t MaxBlocks;    /* Size of memblock array */
-    size_t NumBlocks;    /* number of allocated flow blocks in memblock array */
-    size_t CurrentBlock; /* Index of current memblock to allocate memory from */
-    size_t Allocted;     /* Number of bytes already allocated in memblock */
+#define MemBlockHeaderSize ((sizeof(memBlock_t) + ALIGN_BYTES) & ~ALIGN_BYTES)
 
-    atomic_int lock;
+typedef struct memArena_s {
+    struct memArena_s *next;  // next arena of MemHandler
+    memBlock_t *memblock;     // list of memory blocks - current block first
+    size_t Allocted;          // number of bytes already allocated in current memblock
+    size_t NumBlocks;         // number of memory blocks
+    size_t Used;              // number of bytes allocated in all memory blocks
+} memArena_t;
 
+typedef struct MemHandler_s {
+    size_t BlockSize;     // size of each memory block
+    uint32_t generation;  // invalidates thread arenas of previous MemHandlers
+
+    _Atomic(memArena_t *) arenas;  // list of all thread arenas
 } MemHandler_t;
 
 static MemHandler_t *MemHandler = NULL;
+static uint32_t MemGeneration = 0;
 
-#define MaxMemBlocks 256
+// arena of the current thread
+static __thread memArena_t *threadArena = NULL;
+static __thread uint32_t threadGeneration = 0;
 
 static int nfalloc_Init(uint32_t memBlockSize) {
     MemHandler = calloc(1, sizeof(MemHandler_t));
@@ -76,27 +92,10 @@ static int nfalloc_Init(uint32_t memBlockSize) {
         return 0;
     }
 
-    MemHandler->memblock = (void **)calloc(MaxMemBlocks, sizeof(void *));
-    if (!MemHandler->memblock) {
-        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
-        return 0;
-    }
-
     if (memBlockSize == 0) memBlockSize = DefaultMemBlockSize;
-
-    MemHandler->BlockSize = memBlockSize;
-
-    MemHandler->memblock[0] = calloc(1, memBlockSize);
-    if (!MemHandler->memblock[0]) {
-        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
-        return 0;
-    }
-
-    MemHandler->MaxBlocks = MaxMemBlocks;
-    MemHandler->NumBlocks = 1;
-    MemHandler->CurrentBlock = 0;
-    MemHandler->Allocted = 0;
-    MemHandler->lock = 0;
+    MemHandler->BlockSize = (memBlockSize + HugePageSize - 1) & ~((size_t)HugePageSize - 1);
+    MemHandler->generation = ++MemGeneration;
+    atomic_init(&MemHandler->arenas, NULL);
 
     return 1;
 
@@ -105,62 +104,91 @@ static int nfalloc_Init(uint32_t memBlockSize) {
 static void nfalloc_free(void) {
     if (!MemHandler) return;
 
-    for (int i = 0; i < MemHandler->NumBlocks; i++) {
-        free(MemHandler->memblock[i]);
+    memArena_t *arena = atomic_load(&MemHandler->arenas);
+    while (arena) {
+        memBlock_t *memblock = arena->memblock;
+        while (memblock) {
+            memBlock_t *next = memblock->next;
+            munmap((void *)memblock, memblock->size);
+            memblock = next;
+        }
+        memArena_t *next = arena->next;
+        free((void *)arena);
+        arena = next;
     }
-    MemHandler->NumBlocks = 0;
-    MemHandler->CurrentBlock = 0;
-    MemHandler->Allocted = 0;
 
-    free((void *)MemHandler->memblock);
-    MemHandler->memblock = NULL;
-    MemHandler->MaxBlocks = 0;
     free((void *)MemHandler);
+    MemHandler = NULL;
 
 }  // End of nfalloc_free
 
-static inline void *nfmalloc(size_t size) {
-    void *p;
-    size_t aligned_size;
+// create and register the arena of the current thread
+static memArena_t *nfalloc_NewArena(void) {
+    memArena_t *arena = calloc(1, sizeof(memArena_t));
+    if (!arena) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    memArena_t *head = atomic_load(&MemHandler->arenas);
+    do {
+        arena->next = head;
+    } while (!atomic_compare_exchange_weak(&MemHandler->arenas, &head, arena));
+
+    threadArena = arena;
+    threadGeneration = MemHandler->generation;
+
+    return arena;
 
+}  // End of nfalloc_NewArena
+
+// add a new memory block to the arena and allocate size bytes
+static void *nfalloc_NewBlock(memArena_t *arena, size_t size) {
+    size_t blockSize = MemHandler->BlockSize;
+    if ((size + MemBlockHeaderSize) > blockSize) {
+        // oversized request - gets its own memory block
+        blockSize = (size + MemBlockHeaderSize + HugePageSize - 1) & ~((size_t)HugePageSize - 1);
+    }
+
+    void *p = mmap(NULL, blockSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        LogError("mmap() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(p, blockSize, MADV_HUGEPAGE);
+#endif
+
+    memBlock_t *memblock = (memBlock_t *)p;
+    memblock->size = blockSize;
+    memblock->next = arena->memblock;
+    arena->memblock = memblock;
+    arena->NumBlocks++;
+    arena->Allocted = MemBlockHeaderSize + size;
+    arena->Used += size;
+
+    return p + MemBlockHeaderSize;
+
+}  // End of nfalloc_NewBlock
+
+static inline void *nfmalloc(size_t size) {
     // make sure size of memory is aligned
-    aligned_size = (((size) + ALIGN_BYTES) & ~ALIGN_BYTES);
+    size_t aligned_size = (((size) + ALIGN_BYTES) & ~ALIGN_BYTES);
+
+    memArena_t *arena = threadArena;
+    if (arena == NULL || threadGeneration != MemHandler->generation) arena = nfalloc_NewArena();
 
-    GetLock(MemHandler);
-    if ((MemHandler->Allocted + aligned_size) <= MemHandler->BlockSize) {
+    if (arena->memblock && (arena->Allocted + aligned_size) <= arena->memblock->size) {
         // enough space available in current memblock
-        p = MemHandler->memblock[MemHandler->CurrentBlock] + MemHandler->Allocted;
-        MemHandler->Allocted += aligned_size;
+        void *p = (void *)arena->memblock + arena->Allocted;
+        arena->Allocted += aligned_size;
+        arena->Used += aligned_size;
         dbg_printf("Mem Handle: Requested: %zu, aligned: %zu, ptr: %lx\n", size, aligned_size, (long unsigned)p);
-        ReleaseLock(MemHandler);
         return p;
     }
 
     // not enough space - allocate a new memblock
-
-    MemHandler->CurrentBlock++;
-    if (MemHandler->CurrentBlock >= MemHandler->MaxBlocks) {
-        // we run out in memblock array - re-allocate memblock array
-        MemHandler->MaxBlocks += MaxMemBlocks;
-        MemHandler->memblock = (void **)realloc(MemHandler->memblock, MemHandler->MaxBlocks * sizeof(void *));
-        if (!MemHandler->memblock) {
-            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-            exit(255);
-        }
-    }
-
-    // allocate new memblock
-    p = malloc(MemHandler->BlockSize);
-    if (!p) {
-        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        exit(255);
-    }
-    MemHandler->memblock[MemHandler->CurrentBlock] = p;
-    MemHandler->Allocted = aligned_size;
-    MemHandler->NumBlocks++;
-    ReleaseLock(MemHandler);
-    dbg_printf("Mem Handle: Requested: %zu, aligned: %zu, ptr: %lu\n", size, aligned_size, (long unsigned)p);
-    return p;
+    return nfalloc_NewBlock(arena, aligned_size);
 
 }  // End of nfmalloc
 
@@ -172,5 +200,24 @@ static inline void *nfcalloc(size_t count, size_t size) {
 }  // nfcalloc
 
 static inline void nffree(void *p) {
-    // not implemented
+    // not implemented - memory is released in bulk by nfalloc_free()
 }
+
+// print usage of all arenas - call only, when all threads are done
+static void nfalloc_Print(char *name) {
+    if (!MemHandler) return;
+
+    uint32_t numArenas = 0;
+    uint64_t numBlocks = 0, reserved = 0, used = 0;
+    for (memArena_t *arena = atomic_load(&MemHandler->arenas); arena; arena = arena->next) {
+        numArenas++;
+        numBlocks += arena->NumBlocks;
+        used += arena->Used;
+        for (memBlock_t *memblock = arena->memblock; memblock; memblock = memblock->next) reserved += memblock->size;
+    }
+    if (numBlocks == 0) return;
+
+    printf("Memory %s: arenas: %u, blocks: %llu, reserved: %.1f MB, used: %.1f MB\n", name, numArenas, (unsigned long long)numBlocks,
+           (double)reserved / (1024.0 * 1024.0), (double)used / (1024.0 * 1024.0));
+
+}  // End of nfalloc_Print
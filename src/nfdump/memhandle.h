@@ -41,4 +41,6 @@ static inline void *nfcalloc(size_t count, size_t size);
 
 static inline void nffree(void *p);
 
+static void nfalloc_Print(char *name);
+
 #endif  //_MEMHANDLE_H
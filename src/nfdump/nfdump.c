@@ -101,6 +101,8 @@ static void PrintSummary(stat_record_t *stat_record, outputParams_t *outputParam
 static stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows, RecordPrinter_t print_record,
                                   timeWindow_t *timeWindow, uint64_t limitRecords, outputParams_t *outputParams, int compress);
 
+static queue_t *ReadCachedFiles(queue_t *fileList, statCacheSum_t *cacheSum);
+
 /* Functions */
 
 #include "nfdump_inline.c"
@@ -128,6 +130,8 @@ static void usage(char *name) {
         "-N\t\tPrint plain numbers\n"
         "-s <expr>[/<order>]\tGenerate statistics for <expr> any valid record element.\n"
         "\t\tand ordered by <order>: packets, bytes, flows, bps pps and bpp.\n"
+        "\t\tAppend '~' for approximate statistics in fixed memory: -s srcip/bytes~\n"
+        "-k\t\tCache -s element statistics of each file in <file>.stat and reuse them.\n"
         "-q\t\tQuiet: Do not print the header and bottom stat lines.\n"
         "-i <ident>\tChange Ident to <ident> in file given by -r.\n"
         "-J <num>\tModify file compression: 0: uncompressed - 1: LZO - 2: BZ2 - 3: LZ4 "
@@ -255,13 +259,19 @@ static inline record_header_t *AddFlowLabel(record_header_t *record, char *label
 static stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows, RecordPrinter_t print_record,
                                   timeWindow_t *timeWindow, uint64_t limitRecords, outputParams_t *outputParams, int compress) {
     nffile_t *nffile_w, *nffile_r;
-    stat_record_t stat_record;
+    stat_record_t stat_record, file_stat;
     uint64_t twin_msecFirst, twin_msecLast;
 
     // time window of all matched flows
     memset((void *)&stat_record, 0, sizeof(stat_record_t));
     stat_record.firstseen = 0x7fffffffffffffffLL;
 
+    // stat of the current file for the element stat cache
+    memset((void *)&file_stat, 0, sizeof(stat_record_t));
+    file_stat.firstseen = 0x7fffffffffffffffLL;
+    uint32_t file_processed = processed;
+    uint32_t file_passed = passed;
+
     if (timeWindow) {
         twin_msecFirst = timeWindow->first * 1000LL;
         if (timeWindow->last)
@@ -334,6 +344,14 @@ static stat_record_t process_data(char *wfile, int element_stat, int flow_stat,
                     LogError("Read error in file '%s': %s\n", nffile_r->fileName, strerror(errno));
                 // fall through - get next file in chain
             case NF_EOF: {
+                if (TestFlag(element_stat, FLAG_CACHE)) {
+                    // cache element stat of completely read files only
+                    FlushStatCache(ret == NF_EOF ? nffile_r : NULL, &file_stat, processed - file_processed, passed - file_passed);
+                    memset((void *)&file_stat, 0, sizeof(stat_record_t));
+                    file_stat.firstseen = 0x7fffffffffffffffLL;
+                    file_processed = processed;
+                    file_passed = passed;
+                }
                 nffile_t *next = GetNextFile(nffile_r);
                 if (next == EMPTY_LIST) {
                     done = 1;
@@ -435,6 +453,7 @@ static stat_record_t process_data(char *wfile, int element_stat, int flow_stat,
                     if (Engine->label) printf("Flow has label: %s\n", Engine->label);
 #endif
                     UpdateStat(&stat_record, master_record);
+                    if (TestFlag(element_stat, FLAG_CACHE)) UpdateStat(&file_stat, master_record);
 
                     if (flow_stat) {
                         AddFlowCache(process_ptr, master_record);
@@ -557,6 +576,56 @@ static stat_record_t process_data(char *wfile, int element_stat, int flow_stat,
 
 }  // End of process_data
 
+// merge the element stat of all files with a valid stat cache and
+// return the list of files, which need to be processed
+static queue_t *ReadCachedFiles(queue_t *fileList, statCacheSum_t *cacheSum) {
+    memset((void *)cacheSum, 0, sizeof(statCacheSum_t));
+    cacheSum->stat_record.firstseen = 0x7fffffffffffffffLL;
+    cacheSum->firstseen = 0x7fffffffffffffffLL;
+
+    size_t numFiles = 0;
+    size_t maxFiles = 64;
+    char **files = malloc(maxFiles * sizeof(char *));
+    if (!files) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    char *fileName;
+    while ((fileName = queue_pop(fileList)) != QUEUE_CLOSED) {
+        if (ReadStatCache(fileName, cacheSum)) {
+            dbg_printf("Use stat cache for %s\n", fileName);
+            free(fileName);
+            continue;
+        }
+        if (numFiles == maxFiles) {
+            maxFiles <<= 1;
+            files = realloc(files, maxFiles * sizeof(char *));
+            if (!files) {
+                LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                return NULL;
+            }
+        }
+        files[numFiles++] = fileName;
+    }
+
+    // queue length must be a power of 2
+    size_t queueSize = 1;
+    while (queueSize <= numFiles) queueSize <<= 1;
+    queue_t *fileQueue = queue_init(queueSize);
+    if (!fileQueue) return NULL;
+
+    for (int i = 0; i < numFiles; i++) queue_push(fileQueue, files[i]);
+    queue_close(fileQueue);
+    free(files);
+
+    processed += cacheSum->processed;
+    passed += cacheSum->passed;
+
+    return fileQueue;
+
+}  // End of ReadCachedFiles
+
 int main(int argc, char **argv) {
     struct stat stat_buff;
     stat_record_t sum_stat;
@@ -569,7 +638,7 @@ int main(int argc, char **argv) {
     int ffd, element_stat, fdump;
     int flow_stat, aggregate, aggregate_mask, bidir;
     int print_stat, gnuplot_stat, syntax_only, compress;
-    int GuessDir, ModifyCompress;
+    int GuessDir, ModifyCompress, statCache;
     uint32_t limitRecords;
     char Ident[IDENTLEN];
     flist_t flist;
@@ -589,6 +658,7 @@ int main(int argc, char **argv) {
     skipped_blocks = 0;
     compress = NOT_COMPRESSED;
     GuessDir = 0;
+    statCache = 0;
     nameserver = NULL;
 
     print_format = NULL;
@@ -610,7 +680,7 @@ int main(int argc, char **argv) {
 
     Ident[0] = '\0';
     int c;
-    while ((c = getopt(argc, argv, "6aA:Bbc:C:D:E:G:s:ghn:i:jf:qyzr:v:w:J:M:NImO:R:XZt:TVv:x:l:L:o:")) != EOF) {
+    while ((c = getopt(argc, argv, "6aA:Bbc:C:D:E:G:s:ghkn:i:jf:qyzr:v:w:J:M:NImO:R:XZt:TVv:x:l:L:o:")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -723,6 +793,9 @@ int main(int argc, char **argv) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'k':
+                statCache = 1;
+                break;
             case 'V': {
                 printf("%s: %s\n", argv[0], versionString());
                 exit(EXIT_SUCCESS);
@@ -1064,8 +1137,24 @@ int main(int argc, char **argv) {
 
     if ((aggregate || flow_stat || print_order) && !Init_FlowCache()) exit(250);
 
+    if (statCache) {
+        if (!element_stat || flow_stat || flist.timeWindow || limitRecords) {
+            LogError("Option -k requires element statistics -s and no -s record, -t or -c. Stat cache disabled");
+            statCache = 0;
+        } else {
+            if (!SetStatCache(filter)) exit(EXIT_FAILURE);
+            SetFlag(element_stat, FLAG_CACHE);
+        }
+    }
+
     if (element_stat && !Init_StatTable()) exit(250);
 
+    statCacheSum_t cacheSum;
+    if (statCache) {
+        fileList = ReadCachedFiles(fileList, &cacheSum);
+        if (!fileList || !Init_nffile(fileList)) exit(EXIT_FAILURE);
+    }
+
     SetLimits(element_stat || aggregate || flow_stat, packet_limit_string, byte_limit_string);
 
     if (!(flow_stat || element_stat)) {
@@ -1073,8 +1162,20 @@ int main(int argc, char **argv) {
     }
 
     nfprof_start(&profile_data);
-    sum_stat = process_data(wfile, element_stat, aggregate || flow_stat, print_order != NULL, print_record, flist.timeWindow, limitRecords,
-                            outputParams, compress);
+    if (statCache && queue_done(fileList)) {
+        // all files served from the stat cache
+        sum_stat = cacheSum.stat_record;
+        t_first_flow = cacheSum.firstseen;
+        t_last_flow = cacheSum.lastseen;
+    } else {
+        sum_stat = process_data(wfile, element_stat, aggregate || flow_stat, print_order != NULL, print_record, flist.timeWindow, limitRecords,
+                                outputParams, compress);
+        if (statCache && cacheSum.processed) {
+            SumStatRecords(&sum_stat, &cacheSum.stat_record);
+            if (cacheSum.firstseen < t_first_flow) t_first_flow = cacheSum.firstseen;
+            if (cacheSum.lastseen > t_last_flow) t_last_flow = cacheSum.lastseen;
+        }
+    }
     nfprof_end(&profile_data, processed);
 
     if (passed == 0) {
@@ -1122,9 +1223,16 @@ int main(int argc, char **argv) {
                     }
                     printf("Time window: %s\n", TimeString(t_first_flow, t_last_flow));
                 }
-                printf("Total flows processed: %u, passed: %u, Blocks skipped: %u, Bytes read: %llu\n", processed, passed, skipped_blocks,
+                printf("Total flows processed: %u, passed: %u, Blocks skipped: %u, Bytes read: %llu", processed, passed, skipped_blocks,
                        (unsigned long long)total_bytes);
+                // files served from the -k stat cache are not read
+                if (statCache && cacheSum.files) printf(", Cached files: %u", cacheSum.files);
+                printf("\n");
                 nfprof_print(&profile_data, stdout);
+#ifdef DEVEL
+                if (aggregate || flow_stat || print_order) PrintFlowTableMem();
+                if (element_stat) PrintStatTableMem();
+#endif
                 break;
             case MODE_PIPE:
                 break;
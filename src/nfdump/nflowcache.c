@@ -571,6 +571,8 @@ int Init_FlowCache(void) {
 
 void Dispose_FlowTable(void) { nfalloc_free(); }  // End of Dispose_FlowTable
 
+void PrintFlowTableMem(void) { nfalloc_Print("flow cache"); }  // End of PrintFlowTableMem
+
 // Parse flow cache print order -O
 int Parse_PrintOrder(char *order) {
     int direction = -1;
@@ -133,6 +133,8 @@ int Init_FlowCache(void);
 
 void Dispose_FlowTable(void);
 
+void PrintFlowTableMem(void);
+
 int Parse_PrintOrder(char *order);
 
 char *ParseAggregateMask(char *arg, int hasGeoDB);
@@ -35,16 +35,21 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>
 #include <netinet/in.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "blocksort.h"
 #include "bookkeeper.h"
@@ -300,6 +305,7 @@ struct StatRequest_s {
     int16_t StatType;     // index into StatParameters
     uint8_t order_proto;  // protocol separated statistics
     uint8_t direction;    // sort ascending/descending
+    uint8_t approx;       // approximate stat - use sketches
 } StatRequest[MaxStats];  // This number should do it for a single run
 
 static uint32_t NumStats = 0;  // number of stats in StatRequest
@@ -311,13 +317,69 @@ KHASH_INIT(ElementHash, hashkey_t, StatRecord_t, 1, kh_key_hash_func, kh_key_has
 
 static khash_t(ElementHash) * ElementKHash[MaxStats];
 
+/*
+ * Element stat cache
+ * The element stat of each flow file is collected separately in FileKHash and
+ * stored next to the flow file as <file>.stat. Subsequent runs with the same stat
+ * requests and the same filter merge the cached stat instead of reading the flow file.
+ */
+#define STATCACHE_VERSION 1
+#define STATCACHE_SUFFIX ".stat"
+#define STATCACHE_NAMELEN 16
+#define STATCACHE_MAXFILTER 4096
+// number of StatRecord_t elements in a single cache record
+#define STATCACHE_ELEMENTS 512
+
+typedef struct statCacheInfo_s {
+    // record header
+    uint16_t type;  // StatCacheInfoType
+    uint16_t size;
+    uint16_t version;   // STATCACHE_VERSION
+    uint16_t numStats;  // number of stat requests in cache file
+    uint64_t fileSize;  // size of flow file
+    uint64_t fileTime;  // modification time of flow file
+    uint64_t processed;
+    uint64_t passed;
+    uint64_t firstseen;  // time window of flow file
+    uint64_t lastseen;
+    char filter[4];  // '\0' terminated filter string
+} statCacheInfo_t;
+
+typedef struct statCacheRecord_s {
+    // record header
+    uint16_t type;  // StatCacheRecordType
+    uint16_t size;
+    uint16_t numElements;
+    uint8_t order_proto;
+    uint8_t sketchOrder;  // 0: exact stat, else Space-Saving summary: weight order + 1
+    char statname[STATCACHE_NAMELEN];
+    StatRecord_t record[0];
+} statCacheRecord_t;
+
+// HyperLogLog registers of an approximate stat
+typedef struct statCacheSketch_s {
+    // record header
+    uint16_t type;  // StatCacheSketchType
+    uint16_t size;
+    uint8_t order_proto;
+    uint8_t sketchOrder;
+    uint16_t fill;
+    char statname[STATCACHE_NAMELEN];
+    uint8_t hll[0];
+} statCacheSketch_t;
+
+static khash_t(ElementHash) * FileKHash[MaxStats];
+static char *StatCacheFilter = NULL;
+static int StatCache = 0;
+
 static uint32_t LoadedGeoDB = 0;
 static uint64_t byte_limit, packet_limit;
 static int byte_mode, packet_mode;
 enum { NONE = 0, LESS, MORE };
 
 /* function prototypes */
-static int ParseStatString(char *str, int16_t *StatType, int *flow_stat, uint16_t *order_proto, uint32_t *order_bits, uint32_t *direction);
+static int ParseStatString(char *str, int16_t *StatType, int *flow_stat, uint16_t *order_proto, uint32_t *order_bits, uint32_t *direction,
+                           int *approx);
 
 static int ParseListOrder(char *s, uint32_t *order_bits, uint32_t *direction);
 
@@ -332,6 +394,14 @@ static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int orde
 #include "applybits_inline.c"
 #include "heapsort_inline.c"
 #include "memhandle.c"
+#include "nffile_inline.c"
+#include "sketch_inline.c"
+
+static statSketch_t *ElementSketch[MaxStats];
+static statSketch_t *FileSketch[MaxStats];
+
+// order index, which weights the sketch of stat request j
+static int SketchOrder(int j) { return __builtin_ctz(StatRequest[j].order_bits); }  // End of SketchOrder
 
 static uint64_t null_element(StatRecord_t *record, int inout) { return 0; }
 
@@ -508,6 +578,15 @@ int Init_StatTable(void) {
 
     for (int i = 0; i < NumStats; i++) {
         ElementKHash[i] = kh_init(ElementHash);
+        if (StatCache) FileKHash[i] = kh_init(ElementHash);
+        if (StatRequest[i].approx) {
+            ElementSketch[i] = SketchNew(SketchOrder(i));
+            if (!ElementSketch[i]) return 0;
+            if (StatCache) {
+                FileSketch[i] = SketchNew(SketchOrder(i));
+                if (!FileSketch[i]) return 0;
+            }
+        }
     }
 
     LoadedGeoDB = Loaded_MaxMind();
@@ -518,6 +597,8 @@ int Init_StatTable(void) {
 
 void Dispose_StatTable(void) { nfalloc_free(); }  // End of Dispose_Tables
 
+void PrintStatTableMem(void) { nfalloc_Print("element stat"); }  // End of PrintStatTableMem
+
 int SetStat(char *str, int *element_stat, int *flow_stat) {
     if (NumStats == MaxStats) {
         fprintf(stderr, "Too many stat options! Stats are limited to %i stats per single run!\n", MaxStats);
@@ -529,8 +610,13 @@ int SetStat(char *str, int *element_stat, int *flow_stat) {
     int16_t StatType = 0;
     uint16_t order_proto = 0;
     uint32_t order_bits = 0;
-    if (ParseStatString(str, &StatType, &is_flow_stat, &order_proto, &order_bits, &direction)) {
+    int approx = 0;
+    if (ParseStatString(str, &StatType, &is_flow_stat, &order_proto, &order_bits, &direction, &approx)) {
         if (is_flow_stat) {
+            if (approx) {
+                fprintf(stderr, "Approximate stat not supported for '%s'!\n", str);
+                return 0;
+            }
             *flow_stat = 1;
             Add_FlowStatOrder(order_bits, direction);
         } else {
@@ -538,6 +624,7 @@ int SetStat(char *str, int *element_stat, int *flow_stat) {
             StatRequest[NumStats].order_bits = order_bits;
             StatRequest[NumStats].order_proto = order_proto;
             StatRequest[NumStats].direction = direction;
+            StatRequest[NumStats].approx = approx;
             NumStats++;
             SetFlag(*element_stat, FLAG_STAT);
             if (StatParameters[StatType].type == IS_JA3) SetFlag(*element_stat, FLAG_JA3);
@@ -601,13 +688,20 @@ static int ParseListOrder(char *s, uint32_t *order_bits, uint32_t *direction) {
 
 }  // End of ParseListOrder
 
-static int ParseStatString(char *str, int16_t *StatType, int *flow_stat, uint16_t *order_proto, uint32_t *order_bits, uint32_t *direction) {
+static int ParseStatString(char *str, int16_t *StatType, int *flow_stat, uint16_t *order_proto, uint32_t *order_bits, uint32_t *direction,
+                           int *approx) {
     char *s, *p, *q, *r;
     int i = 0;
 
     if (NumStats >= MaxStats) return 0;
 
     s = strdup(str);
+
+    // trailing '~' selects the approximate stat
+    size_t len = strlen(s);
+    *approx = len && s[len - 1] == '~';
+    if (*approx) s[len - 1] = '\0';
+
     q = strchr(s, '/');
     if (q) *q = 0;
 
@@ -655,55 +749,402 @@ static int ParseStatString(char *str, int16_t *StatType, int *flow_stat, uint16_
 
 }  // End of ParseStatString
 
+/*
+ * Fused per record kernel for all -s element stats: compute all hash keys and
+ * prefetch the hash buckets of all stat tables first, then update the tables.
+ * This overlaps the cache misses of the random hash probes of all stats.
+ */
 void AddElementStat(master_record_t *flow_record) {
-    int j, i;
+    hashkey_t hashkey[MaxStats][2];
+
+    // with the stat cache, collect the element stat of the current file separately
+    khash_t(ElementHash) **StatHash = StatCache ? FileKHash : ElementKHash;
+    statSketch_t **StatSketch = StatCache ? FileSketch : ElementSketch;
+
+    // for every requested -s stat compute the keys of all elements and prefetch the buckets
+    for (int j = 0; j < NumStats; j++) {
+        struct StatParameter_s *statParameter = &StatParameters[StatRequest[j].StatType];
+        uint8_t proto = StatRequest[j].order_proto ? flow_record->proto : 0;
+        for (int i = 0; i < statParameter->num_elem; i++) {
+            struct flow_element_s *element = &statParameter->element[i];
+            hashkey[j][i].v1 = (((uint64_t *)flow_record)[element->offset1] & element->mask) >> element->shift;
+            hashkey[j][i].v0 = element->offset0 ? ((uint64_t *)flow_record)[element->offset0] : 0;
+            hashkey[j][i].proto = proto;
+
+            khash_t(ElementHash) *hash = StatHash[j];
+            if (StatRequest[j].approx || hash->n_buckets == 0) continue;
+            khint_t bucket = kh_key_hash_func(hashkey[j][i]) & (hash->n_buckets - 1);
+            __builtin_prefetch(&hash->flags[bucket >> 4]);
+            __builtin_prefetch(&hash->keys[bucket]);
+            __builtin_prefetch(&hash->vals[bucket], 1);
+        }
+    }
 
-    // for every requested -s stat do
-    for (j = 0; j < NumStats; j++) {
-        int stat = StatRequest[j].StatType;
-        int order_proto = StatRequest[j].order_proto;
-        // for the number of elements in this stat type
-        for (i = 0; i < StatParameters[stat].num_elem; i++) {
-            uint32_t offset = StatParameters[stat].element[i].offset1;
-            uint64_t mask = StatParameters[stat].element[i].mask;
-            uint32_t shift = StatParameters[stat].element[i].shift;
-
-            hashkey_t hashkey;
-            hashkey.v1 = (((uint64_t *)flow_record)[offset] & mask) >> shift;
-            offset = StatParameters[stat].element[i].offset0;
-            hashkey.v0 = offset ? ((uint64_t *)flow_record)[offset] : 0;
-            hashkey.proto = order_proto ? flow_record->proto : 0;
+    uint64_t flows = flow_record->aggr_flows ? flow_record->aggr_flows : 1;
+
+    // update all stat tables
+    for (int j = 0; j < NumStats; j++) {
+        int num_elem = StatParameters[StatRequest[j].StatType].num_elem;
+        for (int i = 0; i < num_elem; i++) {
+            if (StatRequest[j].approx) {
+                StatRecord_t statRecord = {
+                    .counter = {flows, flow_record->inPackets, flow_record->inBytes, flow_record->out_pkts, flow_record->out_bytes},
+                    .msecFirst = flow_record->msecFirst,
+                    .msecLast = flow_record->msecLast,
+                    .hashkey = hashkey[j][i]};
+                SketchAdd(StatSketch[j], &statRecord);
+                continue;
+            }
 
             int ret;
-            khiter_t k = kh_put(ElementHash, ElementKHash[j], hashkey, &ret);
+            khiter_t k = kh_put(ElementHash, StatHash[j], hashkey[j][i], &ret);
+            StatRecord_t *r = &kh_value(StatHash[j], k);
             if (ret == 0) {
-                kh_value(ElementKHash[j], k).counter[INBYTES] += flow_record->inBytes;
-                kh_value(ElementKHash[j], k).counter[INPACKETS] += flow_record->inPackets;
-                kh_value(ElementKHash[j], k).counter[OUTBYTES] += flow_record->out_bytes;
-                kh_value(ElementKHash[j], k).counter[OUTPACKETS] += flow_record->out_pkts;
+                r->counter[INBYTES] += flow_record->inBytes;
+                r->counter[INPACKETS] += flow_record->inPackets;
+                r->counter[OUTBYTES] += flow_record->out_bytes;
+                r->counter[OUTPACKETS] += flow_record->out_pkts;
 
-                if (flow_record->msecFirst < kh_value(ElementKHash[j], k).msecFirst) {
-                    kh_value(ElementKHash[j], k).msecFirst = flow_record->msecFirst;
+                if (flow_record->msecFirst < r->msecFirst) {
+                    r->msecFirst = flow_record->msecFirst;
                 }
-                if (flow_record->msecLast > kh_value(ElementKHash[j], k).msecLast) {
-                    kh_value(ElementKHash[j], k).msecLast = flow_record->msecLast;
+                if (flow_record->msecLast > r->msecLast) {
+                    r->msecLast = flow_record->msecLast;
                 }
-                kh_value(ElementKHash[j], k).counter[FLOWS] += flow_record->aggr_flows ? flow_record->aggr_flows : 1;
+                r->counter[FLOWS] += flows;
 
             } else {
-                kh_value(ElementKHash[j], k).counter[INBYTES] = flow_record->inBytes;
-                kh_value(ElementKHash[j], k).counter[INPACKETS] = flow_record->inPackets;
-                kh_value(ElementKHash[j], k).counter[OUTBYTES] = flow_record->out_bytes;
-                kh_value(ElementKHash[j], k).counter[OUTPACKETS] = flow_record->out_pkts;
-                kh_value(ElementKHash[j], k).msecFirst = flow_record->msecFirst;
-                kh_value(ElementKHash[j], k).msecLast = flow_record->msecLast;
-                kh_value(ElementKHash[j], k).counter[FLOWS] = flow_record->aggr_flows ? flow_record->aggr_flows : 1;
-                kh_value(ElementKHash[j], k).hashkey = hashkey;
+                r->counter[INBYTES] = flow_record->inBytes;
+                r->counter[INPACKETS] = flow_record->inPackets;
+                r->counter[OUTBYTES] = flow_record->out_bytes;
+                r->counter[OUTPACKETS] = flow_record->out_pkts;
+                r->msecFirst = flow_record->msecFirst;
+                r->msecLast = flow_record->msecLast;
+                r->counter[FLOWS] = flows;
+                r->hashkey = hashkey[j][i];
             }
         }  // for the number of elements in this stat type
     }      // for every requested -s stat
 }  // AddElementStat
 
+static inline void MergeStatRecord(khash_t(ElementHash) * hash, StatRecord_t *statRecord) {
+    int ret;
+    khiter_t k = kh_put(ElementHash, hash, statRecord->hashkey, &ret);
+    if (ret == 0) {
+        StatRecord_t *r = &kh_value(hash, k);
+        r->counter[FLOWS] += statRecord->counter[FLOWS];
+        r->counter[INPACKETS] += statRecord->counter[INPACKETS];
+        r->counter[INBYTES] += statRecord->counter[INBYTES];
+        r->counter[OUTPACKETS] += statRecord->counter[OUTPACKETS];
+        r->counter[OUTBYTES] += statRecord->counter[OUTBYTES];
+        if (statRecord->msecFirst < r->msecFirst) r->msecFirst = statRecord->msecFirst;
+        if (statRecord->msecLast > r->msecLast) r->msecLast = statRecord->msecLast;
+    } else {
+        kh_value(hash, k) = *statRecord;
+    }
+
+}  // End of MergeStatRecord
+
+// merge the element stat of the current file into the overall element stat
+static void MergeFileStat(void) {
+    for (int j = 0; j < NumStats; j++) {
+        for (khiter_t k = kh_begin(FileKHash[j]); k != kh_end(FileKHash[j]); ++k) {
+            if (kh_exist(FileKHash[j], k)) MergeStatRecord(ElementKHash[j], &kh_value(FileKHash[j], k));
+        }
+        kh_clear(ElementHash, FileKHash[j]);
+        if (StatRequest[j].approx) {
+            SketchMerge(ElementSketch[j], FileSketch[j]);
+            SketchClear(FileSketch[j]);
+        }
+    }
+
+}  // End of MergeFileStat
+
+// sketchOrder of cache records for stat request j
+static inline uint8_t CacheSketchOrder(int j) { return StatRequest[j].approx ? SketchOrder(j) + 1 : 0; }  // End of CacheSketchOrder
+
+// return 1, if stat request j is a duplicate of a previous request
+static int DuplicateStat(int j) {
+    for (int i = 0; i < j; i++) {
+        if (StatRequest[i].StatType == StatRequest[j].StatType && StatRequest[i].order_proto == StatRequest[j].order_proto &&
+            StatRequest[i].approx == StatRequest[j].approx && (!StatRequest[j].approx || SketchOrder(i) == SketchOrder(j)))
+            return 1;
+    }
+    return 0;
+
+}  // End of DuplicateStat
+
+int SetStatCache(char *filter) {
+    if (strlen(filter) >= STATCACHE_MAXFILTER) {
+        LogError("Filter too long for element stat cache");
+        return 0;
+    }
+    StatCacheFilter = strdup(filter);
+    StatCache = 1;
+    return 1;
+
+}  // End of SetStatCache
+
+int ReadStatCache(char *fileName, statCacheSum_t *cacheSum) {
+    char cacheName[MAXPATHLEN];
+    struct stat fileStat, cacheStat;
+
+    if (!StatCache) return 0;
+
+    snprintf(cacheName, MAXPATHLEN, "%s%s", fileName, STATCACHE_SUFFIX);
+    cacheName[MAXPATHLEN - 1] = '\0';
+    if (stat(fileName, &fileStat) || stat(cacheName, &cacheStat)) return 0;
+
+    nffile_t *nffile = OpenFile(cacheName, NULL);
+    if (!nffile) return 0;
+
+    int valid = 0;
+    int loaded[MaxStats] = {0};
+    statCacheInfo_t cacheInfo = {0};
+    int ret;
+    while ((ret = ReadBlock(nffile)) > 0) {
+        record_header_t *record_ptr = nffile->buff_ptr;
+        uint32_t sumSize = 0;
+        for (int i = 0; i < nffile->block_header->NumRecords; i++) {
+            if ((sumSize + record_ptr->size) > ret || (record_ptr->size < sizeof(record_header_t))) {
+                LogError("Corrupt stat cache file '%s'", cacheName);
+                valid = 0;
+                goto DONE;
+            }
+            sumSize += record_ptr->size;
+
+            switch (record_ptr->type) {
+                case StatCacheInfoType: {
+                    statCacheInfo_t *info = (statCacheInfo_t *)record_ptr;
+                    size_t filterLen = info->size - offsetof(statCacheInfo_t, filter);
+                    if (info->version != STATCACHE_VERSION || info->fileSize != (uint64_t)fileStat.st_size ||
+                        info->fileTime != (uint64_t)fileStat.st_mtime || memchr(info->filter, '\0', filterLen) == NULL ||
+                        strcmp(info->filter, StatCacheFilter) != 0) {
+                        // stat cache outdated or for another filter
+                        goto DONE;
+                    }
+                    cacheInfo = *info;
+                    valid = 1;
+                } break;
+                case StatCacheRecordType: {
+                    statCacheRecord_t *cacheRecord = (statCacheRecord_t *)record_ptr;
+                    if (!valid || cacheRecord->size != (sizeof(statCacheRecord_t) + cacheRecord->numElements * sizeof(StatRecord_t))) {
+                        valid = 0;
+                        goto DONE;
+                    }
+                    cacheRecord->statname[STATCACHE_NAMELEN - 1] = '\0';
+                    StatRecord_t *statRecord = (StatRecord_t *)((void *)cacheRecord + sizeof(statCacheRecord_t));
+                    for (int j = 0; j < NumStats; j++) {
+                        int stat = StatRequest[j].StatType;
+                        if (strcmp(cacheRecord->statname, StatParameters[stat].statname) != 0 ||
+                            cacheRecord->order_proto != StatRequest[j].order_proto || cacheRecord->sketchOrder != CacheSketchOrder(j))
+                            continue;
+                        for (int k = 0; k < cacheRecord->numElements; k++) {
+                            if (StatRequest[j].approx)
+                                SketchUpdate(FileSketch[j], &statRecord[k]);
+                            else
+                                MergeStatRecord(FileKHash[j], &statRecord[k]);
+                        }
+                        loaded[j] |= 1;
+                    }
+                } break;
+                case StatCacheSketchType: {
+                    statCacheSketch_t *cacheSketch = (statCacheSketch_t *)record_ptr;
+                    if (!valid || cacheSketch->size != (sizeof(statCacheSketch_t) + HLL_REGISTERS)) {
+                        valid = 0;
+                        goto DONE;
+                    }
+                    cacheSketch->statname[STATCACHE_NAMELEN - 1] = '\0';
+                    for (int j = 0; j < NumStats; j++) {
+                        int stat = StatRequest[j].StatType;
+                        if (!StatRequest[j].approx || strcmp(cacheSketch->statname, StatParameters[stat].statname) != 0 ||
+                            cacheSketch->order_proto != StatRequest[j].order_proto || cacheSketch->sketchOrder != CacheSketchOrder(j))
+                            continue;
+                        for (int k = 0; k < HLL_REGISTERS; k++) {
+                            if (cacheSketch->hll[k] > FileSketch[j]->hll[k]) FileSketch[j]->hll[k] = cacheSketch->hll[k];
+                        }
+                        loaded[j] |= 2;
+                    }
+                } break;
+                default:
+                    LogError("Skip unknown record type %i in stat cache file '%s'", record_ptr->type, cacheName);
+            }
+            record_ptr = (record_header_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+        }
+    }
+
+    // all requested stats must be available
+    for (int j = 0; j < NumStats; j++) {
+        if (loaded[j] != (StatRequest[j].approx ? 3 : 1)) valid = 0;
+    }
+
+DONE:
+    if (valid) {
+        SumStatRecords(&cacheSum->stat_record, nffile->stat_record);
+        cacheSum->processed += cacheInfo.processed;
+        cacheSum->passed += cacheInfo.passed;
+        cacheSum->files++;
+        if (cacheInfo.firstseen < cacheSum->firstseen) cacheSum->firstseen = cacheInfo.firstseen;
+        if (cacheInfo.lastseen > cacheSum->lastseen) cacheSum->lastseen = cacheInfo.lastseen;
+        MergeFileStat();
+    } else {
+        for (int j = 0; j < NumStats; j++) {
+            kh_clear(ElementHash, FileKHash[j]);
+            if (StatRequest[j].approx) SketchClear(FileSketch[j]);
+        }
+    }
+    CloseFile(nffile);
+    DisposeFile(nffile);
+
+    return valid;
+
+}  // End of ReadStatCache
+
+// write the sketch of stat request j as cache records
+static int WriteCacheSketch(nffile_t *nffile, int j) {
+    statSketch_t *sketch = FileSketch[j];
+    char *statname = StatParameters[StatRequest[j].StatType].statname;
+
+    uint32_t slot = 0;
+    do {
+        if (!CheckBufferSpace(nffile, sizeof(statCacheRecord_t) + STATCACHE_ELEMENTS * sizeof(StatRecord_t))) return 0;
+        statCacheRecord_t *cacheRecord = (statCacheRecord_t *)nffile->buff_ptr;
+        memset((void *)cacheRecord, 0, sizeof(statCacheRecord_t));
+        cacheRecord->type = StatCacheRecordType;
+        cacheRecord->order_proto = StatRequest[j].order_proto;
+        cacheRecord->sketchOrder = CacheSketchOrder(j);
+        strncpy(cacheRecord->statname, statname, STATCACHE_NAMELEN - 1);
+
+        uint32_t numElements = sketch->numSlots - slot;
+        if (numElements > STATCACHE_ELEMENTS) numElements = STATCACHE_ELEMENTS;
+        memcpy((void *)cacheRecord->record, (void *)&sketch->slot[slot], numElements * sizeof(StatRecord_t));
+        slot += numElements;
+        cacheRecord->numElements = numElements;
+        cacheRecord->size = sizeof(statCacheRecord_t) + numElements * sizeof(StatRecord_t);
+        nffile->block_header->NumRecords++;
+        nffile->block_header->size += cacheRecord->size;
+        nffile->buff_ptr += cacheRecord->size;
+    } while (slot < sketch->numSlots);
+
+    if (!CheckBufferSpace(nffile, sizeof(statCacheSketch_t) + HLL_REGISTERS)) return 0;
+    statCacheSketch_t *cacheSketch = (statCacheSketch_t *)nffile->buff_ptr;
+    memset((void *)cacheSketch, 0, sizeof(statCacheSketch_t));
+    cacheSketch->type = StatCacheSketchType;
+    cacheSketch->size = sizeof(statCacheSketch_t) + HLL_REGISTERS;
+    cacheSketch->order_proto = StatRequest[j].order_proto;
+    cacheSketch->sketchOrder = CacheSketchOrder(j);
+    strncpy(cacheSketch->statname, statname, STATCACHE_NAMELEN - 1);
+    memcpy((void *)cacheSketch->hll, (void *)sketch->hll, HLL_REGISTERS);
+    nffile->block_header->NumRecords++;
+    nffile->block_header->size += cacheSketch->size;
+    nffile->buff_ptr += cacheSketch->size;
+
+    return 1;
+
+}  // End of WriteCacheSketch
+
+static void WriteStatCache(nffile_t *nffile_r, stat_record_t *stat_record, uint64_t processed, uint64_t passed) {
+    char cacheName[MAXPATHLEN], tmpName[MAXPATHLEN];
+    struct stat fileStat;
+
+    char *fileName = nffile_r->fileName;
+    if (stat(fileName, &fileStat)) return;
+
+    snprintf(cacheName, MAXPATHLEN, "%s%s", fileName, STATCACHE_SUFFIX);
+    cacheName[MAXPATHLEN - 1] = '\0';
+    snprintf(tmpName, MAXPATHLEN, "%s%s-%d", fileName, STATCACHE_SUFFIX, (int)getpid());
+    tmpName[MAXPATHLEN - 1] = '\0';
+
+    nffile_t *nffile = OpenNewFile(tmpName, NULL, CREATOR_NFDUMP, LZ4_COMPRESSED, NOT_ENCRYPTED);
+    if (!nffile) return;
+    memcpy((void *)nffile->stat_record, (void *)stat_record, sizeof(stat_record_t));
+
+    // info record first - keep following records 8 byte aligned
+    size_t filterLen = strlen(StatCacheFilter) + 1;
+    size_t infoSize = (offsetof(statCacheInfo_t, filter) + filterLen + 7) & ~(size_t)7;
+    statCacheInfo_t *info = (statCacheInfo_t *)nffile->buff_ptr;
+    memset((void *)info, 0, infoSize);
+    info->type = StatCacheInfoType;
+    info->size = infoSize;
+    info->version = STATCACHE_VERSION;
+    info->fileSize = fileStat.st_size;
+    info->fileTime = fileStat.st_mtime;
+    info->processed = processed;
+    info->passed = passed;
+    info->firstseen = nffile_r->stat_record->firstseen;
+    info->lastseen = nffile_r->stat_record->lastseen;
+    for (int j = 0; j < NumStats; j++) {
+        if (!DuplicateStat(j)) info->numStats++;
+    }
+    memcpy(info->filter, StatCacheFilter, filterLen);
+    nffile->block_header->NumRecords++;
+    nffile->block_header->size += infoSize;
+    nffile->buff_ptr += infoSize;
+
+    for (int j = 0; j < NumStats; j++) {
+        if (DuplicateStat(j)) continue;
+        if (StatRequest[j].approx) {
+            if (!WriteCacheSketch(nffile, j)) {
+                CloseFile(nffile);
+                DisposeFile(nffile);
+                unlink(tmpName);
+                return;
+            }
+            continue;
+        }
+
+        // at least one record per stat, even if empty
+        statCacheRecord_t *cacheRecord = NULL;
+        khiter_t k = kh_begin(FileKHash[j]);
+        do {
+            if (cacheRecord == NULL) {
+                if (!CheckBufferSpace(nffile, sizeof(statCacheRecord_t) + STATCACHE_ELEMENTS * sizeof(StatRecord_t))) {
+                    CloseFile(nffile);
+                    DisposeFile(nffile);
+                    unlink(tmpName);
+                    return;
+                }
+                cacheRecord = (statCacheRecord_t *)nffile->buff_ptr;
+                memset((void *)cacheRecord, 0, sizeof(statCacheRecord_t));
+                cacheRecord->type = StatCacheRecordType;
+                cacheRecord->size = sizeof(statCacheRecord_t);
+                cacheRecord->order_proto = StatRequest[j].order_proto;
+                strncpy(cacheRecord->statname, StatParameters[StatRequest[j].StatType].statname, STATCACHE_NAMELEN - 1);
+                nffile->block_header->NumRecords++;
+                nffile->block_header->size += sizeof(statCacheRecord_t);
+                nffile->buff_ptr += sizeof(statCacheRecord_t);
+            }
+            for (; k != kh_end(FileKHash[j]) && cacheRecord->numElements < STATCACHE_ELEMENTS; ++k) {
+                if (!kh_exist(FileKHash[j], k)) continue;
+                memcpy(nffile->buff_ptr, (void *)&kh_value(FileKHash[j], k), sizeof(StatRecord_t));
+                cacheRecord->numElements++;
+                cacheRecord->size += sizeof(StatRecord_t);
+                nffile->block_header->size += sizeof(StatRecord_t);
+                nffile->buff_ptr += sizeof(StatRecord_t);
+            }
+            cacheRecord = NULL;
+        } while (k != kh_end(FileKHash[j]));
+    }
+
+    if (CloseUpdateFile(nffile) && rename(tmpName, cacheName) == 0) {
+        dbg_printf("Wrote stat cache %s\n", cacheName);
+    } else {
+        LogError("Failed to write stat cache file '%s': %s", cacheName, strerror(errno));
+        unlink(tmpName);
+    }
+    DisposeFile(nffile);
+
+}  // End of WriteStatCache
+
+void FlushStatCache(nffile_t *nffile, stat_record_t *stat_record, uint64_t processed, uint64_t passed) {
+    if (!StatCache) return;
+
+    // nffile is NULL for files not completely read - merge, but do not cache
+    if (nffile) WriteStatCache(nffile, stat_record, processed, passed);
+    MergeFileStat();
+
+}  // End of FlushStatCache
+
 static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, StatRecord_t *StatData, int type, int order_proto, int inout) {
     char valstr[64];
     char tag_string[2];
@@ -1070,10 +1511,12 @@ void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, Rec
 
                 // this output formatting is pretty ugly - and needs to be cleaned up - improved
                 if (outputParams->mode == MODE_PLAIN && !outputParams->quiet) {
+                    char *approx = StatRequest[hash_num].approx ? " (approximate)" : "";
                     if (outputParams->topN != 0) {
-                        printf("Top %i %s ordered by %s:\n", outputParams->topN, StatParameters[stat].HeaderInfo, order_mode[order_index].string);
+                        printf("Top %i %s ordered by %s%s:\n", outputParams->topN, StatParameters[stat].HeaderInfo, order_mode[order_index].string,
+                               approx);
                     } else {
-                        printf("Top %s ordered by %s:\n", StatParameters[stat].HeaderInfo, order_mode[order_index].string);
+                        printf("Top %s ordered by %s%s:\n", StatParameters[stat].HeaderInfo, order_mode[order_index].string, approx);
                     }
                     if (Getv6Mode() && (type == IS_IPADDR)) {
                         printf(
@@ -1129,17 +1572,41 @@ void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, Rec
                     }
                 }
                 free((void *)topN_element_list);
+                if (StatRequest[hash_num].approx && outputParams->mode == MODE_PLAIN && !outputParams->quiet) {
+                    printf("Distinct %s: ~%llu\n", StatParameters[stat].HeaderInfo, (unsigned long long)SketchDistinct(ElementSketch[hash_num]));
+                }
                 printf("\n");
             }
         }  // for every requested order
     }      // for every requested -s stat do
 }  // End of PrintElementStat
 
+// add stat record r to the topN list, if it passes the packet and byte limits
+static inline int TopNElement(SortElement_t *topN_element, StatRecord_t *r, int order) {
+    if (byte_limit) {
+        uint64_t value = bytes_element(r, order_mode[order].inout);
+        if ((byte_mode == LESS && value >= byte_limit) || (byte_mode == MORE && value <= byte_limit)) {
+            return 0;
+        }
+    }
+    if (packet_limit) {
+        uint64_t value = packets_element(r, order_mode[order].inout);
+        if ((packet_mode == LESS && value >= packet_limit) || (packet_mode == MORE && value <= packet_limit)) {
+            return 0;
+        }
+    }
+    topN_element->count = order_mode[order].element_function(r, order_mode[order].inout);
+    topN_element->record = (void *)r;
+    return 1;
+
+}  // End of TopNElement
+
 static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int order, int direction) {
     SortElement_t *topN_list;
     uint32_t c, maxindex;
 
-    maxindex = kh_size(ElementKHash[hash_num]);
+    statSketch_t *sketch = StatRequest[hash_num].approx ? ElementSketch[hash_num] : NULL;
+    maxindex = sketch ? sketch->numSlots : kh_size(ElementKHash[hash_num]);
     dbg_printf("StatTopN sort %u records\n", maxindex);
     topN_list = (SortElement_t *)calloc(maxindex, sizeof(SortElement_t));
 
@@ -1150,27 +1617,15 @@ static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int orde
 
     // preset topN_list table - still unsorted
     c = 0;
-    // Iterate through all buckets
-    for (khiter_t k = kh_begin(ElementKHash[hash_num]); k != kh_end(ElementKHash[hash_num]); ++k) {  // traverse
-        if (kh_exist(ElementKHash[hash_num], k)) {
-            StatRecord_t *r = &kh_value(ElementKHash[hash_num], k);
-
-            // we want to sort only those flows which pass the packet or byte limits
-            if (byte_limit) {
-                uint64_t value = bytes_element(r, order_mode[order].inout);
-                if ((byte_mode == LESS && value >= byte_limit) || (byte_mode == MORE && value <= byte_limit)) {
-                    continue;
-                }
-            }
-            if (packet_limit) {
-                uint64_t value = packets_element(r, order_mode[order].inout);
-                if ((packet_mode == LESS && value >= packet_limit) || (packet_mode == MORE && value <= packet_limit)) {
-                    continue;
-                }
-            }
-            topN_list[c].count = order_mode[order].element_function(r, order_mode[order].inout);
-            topN_list[c].record = (void *)r;
-            c++;
+    // we want to sort only those flows which pass the packet or byte limits
+    if (sketch) {
+        for (uint32_t i = 0; i < sketch->numSlots; i++) {
+            c += TopNElement(&topN_list[c], &sketch->slot[i], order);
+        }
+    } else {
+        // Iterate through all buckets
+        for (khiter_t k = kh_begin(ElementKHash[hash_num]); k != kh_end(ElementKHash[hash_num]); ++k) {  // traverse
+            if (kh_exist(ElementKHash[hash_num], k)) c += TopNElement(&topN_list[c], &kh_value(ElementKHash[hash_num], k), order);
         }
     }
 
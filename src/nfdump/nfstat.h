@@ -37,6 +37,7 @@
 
 #include "config.h"
 #include "nfdump.h"
+#include "nffile.h"
 #include "output.h"
 
 #define ASCENDING 1
@@ -45,6 +46,17 @@
 #define FLAG_STAT 0x1
 #define FLAG_JA3 0x2
 #define FLAG_GEO 0x4
+#define FLAG_CACHE 0x8
+
+// summary of all flow files read from the element stat cache
+typedef struct statCacheSum_s {
+    stat_record_t stat_record;  // stat of all matched flows
+    uint64_t processed;         // number of flows processed
+    uint64_t passed;            // number of flows passed the filter
+    uint32_t files;             // number of flow files read from the cache
+    uint64_t firstseen;         // time window of the flow files
+    uint64_t lastseen;
+} statCacheSum_t;
 
 /* Function prototypes */
 void SetLimits(int stat, char *packet_limit_string, char *byte_limit_string);
@@ -53,10 +65,18 @@ int Init_StatTable(void);
 
 void Dispose_StatTable(void);
 
+void PrintStatTableMem(void);
+
 int SetStat(char *str, int *element_stat, int *flow_stat);
 
 void AddElementStat(master_record_t *flow_record);
 
+int SetStatCache(char *filter);
+
+int ReadStatCache(char *fileName, statCacheSum_t *cacheSum);
+
+void FlushStatCache(nffile_t *nffile, stat_record_t *stat_record, uint64_t processed, uint64_t passed);
+
 void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, RecordPrinter_t print_record);
 
 void ListPrintOrder(void);
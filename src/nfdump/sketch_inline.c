@@ -0,0 +1,229 @@
+/*
+ *  Copyright (c) 2009-2023, Peter Haag
+ *  Copyright (c) 2004-2008, SWITCH - Teleinformatikdienste fuer Lehre und Forschung
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Approximate element statistics - selected with a trailing '~' in the -s stat string.
+ * A Space-Saving summary with a fixed number of counters keeps the heavy hitters
+ * and a HyperLogLog estimates the number of distinct elements. Memory is fixed,
+ * regardless of the number of elements seen. The counters of an element are an
+ * upper bound of the real counters: an element, which replaces the smallest counter,
+ * inherits its values. Both sketches are mergeable and are stored in the element
+ * stat cache, if enabled.
+ */
+
+// number of Space-Saving counters
+#define SKETCH_SIZE 4096
+
+// number of HyperLogLog registers - 2^14 results in a std error of ~0.8%
+#define HLL_BITS 14
+#define HLL_REGISTERS (1 << HLL_BITS)
+
+KHASH_INIT(SketchHash, hashkey_t, uint32_t, 1, kh_key_hash_func, kh_key_hash_equal)
+
+typedef struct statSketch_s {
+    khash_t(SketchHash) * index;   // element key -> slot
+    StatRecord_t *slot;            // Space-Saving counters
+    uint32_t *heap;                // min heap of slots ordered by weight
+    uint32_t *heapPos;             // heap position of each slot
+    uint32_t numSlots;             // number of slots in use
+    order_proc_element_t weight;   // weight function of the Space-Saving summary
+    int inout;                     // IN, OUT or INOUT counters for weight
+    uint8_t hll[HLL_REGISTERS];    // HyperLogLog registers
+} statSketch_t;
+
+static statSketch_t *SketchNew(int order) {
+    statSketch_t *sketch = (statSketch_t *)nfcalloc(1, sizeof(statSketch_t));
+    sketch->index = kh_init(SketchHash);
+    sketch->slot = (StatRecord_t *)nfcalloc(SKETCH_SIZE, sizeof(StatRecord_t));
+    sketch->heap = (uint32_t *)nfcalloc(SKETCH_SIZE, sizeof(uint32_t));
+    sketch->heapPos = (uint32_t *)nfcalloc(SKETCH_SIZE, sizeof(uint32_t));
+    if (!sketch->index) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    kh_resize(SketchHash, sketch->index, 2 * SKETCH_SIZE);
+
+    // rates are not additive - weight the summary by the underlying counter
+    order_proc_element_t element_function = order_mode[order].element_function;
+    if (element_function == pps_element) {
+        sketch->weight = packets_element;
+    } else if (element_function == bps_element || element_function == bpp_element) {
+        sketch->weight = bytes_element;
+    } else if (element_function == null_element) {
+        sketch->weight = flows_element;
+    } else {
+        sketch->weight = element_function;
+    }
+    sketch->inout = order_mode[order].inout;
+
+    return sketch;
+
+}  // End of SketchNew
+
+static void SketchClear(statSketch_t *sketch) {
+    kh_clear(SketchHash, sketch->index);
+    sketch->numSlots = 0;
+    memset((void *)sketch->hll, 0, HLL_REGISTERS);
+
+}  // End of SketchClear
+
+static inline uint64_t SketchWeight(statSketch_t *sketch, uint32_t slot) {
+    return sketch->weight(&sketch->slot[slot], sketch->inout);
+}  // End of SketchWeight
+
+static inline void SketchSwap(statSketch_t *sketch, uint32_t i, uint32_t j) {
+    uint32_t tmp = sketch->heap[i];
+    sketch->heap[i] = sketch->heap[j];
+    sketch->heap[j] = tmp;
+    sketch->heapPos[sketch->heap[i]] = i;
+    sketch->heapPos[sketch->heap[j]] = j;
+}  // End of SketchSwap
+
+static inline void SketchSiftUp(statSketch_t *sketch, uint32_t pos) {
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) >> 1;
+        if (SketchWeight(sketch, sketch->heap[parent]) <= SketchWeight(sketch, sketch->heap[pos])) break;
+        SketchSwap(sketch, parent, pos);
+        pos = parent;
+    }
+}  // End of SketchSiftUp
+
+static inline void SketchSiftDown(statSketch_t *sketch, uint32_t pos) {
+    uint32_t numSlots = sketch->numSlots;
+    for (;;) {
+        uint32_t smallest = pos;
+        uint32_t left = 2 * pos + 1;
+        uint32_t right = left + 1;
+        if (left < numSlots && SketchWeight(sketch, sketch->heap[left]) < SketchWeight(sketch, sketch->heap[smallest])) smallest = left;
+        if (right < numSlots && SketchWeight(sketch, sketch->heap[right]) < SketchWeight(sketch, sketch->heap[smallest])) smallest = right;
+        if (smallest == pos) break;
+        SketchSwap(sketch, smallest, pos);
+        pos = smallest;
+    }
+}  // End of SketchSiftDown
+
+static inline void SketchAddCounters(StatRecord_t *r, StatRecord_t *statRecord) {
+    r->counter[FLOWS] += statRecord->counter[FLOWS];
+    r->counter[INPACKETS] += statRecord->counter[INPACKETS];
+    r->counter[INBYTES] += statRecord->counter[INBYTES];
+    r->counter[OUTPACKETS] += statRecord->counter[OUTPACKETS];
+    r->counter[OUTBYTES] += statRecord->counter[OUTBYTES];
+}  // End of SketchAddCounters
+
+// add element record to the Space-Saving summary
+static inline void SketchUpdate(statSketch_t *sketch, StatRecord_t *statRecord) {
+    khiter_t k = kh_get(SketchHash, sketch->index, statRecord->hashkey);
+    if (k != kh_end(sketch->index)) {
+        uint32_t slot = kh_value(sketch->index, k);
+        StatRecord_t *r = &sketch->slot[slot];
+        SketchAddCounters(r, statRecord);
+        if (statRecord->msecFirst < r->msecFirst) r->msecFirst = statRecord->msecFirst;
+        if (statRecord->msecLast > r->msecLast) r->msecLast = statRecord->msecLast;
+        SketchSiftDown(sketch, sketch->heapPos[slot]);
+        return;
+    }
+
+    int ret;
+    if (sketch->numSlots < SKETCH_SIZE) {
+        uint32_t slot = sketch->numSlots++;
+        sketch->slot[slot] = *statRecord;
+        sketch->heap[slot] = slot;
+        sketch->heapPos[slot] = slot;
+        k = kh_put(SketchHash, sketch->index, statRecord->hashkey, &ret);
+        kh_value(sketch->index, k) = slot;
+        SketchSiftUp(sketch, slot);
+        return;
+    }
+
+    // summary full - replace the element with the smallest weight
+    uint32_t slot = sketch->heap[0];
+    StatRecord_t *r = &sketch->slot[slot];
+    k = kh_get(SketchHash, sketch->index, r->hashkey);
+    kh_del(SketchHash, sketch->index, k);
+
+    SketchAddCounters(r, statRecord);
+    r->msecFirst = statRecord->msecFirst;
+    r->msecLast = statRecord->msecLast;
+    r->hashkey = statRecord->hashkey;
+    k = kh_put(SketchHash, sketch->index, statRecord->hashkey, &ret);
+    kh_value(sketch->index, k) = slot;
+    SketchSiftDown(sketch, 0);
+
+}  // End of SketchUpdate
+
+static inline uint64_t SketchHashKey(hashkey_t *hashkey) {
+    uint64_t h = hashkey->v1 ^ (hashkey->v0 * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)hashkey->proto << 56);
+    // splitmix64 finalizer
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}  // End of SketchHashKey
+
+// add a flow element to the sketch
+static inline void SketchAdd(statSketch_t *sketch, StatRecord_t *statRecord) {
+    uint64_t h = SketchHashKey(&statRecord->hashkey);
+    uint32_t index = h >> (64 - HLL_BITS);
+    uint8_t rank = __builtin_clzll((h << HLL_BITS) | (1ULL << (HLL_BITS - 1))) + 1;
+    if (rank > sketch->hll[index]) sketch->hll[index] = rank;
+
+    SketchUpdate(sketch, statRecord);
+
+}  // End of SketchAdd
+
+// merge sketch src into sketch dst
+static void SketchMerge(statSketch_t *dst, statSketch_t *src) {
+    for (uint32_t i = 0; i < src->numSlots; i++) SketchUpdate(dst, &src->slot[i]);
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        if (src->hll[i] > dst->hll[i]) dst->hll[i] = src->hll[i];
+    }
+
+}  // End of SketchMerge
+
+// estimated number of distinct elements
+static uint64_t SketchDistinct(statSketch_t *sketch) {
+    double m = HLL_REGISTERS;
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -sketch->hll[i]);
+        if (sketch->hll[i] == 0) zeros++;
+    }
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+
+    // small range correction
+    if (estimate <= 2.5 * m && zeros) estimate = m * log(m / zeros);
+
+    return (uint64_t)(estimate + 0.5);
+
+}  // End of SketchDistinct
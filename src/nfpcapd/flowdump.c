@@ -66,8 +66,51 @@ static int printRecord = 0;
     recordSize += (s);      \
     if (recordSize > availableSize) continue;
 
+// exporter and sampler of the early filter flow sampling
+#define EARLYSAMPLERID 1
+static exporter_t *sampleExporter = NULL;
+
 static int StorePcapFlow(flowParam_t *flowParam, struct FlowNode *Node);
 
+static int AddSampleExporter(flowParam_t *flowParam) {
+    FlowSource_t *fs = flowParam->fs;
+
+    exporter_t *e = calloc(1, sizeof(exporter_t));
+    sampler_t *sampler = calloc(1, sizeof(sampler_t));
+    if (!e || !sampler) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(e);
+        free(sampler);
+        return 0;
+    }
+
+    e->info.header.type = ExporterInfoRecordType;
+    e->info.header.size = sizeof(exporter_info_record_t);
+    e->info.version = 0x41;
+    e->info.id = 1;
+    e->info.sa_family = AF_INET;
+    FlushInfoExporter(fs, &(e->info));
+
+    sampler->record.type = SamplerRecordType;
+    sampler->record.size = sizeof(sampler_record_t);
+    sampler->record.exporter_sysid = e->info.sysid;
+    sampler->record.algorithm = 0;
+    sampler->record.id = EARLYSAMPLERID;
+    sampler->record.packetInterval = 1;
+    sampler->record.spaceInterval = flowParam->sampleRate - 1;
+    AppendToBuffer(fs->nffile, &(sampler->record), sampler->record.size);
+    e->sampler = sampler;
+
+    // the exporter is dumped again into each new file by FlushStdRecords()
+    e->next = fs->exporter_data;
+    fs->exporter_data = e;
+    sampleExporter = e;
+
+    LogInfo("Add early filter sampler - SysID: %u, sampling: 1:%u", e->info.sysid, flowParam->sampleRate);
+    return 1;
+
+}  // End of AddSampleExporter
+
 static int StorePcapFlow(flowParam_t *flowParam, struct FlowNode *Node) {
     FlowSource_t *fs = flowParam->fs;
 
@@ -142,20 +185,20 @@ static int StorePcapFlow(flowParam_t *flowParam, struct FlowNode *Node) {
                 macAddr->outSrcMac = 0;
             }
 
-            if (Node->mpls[0]) {
+            if (Node->ext && Node->ext->mpls[0]) {
                 UpdateRecordSize(EXmplsLabelSize);
                 PushExtension(recordHeader, EXmplsLabel, mplsLabel);
-                for (int i = 0; Node->mpls[i] != 0; i++) {
-                    mplsLabel->mplsLabel[i] = ntohl(Node->mpls[i]) >> 8;
+                for (int i = 0; i < 10 && Node->ext->mpls[i] != 0; i++) {
+                    mplsLabel->mplsLabel[i] = ntohl(Node->ext->mpls[i]) >> 8;
                 }
             }
 
-            if (Node->flowKey.proto == IPPROTO_TCP && Node->latency.application) {
+            if (Node->flowKey.proto == IPPROTO_TCP && Node->ext && Node->ext->latency.application) {
                 UpdateRecordSize(EXlatencySize);
                 PushExtension(recordHeader, EXlatency, latency);
-                latency->usecClientNwDelay = Node->latency.client;
-                latency->usecServerNwDelay = Node->latency.server;
-                latency->usecApplLatency = Node->latency.application;
+                latency->usecClientNwDelay = Node->ext->latency.client;
+                latency->usecServerNwDelay = Node->ext->latency.server;
+                latency->usecApplLatency = Node->ext->latency.application;
             }
 
             if (Node->pflog) {
@@ -198,20 +241,32 @@ static int StorePcapFlow(flowParam_t *flowParam, struct FlowNode *Node) {
             }
         }
 
-        if (Node->tun_ip_version == AF_INET) {
+        struct nodeExt_s *ext = Node->ext;
+        if (ext && ext->tun_ip_version == AF_INET) {
             UpdateRecordSize(EXtunIPv4Size);
             PushExtension(recordHeader, EXtunIPv4, tunIPv4);
-            tunIPv4->tunSrcAddr = Node->tun_src_addr.v4;
-            tunIPv4->tunDstAddr = Node->tun_dst_addr.v4;
-            tunIPv4->tunProto = Node->tun_proto;
-        } else if (Node->tun_ip_version == AF_INET6) {
+            tunIPv4->tunSrcAddr = ext->tun_src_addr.v4;
+            tunIPv4->tunDstAddr = ext->tun_dst_addr.v4;
+            tunIPv4->tunProto = ext->tun_proto;
+        } else if (ext && ext->tun_ip_version == AF_INET6) {
             UpdateRecordSize(EXtunIPv6Size);
             PushExtension(recordHeader, EXtunIPv6, tunIPv6);
-            tunIPv6->tunSrcAddr[0] = Node->tun_src_addr.v6[0];
-            tunIPv6->tunSrcAddr[1] = Node->tun_src_addr.v6[1];
-            tunIPv6->tunDstAddr[0] = Node->tun_dst_addr.v6[0];
-            tunIPv6->tunDstAddr[1] = Node->tun_dst_addr.v6[1];
-            tunIPv6->tunProto = Node->tun_proto;
+            tunIPv6->tunSrcAddr[0] = ext->tun_src_addr.v6[0];
+            tunIPv6->tunSrcAddr[1] = ext->tun_src_addr.v6[1];
+            tunIPv6->tunDstAddr[0] = ext->tun_dst_addr.v6[0];
+            tunIPv6->tunDstAddr[1] = ext->tun_dst_addr.v6[1];
+            tunIPv6->tunProto = ext->tun_proto;
+        }
+
+        if (Node->sampled && sampleExporter) {
+            UpdateRecordSize(EXsamplerInfoSize);
+            PushExtension(recordHeader, EXsamplerInfo, samplerInfo);
+            samplerInfo->selectorID = EARLYSAMPLERID;
+            samplerInfo->exporter_sysid = sampleExporter->info.sysid;
+            samplerInfo->align = 0;
+            recordHeader->exporterID = sampleExporter->info.sysid;
+            sampleExporter->flows++;
+            sampleExporter->packets += Node->packets;
         }
 
         // update first_seen, last_seen
@@ -373,13 +428,28 @@ __attribute__((noreturn)) void *flow_thread(void *thread_data) {
     }
     SetIdent(fs->nffile, fs->Ident);
 
+    if (flowParam->sampleRate > 1 && !AddSampleExporter(flowParam)) {
+        pthread_kill(flowParam->parent, SIGUSR1);
+        pthread_exit((void *)flowParam);
+    }
+
     // init vars
     fs->bad_packets = 0;
     fs->msecFirst = 0xffffffffffffLL;
     fs->msecLast = 0;
+
+    // with multiple packet threads, each thread sends a sync node per time slot
+    // the first one rotates the file
+    time_t lastSync = 0;
     while (1) {
         struct FlowNode *Node = Pop_Node(flowParam->NodeList);
         if (Node->signal == SIGNAL_SYNC) {
+            Flush_NodeBatch();
+            if (Node->timestamp <= lastSync) {
+                Free_Node(Node);
+                continue;
+            }
+            lastSync = Node->timestamp;
             CloseFlowFile(flowParam, Node->timestamp);
             fs->nffile = OpenNewFile(fs->current, fs->nffile, CREATOR_NFPCAPD, compress, NOT_ENCRYPTED);
             if (!fs->nffile) {
@@ -394,6 +464,7 @@ __attribute__((noreturn)) void *flow_thread(void *thread_data) {
 
         } else if (Node->signal == SIGNAL_DONE) {
             CloseFlowFile(flowParam, Node->timestamp);
+            Flush_NodeBatch();
             break;
         } else {
             StorePcapFlow(flowParam, Node);
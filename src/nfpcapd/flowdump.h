@@ -57,11 +57,14 @@ typedef struct flowParam_s {
 
     // send flows
     repeater_t *sendHost;
+    int stream;  // SEND_STREAM, SEND_STREAM_LZ4
 
     // options
     int printRecord;
     int extendedFlow;
     int addPayload;
+    uint32_t payloadLength;  // max payload length per flow
+    uint32_t sampleRate;     // early filter flow sampling
 } flowParam_t;
 
 __attribute__((noreturn)) void *flow_thread(void *thread_data);
@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,6 +44,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "bookkeeper.h"
@@ -50,6 +52,7 @@
 #include "config.h"
 #include "exporter.h"
 #include "flowdump.h"
+#include "lz4.h"
 #include "metric.h"
 #include "nfd_raw.h"
 #include "nfdump.h"
@@ -65,11 +68,22 @@ static int printRecord = 0;
 
 #define UpdateRecordSize(s) \
     recordSize += (s);      \
-    if (recordSize > availableSize) continue;
+    if (recordSize > availableSize) return 0;
+
+// flush a partial stream frame after at most this number of seconds
+#define FRAMEFLUSH 1
 
 static void *sendBuffer = NULL;
 static uint32_t sequence = 0;
 
+// TCP frame stream -o stream
+static void *lz4Buffer = NULL;
+static uint32_t frameLength = 0;
+static uint32_t frameRecords = 0;
+static time_t frameStart = 0;
+static time_t lastConnect = 0;
+static int localFamily = 0;
+
 static int ProcessFlow(flowParam_t *flowParam, struct FlowNode *Node);
 
 static int SendFlow(repeater_t *sendHost, nfd_header_t *pcapd_header) {
@@ -93,117 +107,138 @@ static int SendFlow(repeater_t *sendHost, nfd_header_t *pcapd_header) {
 
 }  // End of SendFlow
 
-static int ProcessFlow(flowParam_t *flowParam, struct FlowNode *Node) {
-    repeater_t *sendHost = flowParam->sendHost;
+/*
+ * Pack the flow node into a V3 record at buffPtr.
+ * Returns the record size or 0 if the record does not fit into availableSize.
+ */
+static uint32_t PackRecord(flowParam_t *flowParam, struct FlowNode *Node, void *buffPtr, size_t availableSize) {
+    uint32_t recordSize = 0;
 
-    dbg_printf("Send Flow node\n");
+    // map output record to memory buffer
+    UpdateRecordSize(V3HeaderRecordSize);
+    AddV3Header(buffPtr, recordHeader);
+
+    // header data
+    recordHeader->nfversion = 0x41;
+    recordHeader->engineType = 0x11;
+    recordHeader->engineID = 1;
+    recordHeader->exporterID = 0;
+
+    // pack V3 record
+    UpdateRecordSize(EXgenericFlowSize);
+    PushExtension(recordHeader, EXgenericFlow, genericFlow);
+    genericFlow->msecFirst = (1000 * Node->t_first.tv_sec) + Node->t_first.tv_usec / 1000;
+    genericFlow->msecLast = (1000 * Node->t_last.tv_sec) + Node->t_last.tv_usec / 1000;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    genericFlow->msecReceived = now.tv_sec * 1000L + now.tv_usec / 1000;
+
+    genericFlow->inPackets = Node->packets;
+    genericFlow->inBytes = Node->bytes;
+
+    genericFlow->tcpFlags = Node->flags;
+    genericFlow->proto = Node->flowKey.proto;
+    genericFlow->srcPort = Node->flowKey.src_port;
+    genericFlow->dstPort = Node->flowKey.dst_port;
+
+    if (Node->flowKey.version == AF_INET6) {
+        UpdateRecordSize(EXipv6FlowSize);
+        PushExtension(recordHeader, EXipv6Flow, ipv6Flow);
+        ipv6Flow->srcAddr[0] = Node->flowKey.src_addr.v6[0];
+        ipv6Flow->srcAddr[1] = Node->flowKey.src_addr.v6[1];
+        ipv6Flow->dstAddr[0] = Node->flowKey.dst_addr.v6[0];
+        ipv6Flow->dstAddr[1] = Node->flowKey.dst_addr.v6[1];
+    } else {
+        UpdateRecordSize(EXipv4FlowSize);
+        PushExtension(recordHeader, EXipv4Flow, ipv4Flow);
+        ipv4Flow->srcAddr = Node->flowKey.src_addr.v4;
+        ipv4Flow->dstAddr = Node->flowKey.dst_addr.v4;
+    }
 
-    nfd_header_t *pcapd_header = (nfd_header_t *)sendBuffer;
-    void *buffPtr = sendBuffer + pcapd_header->length;
-    uint32_t recordSize = 0;
-    do {
-        size_t availableSize = 65535 - pcapd_header->length;
-        if (recordSize > availableSize || availableSize < 150) {
-            if (SendFlow(sendHost, pcapd_header) < 0) return 0;
-            continue;
-        }
-        recordSize = 0;
-
-        // map output record to memory buffer
-        UpdateRecordSize(V3HeaderRecordSize);
-        AddV3Header(buffPtr, recordHeader);
-
-        // header data
-        recordHeader->nfversion = 0x41;
-        recordHeader->engineType = 0x11;
-        recordHeader->engineID = 1;
-        recordHeader->exporterID = 0;
-
-        // pack V3 record
-        UpdateRecordSize(EXgenericFlowSize);
-        PushExtension(recordHeader, EXgenericFlow, genericFlow);
-        genericFlow->msecFirst = (1000 * Node->t_first.tv_sec) + Node->t_first.tv_usec / 1000;
-        genericFlow->msecLast = (1000 * Node->t_last.tv_sec) + Node->t_last.tv_usec / 1000;
-
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        genericFlow->msecReceived = now.tv_sec * 1000L + now.tv_usec / 1000;
-
-        genericFlow->inPackets = Node->packets;
-        genericFlow->inBytes = Node->bytes;
-
-        genericFlow->tcpFlags = Node->flags;
-        genericFlow->proto = Node->flowKey.proto;
-        genericFlow->srcPort = Node->flowKey.src_port;
-        genericFlow->dstPort = Node->flowKey.dst_port;
-
-        if (Node->flowKey.version == AF_INET6) {
-            UpdateRecordSize(EXipv6FlowSize);
-            PushExtension(recordHeader, EXipv6Flow, ipv6Flow);
-            ipv6Flow->srcAddr[0] = Node->flowKey.src_addr.v6[0];
-            ipv6Flow->srcAddr[1] = Node->flowKey.src_addr.v6[1];
-            ipv6Flow->dstAddr[0] = Node->flowKey.dst_addr.v6[0];
-            ipv6Flow->dstAddr[1] = Node->flowKey.dst_addr.v6[1];
-        } else {
-            UpdateRecordSize(EXipv4FlowSize);
-            PushExtension(recordHeader, EXipv4Flow, ipv4Flow);
-            ipv4Flow->srcAddr = Node->flowKey.src_addr.v4;
-            ipv4Flow->dstAddr = Node->flowKey.dst_addr.v4;
+    if (flowParam->extendedFlow) {
+        if (Node->vlanID) {
+            UpdateRecordSize(EXvLanSize);
+            PushExtension(recordHeader, EXvLan, vlan);
+            vlan->dstVlan = Node->vlanID;
         }
 
-        if (flowParam->extendedFlow) {
-            if (Node->vlanID) {
-                UpdateRecordSize(EXvLanSize);
-                PushExtension(recordHeader, EXvLan, vlan);
-                vlan->dstVlan = Node->vlanID;
-            }
-
-            UpdateRecordSize(EXmacAddrSize);
-            PushExtension(recordHeader, EXmacAddr, macAddr);
-            macAddr->inSrcMac = ntohll(Node->srcMac) >> 16;
-            macAddr->outDstMac = ntohll(Node->dstMac) >> 16;
-            macAddr->inDstMac = 0;
-            macAddr->outSrcMac = 0;
-
-            if (Node->mpls[0]) {
-                UpdateRecordSize(EXmplsLabelSize);
-                PushExtension(recordHeader, EXmplsLabel, mplsLabel);
-                for (int i = 0; Node->mpls[i] != 0; i++) {
-                    mplsLabel->mplsLabel[i] = ntohl(Node->mpls[i]) >> 8;
-                }
+        UpdateRecordSize(EXmacAddrSize);
+        PushExtension(recordHeader, EXmacAddr, macAddr);
+        macAddr->inSrcMac = ntohll(Node->srcMac) >> 16;
+        macAddr->outDstMac = ntohll(Node->dstMac) >> 16;
+        macAddr->inDstMac = 0;
+        macAddr->outSrcMac = 0;
+
+        if (Node->ext && Node->ext->mpls[0]) {
+            UpdateRecordSize(EXmplsLabelSize);
+            PushExtension(recordHeader, EXmplsLabel, mplsLabel);
+            for (int i = 0; i < 10 && Node->ext->mpls[i] != 0; i++) {
+                mplsLabel->mplsLabel[i] = ntohl(Node->ext->mpls[i]) >> 8;
             }
+        }
 
-            if (Node->flowKey.proto == IPPROTO_TCP) {
-                UpdateRecordSize(EXlatencySize);
-                PushExtension(recordHeader, EXlatency, latency);
-                latency->usecClientNwDelay = Node->latency.client;
-                latency->usecServerNwDelay = Node->latency.server;
-                latency->usecApplLatency = Node->latency.application;
+        if (Node->flowKey.proto == IPPROTO_TCP) {
+            UpdateRecordSize(EXlatencySize);
+            PushExtension(recordHeader, EXlatency, latency);
+            if (Node->ext) {
+                latency->usecClientNwDelay = Node->ext->latency.client;
+                latency->usecServerNwDelay = Node->ext->latency.server;
+                latency->usecApplLatency = Node->ext->latency.application;
             }
         }
+    }
 
-        if (flowParam->addPayload) {
-            if (Node->payloadSize) {
-                UpdateRecordSize(EXinPayloadSize + Node->payloadSize);
-                PushVarLengthPointer(recordHeader, EXinPayload, inPayload, Node->payloadSize);
-                memcpy(inPayload, Node->payload, Node->payloadSize);
-            }
+    if (flowParam->addPayload) {
+        if (Node->payloadSize) {
+            UpdateRecordSize(EXinPayloadSize + Node->payloadSize);
+            PushVarLengthPointer(recordHeader, EXinPayload, inPayload, Node->payloadSize);
+            memcpy(inPayload, Node->payload, Node->payloadSize);
         }
+    }
 
-        if (printRecord) {
-            flow_record_short(stdout, recordHeader);
+    if (flowParam->stream) {
+        // reserve the exporter IP - the collector fills in the address it received the stream from
+        if (localFamily == AF_INET6) {
+            UpdateRecordSize(EXipReceivedV6Size);
+            PushExtension(recordHeader, EXipReceivedV6, ipReceivedV6);
+            ipReceivedV6->ip[0] = 0;
+            ipReceivedV6->ip[1] = 0;
+        } else {
+            UpdateRecordSize(EXipReceivedV4Size);
+            PushExtension(recordHeader, EXipReceivedV4, ipReceivedV4);
+            ipReceivedV4->ip = 0;
         }
+    }
+
+    if (printRecord) {
+        flow_record_short(stdout, recordHeader);
+    }
 
-        // update file record size ( -> output buffer size )
-        pcapd_header->numRecord++;
-        pcapd_header->length += recordHeader->size;
+    dbg_printf("Record size: %u, header size: %u\n", recordSize, recordHeader->size);
+
+    assert(recordHeader->size == recordSize);
+    return recordSize;
+
+}  // End of PackRecord
+
+static int ProcessFlow(flowParam_t *flowParam, struct FlowNode *Node) {
+    repeater_t *sendHost = flowParam->sendHost;
 
-        dbg_printf("Record size: %u, header size: %u\n", recordSize, recordHeader->size);
+    dbg_printf("Send Flow node\n");
 
-        assert(recordHeader->size == recordSize);
-        break;
+    nfd_header_t *pcapd_header = (nfd_header_t *)sendBuffer;
+    uint32_t recordSize = PackRecord(flowParam, Node, sendBuffer + pcapd_header->length, 65535 - pcapd_header->length);
+    if (recordSize == 0) {
+        // datagram full
+        if (SendFlow(sendHost, pcapd_header) < 0) return 0;
+        recordSize = PackRecord(flowParam, Node, sendBuffer + pcapd_header->length, 65535 - pcapd_header->length);
+        if (recordSize == 0) return 0;
+    }
 
-    } while (1);
+    // update file record size ( -> output buffer size )
+    pcapd_header->numRecord++;
+    pcapd_header->length += recordSize;
 
     if (pcapd_header->length > 1200) {
         // send buffer - prevent fragmentation for next packet
@@ -212,11 +247,128 @@ static int ProcessFlow(flowParam_t *flowParam, struct FlowNode *Node) {
 
     return 1;
 
-} /* End of StorePcapFlow */
+} /* End of ProcessFlow */
+
+// address family of the stream socket - selects the reserved EXipReceived extension
+static void StreamFamily(int sockfd) {
+    struct sockaddr_storage addr;
+    socklen_t addrLen = sizeof(addr);
+    if (getsockname(sockfd, (struct sockaddr *)&addr, &addrLen) < 0) return;
+
+    localFamily = addr.ss_family == AF_INET6 ? AF_INET6 : AF_INET;
+
+}  // End of StreamFamily
+
+static int ConnectStream(repeater_t *sendHost) {
+    // reconnect at most once a second
+    time_t now = time(NULL);
+    if (now == lastConnect) return 0;
+    lastConnect = now;
+
+    sendHost->sockfd = Stream_send_socket(sendHost->hostname, sendHost->port, AF_UNSPEC);
+    if (sendHost->sockfd < 0) return 0;
+
+    StreamFamily(sendHost->sockfd);
+    LogInfo("Flow stream connected to %s port %s", sendHost->hostname, sendHost->port);
+    return 1;
+
+}  // End of ConnectStream
+
+static int SendAll(int sockfd, void *buff, size_t len) {
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+    while (len) {
+        ssize_t ret = send(sockfd, buff, len, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buff += ret;
+        len -= ret;
+    }
+    return 1;
+
+}  // End of SendAll
+
+/*
+ * Send the current frame. A slow collector blocks the send, which holds back the
+ * sender thread. A failed frame is dropped and the stream gets reconnected.
+ */
+static int SendFrame(repeater_t *sendHost) {
+    if (frameRecords == 0) return 1;
+
+    nfd_frame_t *frame = (nfd_frame_t *)sendBuffer;
+    uint32_t length = frameLength;
+    uint16_t flags = 0;
+    if (lz4Buffer) {
+        int len = LZ4_compress_default(sendBuffer + sizeof(nfd_frame_t), lz4Buffer + sizeof(nfd_frame_t), frameLength, LZ4_COMPRESSBOUND(NFD_FRAMESIZE));
+        if (len > 0 && len < frameLength) {
+            frame = (nfd_frame_t *)lz4Buffer;
+            length = len;
+            flags = NFD_FRAME_LZ4;
+        }
+    }
+
+    frame->version = htons(NFD_STREAM);
+    frame->flags = htons(flags);
+    frame->length = htonl(length);
+    frame->rawLength = htonl(frameLength);
+    frame->numRecord = htonl(frameRecords);
+    frame->sequence = htonl(sequence++);
+    frame->exportTime = htonl(time(NULL));
+    dbg_printf("Sending frame: %u records, %u bytes\n", frameRecords, length);
+
+    frameLength = 0;
+    frameRecords = 0;
+
+    if (sendHost->sockfd < 0 && !ConnectStream(sendHost)) {
+        LogError("Flow stream not connected - drop frame");
+        return 0;
+    }
+
+    if (!SendAll(sendHost->sockfd, frame, sizeof(nfd_frame_t) + length)) {
+        LogError("ERROR: send() failed: %s", strerror(errno));
+        close(sendHost->sockfd);
+        sendHost->sockfd = -1;
+        return 0;
+    }
+
+    return 1;
+
+}  // End of SendFrame
+
+static int StreamFlow(flowParam_t *flowParam, struct FlowNode *Node) {
+    repeater_t *sendHost = flowParam->sendHost;
+
+    void *buffPtr = sendBuffer + sizeof(nfd_frame_t);
+    uint32_t recordSize = PackRecord(flowParam, Node, buffPtr + frameLength, NFD_FRAMESIZE - frameLength);
+    if (recordSize == 0) {
+        // frame full
+        SendFrame(sendHost);
+        recordSize = PackRecord(flowParam, Node, buffPtr, NFD_FRAMESIZE);
+        if (recordSize == 0) return 0;
+    }
+
+    time_t now = time(NULL);
+    if (frameRecords == 0) frameStart = now;
+    frameLength += recordSize;
+    frameRecords++;
+
+    if ((now - frameStart) >= FRAMEFLUSH) return SendFrame(sendHost);
+
+    return 1;
+
+}  // End of StreamFlow
 
 static inline int CloseSender(flowParam_t *flowParam, time_t timestamp) {
     repeater_t *sendHost = flowParam->sendHost;
 
+    if (flowParam->stream) {
+        SendFrame(sendHost);
+        if (sendHost->sockfd < 0) return 0;
+    }
+
     return close(sendHost->sockfd);
 
 }  // end of CloseFlowFile
@@ -225,21 +377,42 @@ __attribute__((noreturn)) void *sendflow_thread(void *thread_data) {
     // argument dispatching
     flowParam_t *flowParam = (flowParam_t *)thread_data;
 
-    sendBuffer = malloc(65535);
-    nfd_header_t *pcapd_header = (nfd_header_t *)sendBuffer;
-    memset((void *)pcapd_header, 0, sizeof(nfd_header_t));
-    pcapd_header->version = htons(NFD_PROTOCOL);
-    pcapd_header->length = sizeof(nfd_header_t);
-    pcapd_header->lastSequence = 1;
+    if (flowParam->stream) {
+        sendBuffer = malloc(sizeof(nfd_frame_t) + NFD_FRAMESIZE);
+        if (flowParam->stream == SEND_STREAM_LZ4) lz4Buffer = malloc(sizeof(nfd_frame_t) + LZ4_COMPRESSBOUND(NFD_FRAMESIZE));
+        if (!sendBuffer || (flowParam->stream == SEND_STREAM_LZ4 && !lz4Buffer)) {
+            LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            pthread_kill(flowParam->parent, SIGUSR1);
+            pthread_exit((void *)flowParam);
+        }
+        StreamFamily(flowParam->sendHost->sockfd);
+    } else {
+        sendBuffer = malloc(65535);
+        nfd_header_t *pcapd_header = (nfd_header_t *)sendBuffer;
+        memset((void *)pcapd_header, 0, sizeof(nfd_header_t));
+        pcapd_header->version = htons(NFD_PROTOCOL);
+        pcapd_header->length = sizeof(nfd_header_t);
+        pcapd_header->lastSequence = 1;
+    }
 
     printRecord = flowParam->printRecord;
     while (1) {
-        struct FlowNode *Node = Pop_Node(flowParam->NodeList);
+        // a partial stream frame is flushed, if no flow arrives within FRAMEFLUSH seconds
+        struct FlowNode *Node = frameRecords ? Pop_NodeTimeout(flowParam->NodeList, FRAMEFLUSH) : Pop_Node(flowParam->NodeList);
+        if (Node == NULL) {
+            SendFrame(flowParam->sendHost);
+            continue;
+        }
         if (Node->signal == SIGNAL_SYNC) {
-            // skip
+            // flush the frame at each rotation cycle
+            if (flowParam->stream) SendFrame(flowParam->sendHost);
+            Flush_NodeBatch();
         } else if (Node->signal == SIGNAL_DONE) {
             CloseSender(flowParam, Node->timestamp);
+            Flush_NodeBatch();
             break;
+        } else if (flowParam->stream) {
+            StreamFlow(flowParam, Node);
         } else {
             ProcessFlow(flowParam, Node);
         }
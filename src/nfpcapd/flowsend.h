@@ -31,6 +31,10 @@
 #ifndef _FLOWSEND_H
 #define _FLOWSEND_H 1
 
+// flowParam stream: send flows as TCP frame stream -o stream, -o lz4
+#define SEND_STREAM 1
+#define SEND_STREAM_LZ4 2
+
 __attribute__((noreturn)) void *sendflow_thread(void *thread_data);
 
 #endif
@@ -33,6 +33,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -41,45 +42,75 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
+#include "khash.h"
 #include "nfdump.h"
 #include "nffile.h"
 #include "util.h"
 
 static int ExtendCache(void);
 
-static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2);
+static void Free_Payload(void *slot);
 
 static void DumpTreeStat(NodeList_t *NodeList);
 
-// Insert the IP RB tree code here
-RB_GENERATE(FlowTree, FlowNode, entry, FlowNodeCMP);
+/*
+ * The flow table is an open addressing hash, which indexes the flow keys of the nodes.
+ * The key is a pointer to the flowKey of the node, so the node is found from the key.
+ */
+static kh_inline khint_t FlowKeyHash(struct flowKey_s *key) {
+    const uint64_t *k = (const uint64_t *)key;
+    uint64_t h = k[0] ^ (k[1] * 0x9E3779B97F4A7C15ULL);
+    h ^= k[2] ^ (k[3] * 0xC2B2AE3D27D4EB4FULL);
+    h ^= k[4] * 0x165667B19E3779F9ULL;
+    return kh_int64_hash_func(h);
+}
+
+#define FlowKeyEqual(k1, k2) (memcmp((void *)(k1), (void *)(k2), sizeof(struct flowKey_s)) == 0)
+KHASH_INIT(FlowHash, struct flowKey_s *, char, 0, FlowKeyHash, FlowKeyEqual)
+
+#define KeyNode(key) ((struct FlowNode *)((char *)(key)-offsetof(struct FlowNode, flowKey)))
 
 // Flow Cache to store all nodes
-#define EXPIREINTERVALL 10
 #define DefaultCacheSize (512 * 1024)
 #define ExtentSize 4096
 #define MaxSize (1024 * 1024 * 512)
 static uint32_t FlowCacheSize = 0;
-static time_t lastExpire = 0;
+static __thread time_t lastExpire = 0;
 static uint32_t expireActiveTimeout = 300;
 static uint32_t expireInactiveTimeout = 60;
 static struct FlowNode *FlowElementCache = NULL;
 
-// free list
+// free list - protected by m_FreeList
 static struct FlowNode *FlowNode_FreeList = NULL;
 static pthread_mutex_t m_FreeList = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t c_FreeList = PTHREAD_COND_INITIALIZER;
-static uint32_t EmptyFreeList = 0;
+static _Atomic uint32_t EmptyFreeList = 0;
 static uint32_t EmptyFreeListEvents = 0;
-static uint32_t Allocated = 0;
+static _Atomic int32_t Allocated = 0;
 
-// Flow tree
-static FlowTree_t *FlowTree = NULL;
-static int NumFlows = 0;
-static flowTreeStat_t flowTreeStat = {0};
+/*
+ * Nodes are allocated by the packet threads and freed by the flow thread. Each thread
+ * allocates from its own node cache and collects the freed nodes in a local batch.
+ * Full batches are pushed onto the lock-free ReturnStack, which is taken as a whole
+ * by the next thread running out of nodes. m_FreeList is only locked to cut a new
+ * batch from the free list. Allocated is updated once per batch.
+ */
+#define NodeBatchSize 64
+static _Atomic(struct FlowNode *) ReturnStack = NULL;
+static __thread struct FlowNode *nodeCache = NULL;
+static __thread struct FlowNode *returnBatch = NULL;
+static __thread struct FlowNode *returnTail = NULL;
+static __thread uint32_t returnCount = 0;
+static __thread int32_t allocDelta = 0;
+
+// Flow table - each packet thread builds its flows in its own table
+static __thread khash_t(FlowHash) *FlowTable = NULL;
+static __thread int NumFlows = 0;
+static __thread flowTreeStat_t flowTreeStat = {0};
 
 // Simple unprotected list
 typedef struct FlowNode_list_s {
@@ -88,33 +119,138 @@ typedef struct FlowNode_list_s {
     uint32_t size;
 } Linked_list_t;
 
+/*
+ * Timer lists of the flow table. The expiry takes the expired nodes from the head
+ * of the lists and stops at the first node, which is not expired.
+ * lruList:  flow nodes ordered by their last packet - inactive timeout
+ * ageList:  flow nodes ordered by their first packet - active timeout
+ * fragList: fragment nodes ordered by their last fragment - see fragment table
+ */
+static __thread Linked_list_t lruList = {0};
+static __thread Linked_list_t ageList = {0};
+static __thread Linked_list_t fragList = {0};
+
+static inline void LinkLRU(Linked_list_t *list, struct FlowNode *node) {
+    node->lruNext = NULL;
+    node->lruPrev = list->tail;
+    if (list->tail)
+        list->tail->lruNext = node;
+    else
+        list->list = node;
+    list->tail = node;
+    list->size++;
+}  // End of LinkLRU
+
+static inline void UnlinkLRU(Linked_list_t *list, struct FlowNode *node) {
+    if (node->lruPrev)
+        node->lruPrev->lruNext = node->lruNext;
+    else
+        list->list = node->lruNext;
+    if (node->lruNext)
+        node->lruNext->lruPrev = node->lruPrev;
+    else
+        list->tail = node->lruPrev;
+    node->lruPrev = node->lruNext = NULL;
+    list->size--;
+}  // End of UnlinkLRU
+
+static inline void LinkAge(Linked_list_t *list, struct FlowNode *node) {
+    node->ageNext = NULL;
+    node->agePrev = list->tail;
+    if (list->tail)
+        list->tail->ageNext = node;
+    else
+        list->list = node;
+    list->tail = node;
+    list->size++;
+}  // End of LinkAge
+
+static inline void UnlinkAge(Linked_list_t *list, struct FlowNode *node) {
+    if (node->agePrev)
+        node->agePrev->ageNext = node->ageNext;
+    else
+        list->list = node->ageNext;
+    if (node->ageNext)
+        node->ageNext->agePrev = node->agePrev;
+    else
+        list->tail = node->agePrev;
+    node->agePrev = node->ageNext = NULL;
+    list->size--;
+}  // End of UnlinkAge
+
 /* Free list handling functions */
-// Get next free node from free list
-struct FlowNode *New_Node(void) {
-    struct FlowNode *node;
+// Get a batch of free nodes - either returned nodes or from the free list
+static struct FlowNode *GetNodeBatch(void) {
+    struct FlowNode *list = atomic_exchange(&ReturnStack, NULL);
+    if (list) return list;
 
     pthread_mutex_lock(&m_FreeList);
     while (FlowNode_FreeList == NULL) {
-        EmptyFreeList = 1;
         EmptyFreeListEvents++;
         if (FlowCacheSize < MaxSize) {
             dbg_printf("Auto expand flow cache\n");
             if (!ExtendCache()) abort();
         } else {
+            // announce the wait before checking the returned nodes a last time
+            atomic_store(&EmptyFreeList, 1);
+            list = atomic_exchange(&ReturnStack, NULL);
+            if (list) {
+                pthread_mutex_unlock(&m_FreeList);
+                return list;
+            }
             LogError("Max cache size reached");
             pthread_cond_wait(&c_FreeList, &m_FreeList);
         }
     }
 
-    node = FlowNode_FreeList;
+    list = FlowNode_FreeList;
+    struct FlowNode *node = list;
+    for (int i = 1; i < NodeBatchSize && node->right; i++) node = node->right;
+    FlowNode_FreeList = node->right;
+    node->right = NULL;
+    pthread_mutex_unlock(&m_FreeList);
+
+    return list;
+
+}  // End of GetNodeBatch
+
+// push the local batch of freed nodes onto the return stack
+static void ReturnNodeBatch(void) {
+    struct FlowNode *head = atomic_load(&ReturnStack);
+    do {
+        returnTail->right = head;
+    } while (!atomic_compare_exchange_weak(&ReturnStack, &head, returnBatch));
+
+    returnBatch = NULL;
+    returnTail = NULL;
+    returnCount = 0;
+    atomic_fetch_add_explicit(&Allocated, allocDelta, memory_order_relaxed);
+    allocDelta = 0;
+
+    if (atomic_load(&EmptyFreeList)) {
+        pthread_mutex_lock(&m_FreeList);
+        EmptyFreeList = 0;
+        pthread_cond_signal(&c_FreeList);
+        pthread_mutex_unlock(&m_FreeList);
+    }
+
+}  // End of ReturnNodeBatch
+
+// Get next free node from the node cache
+struct FlowNode *New_Node(void) {
+    if (nodeCache == NULL) {
+        nodeCache = GetNodeBatch();
+        atomic_fetch_add_explicit(&Allocated, allocDelta, memory_order_relaxed);
+        allocDelta = 0;
+    }
+
+    struct FlowNode *node = nodeCache;
     if (node->memflag != NODE_FREE) {
         LogError("New_Node() unexpected error in %s line %d: %s\n", __FILE__, __LINE__, "Tried to allocate a non free Node");
         abort();
     }
-
-    FlowNode_FreeList = node->right;
-    Allocated++;
-    pthread_mutex_unlock(&m_FreeList);
+    nodeCache = node->right;
+    allocDelta++;
 
     node->left = NULL;
     node->right = NULL;
@@ -124,7 +260,7 @@ struct FlowNode *New_Node(void) {
 
 }  // End of New_Node
 
-// return node into free list
+// return node into the local return batch
 void Free_Node(struct FlowNode *node) {
     if (node->memflag == NODE_FREE) {
         LogError("Free_Node() Fatal: Tried to free an already freed Node");
@@ -136,28 +272,43 @@ void Free_Node(struct FlowNode *node) {
         abort();
     }
 
-    if (node->payload) free(node->payload);
+    if (node->payload) {
+        // fragment nodes hold a reassembly buffer
+        if (node->nodeType == FRAG_NODE)
+            free(node->payload);
+        else
+            Free_Payload(node->payload);
+    }
     if (node->pflog) free(node->pflog);
+    if (node->ext) free(node->ext);
 
     dbg_assert(node->left == NULL);
     dbg_assert(node->right == NULL);
 
     memset((void *)node, 0, sizeof(struct FlowNode));
 
-    pthread_mutex_lock(&m_FreeList);
-    node->right = FlowNode_FreeList;
-    node->left = NULL;
     node->memflag = NODE_FREE;
-    FlowNode_FreeList = node;
-    Allocated--;
-    if (EmptyFreeList) {
-        EmptyFreeList = 0;
-        pthread_cond_signal(&c_FreeList);
-    }
-    pthread_mutex_unlock(&m_FreeList);
+    node->right = returnBatch;
+    if (returnBatch == NULL) returnTail = node;
+    returnBatch = node;
+    allocDelta--;
+    if (++returnCount == NodeBatchSize) ReturnNodeBatch();
 
 }  // End of Free_Node
 
+// get the extension data of a node - allocated on first use
+struct nodeExt_s *NodeExt(struct FlowNode *node) {
+    if (node->ext == NULL) {
+        node->ext = calloc(1, sizeof(struct nodeExt_s));
+        if (!node->ext) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            abort();
+        }
+    }
+    return node->ext;
+
+}  // End of NodeExt
+
 static int ExtendCache(void) {
     struct FlowNode *extent = calloc(ExtentSize, sizeof(struct FlowNode));
     if (!extent) {
@@ -187,6 +338,276 @@ static int ExtendCache(void) {
 
 }  // End of ExtendCache
 
+/*
+ * Payload pool
+ * The payload of a flow is copied into a fixed size slot of the payload pool. Slots are
+ * allocated and returned in batches like the nodes - each thread allocates from its own
+ * slot cache and pushes its freed slots onto the lock-free PayloadStack. The pool grows
+ * in extents up to PayloadMemoryLimit. If no slot is left, the payload is dropped.
+ * A free slot holds the pointer to the next free slot.
+ */
+#define PayloadMemoryLimit (64 * 1024 * 1024)
+#define PayloadExtentSize (1024 * 1024)
+#define PayloadBatchSize 64
+#define NextSlot(slot) (*(void **)(slot))
+static uint32_t PayloadLength = DefaultPayloadLength;
+static uint32_t PayloadSlotSize = (DefaultPayloadLength + 7) & ~7;
+
+// free list - protected by m_PayloadList
+static void *PayloadFreeList = NULL;
+static size_t PayloadMemory = 0;
+static pthread_mutex_t m_PayloadList = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic(void *) PayloadStack = NULL;
+static _Atomic int32_t PayloadInUse = 0;
+static _Atomic uint32_t PayloadDropped = 0;
+static __thread void *payloadCache = NULL;
+static __thread void *payloadReturn = NULL;
+static __thread void *payloadReturnTail = NULL;
+static __thread uint32_t payloadReturnCount = 0;
+static __thread int32_t payloadDelta = 0;
+
+int Init_PayloadPool(uint32_t maxLength) {
+    if (maxLength == 0 || maxLength > 65535) {
+        LogError("Payload length %u out of range", maxLength);
+        return 0;
+    }
+
+    PayloadLength = maxLength;
+    PayloadSlotSize = (maxLength + 7) & ~7;
+    LogVerbose("Payload pool: max payload length: %u, memory limit: %u", PayloadLength, PayloadMemoryLimit);
+
+    return 1;
+
+}  // End of Init_PayloadPool
+
+// Get a batch of free slots - either returned slots or from the free list
+static void *GetPayloadBatch(void) {
+    void *list = atomic_exchange(&PayloadStack, NULL);
+    if (list) return list;
+
+    pthread_mutex_lock(&m_PayloadList);
+    if (PayloadFreeList == NULL && (PayloadMemory + PayloadExtentSize) <= PayloadMemoryLimit) {
+        void *extent = malloc(PayloadExtentSize);
+        if (extent) {
+            uint32_t numSlots = PayloadExtentSize / PayloadSlotSize;
+            for (uint32_t i = 0; i < numSlots; i++) {
+                void *slot = extent + i * PayloadSlotSize;
+                NextSlot(slot) = PayloadFreeList;
+                PayloadFreeList = slot;
+            }
+            PayloadMemory += PayloadExtentSize;
+        } else {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        }
+    }
+
+    list = PayloadFreeList;
+    if (list) {
+        void *slot = list;
+        for (int i = 1; i < PayloadBatchSize && NextSlot(slot); i++) slot = NextSlot(slot);
+        PayloadFreeList = NextSlot(slot);
+        NextSlot(slot) = NULL;
+    }
+    pthread_mutex_unlock(&m_PayloadList);
+
+    return list;
+
+}  // End of GetPayloadBatch
+
+// push the local batch of freed slots onto the payload stack
+static void ReturnPayloadBatch(void) {
+    void *head = atomic_load(&PayloadStack);
+    do {
+        NextSlot(payloadReturnTail) = head;
+    } while (!atomic_compare_exchange_weak(&PayloadStack, &head, payloadReturn));
+
+    payloadReturn = NULL;
+    payloadReturnTail = NULL;
+    payloadReturnCount = 0;
+    atomic_fetch_add_explicit(&PayloadInUse, payloadDelta, memory_order_relaxed);
+    payloadDelta = 0;
+
+}  // End of ReturnPayloadBatch
+
+static void Free_Payload(void *slot) {
+    NextSlot(slot) = payloadReturn;
+    if (payloadReturn == NULL) payloadReturnTail = slot;
+    payloadReturn = slot;
+    payloadDelta--;
+    if (++payloadReturnCount == PayloadBatchSize) ReturnPayloadBatch();
+
+}  // End of Free_Payload
+
+// copy the payload into a slot of the payload pool - returns 0, if the payload is dropped
+int Add_NodePayload(struct FlowNode *node, void *data, uint32_t length) {
+    if (payloadCache == NULL) {
+        payloadCache = GetPayloadBatch();
+        atomic_fetch_add_explicit(&PayloadInUse, payloadDelta, memory_order_relaxed);
+        payloadDelta = 0;
+        if (payloadCache == NULL) {
+            atomic_fetch_add_explicit(&PayloadDropped, 1, memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    void *slot = payloadCache;
+    payloadCache = NextSlot(slot);
+    payloadDelta++;
+
+    if (length > PayloadLength) length = PayloadLength;
+    memcpy(slot, data, length);
+    node->payload = slot;
+    node->payloadSize = length;
+
+    return 1;
+
+}  // End of Add_NodePayload
+
+// return the partially filled node and payload batches of this thread
+void Flush_NodeBatch(void) {
+    if (returnBatch) ReturnNodeBatch();
+    if (payloadReturn) ReturnPayloadBatch();
+
+}  // End of Flush_NodeBatch
+
+/*
+ * IPv4 fragment table
+ * Each packet thread reassembles its fragments in its own table, separate from the
+ * flow table, so fragment floods do not fill the flow table. The table is bounded by
+ * MaxFragNodes and FragMemoryLimit. The fragList is kept in LRU order - the least
+ * recently used node is evicted first, if a limit is reached. During reassembly
+ * payloadSize is the allocated size of the payload buffer.
+ */
+#define MaxFragNodes 4096
+#define FragMemoryLimit (32 * 1024 * 1024)
+#define FragTimeout 15
+#define FragChunkSize 2048
+static __thread khash_t(FlowHash) *FragTable = NULL;
+static __thread size_t fragMemory = 0;
+static __thread fragStat_t fragStat = {0};
+
+struct FlowNode *Lookup_FragNode(struct FlowNode *node) {
+    if (!FragTable) return NULL;
+
+    khiter_t k = kh_get(FlowHash, FragTable, &node->flowKey);
+    return k == kh_end(FragTable) ? NULL : KeyNode(kh_key(FragTable, k));
+
+}  // End of Lookup_FragNode
+
+void Remove_FragNode(struct FlowNode *node) {
+    khiter_t k = kh_get(FlowHash, FragTable, &node->flowKey);
+    if (k == kh_end(FragTable)) {
+        LogError("Remove_FragNode() node not in fragment table");
+        return;
+    }
+    kh_del(FlowHash, FragTable, k);
+    UnlinkAge(&fragList, node);
+
+    fragMemory -= node->payloadSize;
+    flowTreeStat.fragNodes--;
+
+}  // End of Remove_FragNode
+
+// remove the least recently used fragment node
+static void EvictFragNode(void) {
+    struct FlowNode *node = fragList.list;
+    Remove_FragNode(node);
+    Free_Node(node);
+    fragStat.evicted++;
+
+}  // End of EvictFragNode
+
+static uint32_t Expire_FragTable(time_t when) {
+    uint32_t fragCnt = 0;
+    while (fragList.list && ((when - fragList.list->t_last.tv_sec) > FragTimeout || when == 0)) {
+        struct FlowNode *node = fragList.list;
+        Remove_FragNode(node);
+        Free_Node(node);
+        fragCnt++;
+    }
+    fragStat.timedOut += fragCnt;
+
+    return fragCnt;
+
+}  // End of Expire_FragTable
+
+struct FlowNode *Insert_FragNode(struct FlowNode *node) {
+    if (!FragTable) {
+        FragTable = kh_init(FlowHash);
+        if (!FragTable) {
+            LogError("kh_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            abort();
+        }
+    }
+
+    Expire_FragTable(node->t_last.tv_sec);
+    while (flowTreeStat.fragNodes >= MaxFragNodes) EvictFragNode();
+
+    int ret;
+    khiter_t k = kh_put(FlowHash, FragTable, &node->flowKey, &ret);
+    if (ret < 0) {
+        LogError("kh_put() error in %s line %d", __FILE__, __LINE__);
+        abort();
+    }
+    if (ret == 0) return KeyNode(kh_key(FragTable, k));
+
+    node->payloadSize = 0;
+    LinkAge(&fragList, node);
+    flowTreeStat.fragNodes++;
+    fragStat.inserted++;
+
+    return NULL;
+
+}  // End of Insert_FragNode
+
+// copy fragment data into the reassembly buffer - returns 0, if the fragment is dropped
+int Add_FragData(struct FlowNode *node, uint32_t offset, void *data, uint32_t length) {
+    // most recently used
+    UnlinkAge(&fragList, node);
+    LinkAge(&fragList, node);
+
+    uint32_t end = offset + length;
+    if (end > 65536) {
+        fragStat.dropped++;
+        return 0;
+    }
+
+    if (end > node->payloadSize) {
+        uint32_t size = (end + FragChunkSize - 1) & ~(FragChunkSize - 1);
+        if (size > 65536) size = 65536;
+        size_t grow = size - node->payloadSize;
+        while ((fragMemory + grow) > FragMemoryLimit && fragList.list != node) EvictFragNode();
+        if ((fragMemory + grow) > FragMemoryLimit) {
+            fragStat.dropped++;
+            return 0;
+        }
+
+        void *payload = realloc(node->payload, size);
+        if (!payload) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            fragStat.dropped++;
+            return 0;
+        }
+        memset(payload + node->payloadSize, 0, grow);
+        node->payload = payload;
+        node->payloadSize = size;
+        fragMemory += grow;
+    }
+    memcpy(node->payload + offset, data, length);
+
+    return 1;
+
+}  // End of Add_FragData
+
+// remove the reassembled packet from the fragment table
+void Complete_FragNode(struct FlowNode *node, uint32_t size) {
+    Remove_FragNode(node);
+    node->payloadSize = size;
+    fragStat.completed++;
+
+}  // End of Complete_FragNode
+
 /* flow tree functions */
 int Init_FlowTree(uint32_t CacheSize, int32_t expireActive, int32_t expireInactive) {
     if (expireActive) {
@@ -207,13 +628,6 @@ int Init_FlowTree(uint32_t CacheSize, int32_t expireActive, int32_t expireInacti
         LogInfo("Set inactive flow expire timeout to %us", expireInactiveTimeout);
     }
 
-    FlowTree = malloc(sizeof(FlowTree_t));
-    if (!FlowTree) {
-        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return 0;
-    }
-    RB_INIT(FlowTree);
-
     if (CacheSize == 0) CacheSize = DefaultCacheSize;
 
     while (FlowCacheSize < CacheSize)
@@ -230,14 +644,22 @@ void Dispose_FlowTree(void) {
     struct FlowNode *node, *nxt;
 
     // Dump all incomplete flows to the file
-    nxt = NULL;
-    for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-        nxt = RB_NEXT(FlowTree, FlowTree, node);
+    for (node = ageList.list; node != NULL; node = nxt) {
+        nxt = node->ageNext;
         Remove_Node(node);
     }
+    for (node = fragList.list; node != NULL; node = nxt) {
+        nxt = node->ageNext;
+        Remove_FragNode(node);
+    }
+    if (FlowTable) kh_destroy(FlowHash, FlowTable);
+    FlowTable = NULL;
+    if (FragTable) kh_destroy(FlowHash, FragTable);
+    FragTable = NULL;
     free(FlowElementCache);
     FlowElementCache = NULL;
     FlowNode_FreeList = NULL;
+    ReturnStack = NULL;
     EmptyFreeList = 0;
 
 }  // End of Dispose_FlowTree
@@ -254,36 +676,58 @@ void CacheCheck(NodeList_t *NodeList, time_t when) {
         uint32_t num __attribute__((unused)) = Expire_FlowTree(NodeList, when);
         dbg_printf("  Expire cache: %u\n", num);
         lastExpire = when;
+        // hand over the flows of a partial batch
+        Publish_NodeBatch(NodeList);
     }
 
 }  // End of CacheCheck
 
-static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2) {
-    int i = memcmp((void *)&e1->flowKey, (void *)&e2->flowKey, sizeof(e1->flowKey));
-    return i;
-}  // End of FlowNodeCMP
+struct FlowNode *Lookup_Node(struct FlowNode *node) {
+    if (!FlowTable) return NULL;
 
-struct FlowNode *Lookup_Node(struct FlowNode *node) { return RB_FIND(FlowTree, FlowTree, node); }  // End of Lookup_FlowTree
+    khiter_t k = kh_get(FlowHash, FlowTable, &node->flowKey);
+    return k == kh_end(FlowTable) ? NULL : KeyNode(kh_key(FlowTable, k));
 
-struct FlowNode *Insert_Node(struct FlowNode *node) {
-    struct FlowNode *n;
+}  // End of Lookup_Node
 
+struct FlowNode *Insert_Node(struct FlowNode *node) {
     dbg_assert(node->left == NULL);
     dbg_assert(node->right == NULL);
 
-    // return RB_INSERT(FlowTree, FlowTree, node);
-    n = RB_INSERT(FlowTree, FlowTree, node);
-    if (n) {  // existing node
+    if (!FlowTable) {
+        FlowTable = kh_init(FlowHash);
+        if (!FlowTable) {
+            LogError("kh_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            abort();
+        }
+    }
+
+    int ret;
+    khiter_t k = kh_put(FlowHash, FlowTable, &node->flowKey, &ret);
+    if (ret < 0) {
+        LogError("kh_put() error in %s line %d", __FILE__, __LINE__);
+        abort();
+    }
+
+    if (ret == 0) {  // existing node
+        struct FlowNode *n = KeyNode(kh_key(FlowTable, k));
+        // the caller updates the existing flow with the new packet
+        if (n->nodeType == FLOW_NODE) {
+            UnlinkLRU(&lruList, n);
+            LinkLRU(&lruList, n);
+        }
         return n;
-    } else {
-        flowTreeStat.activeNodes++;
-        if (node->nodeType == FLOW_NODE)
-            flowTreeStat.flowNodes++;
-        else if (node->nodeType == FRAG_NODE)
-            flowTreeStat.fragNodes++;
-        NumFlows++;
-        return NULL;
     }
+
+    flowTreeStat.activeNodes++;
+    if (node->nodeType == FLOW_NODE) {
+        LinkLRU(&lruList, node);
+        LinkAge(&ageList, node);
+        flowTreeStat.flowNodes++;
+    }
+    NumFlows++;
+    return NULL;
+
 }  // End of Insert_Node
 
 void Remove_Node(struct FlowNode *node) {
@@ -304,7 +748,20 @@ void Remove_Node(struct FlowNode *node) {
         rev_node->rev_node = NULL;
         node->rev_node = NULL;
     }
-    RB_REMOVE(FlowTree, FlowTree, node);
+
+    khiter_t k = kh_get(FlowHash, FlowTable, &node->flowKey);
+    if (k == kh_end(FlowTable)) {
+        LogError("Remove_Node() node not in flow table");
+        return;
+    }
+    kh_del(FlowHash, FlowTable, k);
+
+    flowTreeStat.activeNodes--;
+    if (node->nodeType == FLOW_NODE) {
+        UnlinkLRU(&lruList, node);
+        UnlinkAge(&ageList, node);
+        flowTreeStat.flowNodes--;
+    }
     NumFlows--;
 
 }  // End of Remove_Node
@@ -339,81 +796,94 @@ int Link_RevNode(struct FlowNode *node) {
 
 }  // End of Link_RevNode
 
-uint32_t Flush_FlowTree(NodeList_t *NodeList, time_t when) {
+// flush the table of the calling packet thread
+uint32_t Flush_FlowTree(NodeList_t *NodeList) {
     struct FlowNode *node, *nxt;
 
     // Dump all incomplete flows to the file
-    nxt = NULL;
-    for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-        nxt = RB_NEXT(FlowTree, FlowTree, node);
+    uint32_t flowCnt = 0;
+    for (node = ageList.list; node != NULL; node = nxt) {
+        nxt = node->ageNext;
         Remove_Node(node);
-        if (node->nodeType == FRAG_NODE) {
-            Free_Node(node);
-        } else {
-            Push_Node(NodeList, node);
-        }
+        Push_Node(NodeList, node);
+        flowCnt++;
     }
+    for (node = fragList.list; node != NULL; node = nxt) {
+        nxt = node->ageNext;
+        Remove_FragNode(node);
+        Free_Node(node);
+    }
+    Publish_NodeBatch(NodeList);
 
-    node = New_Node();
-    node->timestamp = when;
-    node->nodeType = SIGNAL_NODE;
-    node->signal = SIGNAL_DONE;
-    Push_Node(NodeList, node);
-
-    return 0;
+    return flowCnt;
 
 }  // End of Flush_FlowTree
 
+// expire the timed out nodes from the head of the timer lists
 uint32_t Expire_FlowTree(NodeList_t *NodeList, time_t when) {
-    struct FlowNode *node, *nxt;
-
-    if (NumFlows == 0) return 0;
+    uint32_t fragCnt = Expire_FragTable(when);
+    if (NumFlows == 0) return fragCnt;
 
     uint32_t flowCnt = 0;
-    uint32_t fragCnt = 0;
-    // Dump all incomplete flows to the file
-    nxt = NULL;
-    for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-        nxt = RB_NEXT(FlowTree, FlowTree, node);
-        if ((node->nodeType == FLOW_NODE) &&
-            // inactive timeout
-            ((when - node->t_last.tv_sec) > expireInactiveTimeout ||
-             // active timeout
-             (when - node->t_first.tv_sec) > expireActiveTimeout || when == 0)) {
-            Remove_Node(node);
-            Push_Node(NodeList, node);
-            flowTreeStat.activeNodes--;
-            flowTreeStat.flowNodes--;
-            flowCnt++;
-        } else if ((node->nodeType == FRAG_NODE) && ((when - node->t_last.tv_sec) > 15 || when == 0)) {
-            Remove_Node(node);
-            Free_Node(node);
-            flowTreeStat.activeNodes--;
-            flowTreeStat.fragNodes--;
-        }
+
+    // active timeout
+    while (ageList.list && ((when - ageList.list->t_first.tv_sec) > expireActiveTimeout || when == 0)) {
+        struct FlowNode *node = ageList.list;
+        Remove_Node(node);
+        Push_Node(NodeList, node);
+        flowCnt++;
+    }
+
+    // inactive timeout
+    while (lruList.list && (when - lruList.list->t_last.tv_sec) > expireInactiveTimeout) {
+        struct FlowNode *node = lruList.list;
+        Remove_Node(node);
+        Push_Node(NodeList, node);
+        flowCnt++;
     }
 
     if (flowCnt || fragCnt)
         LogVerbose("Expired flow nodes: %u, expired frag nodes: %u, active tree nodes: %u, allocated nodes %u", flowCnt, fragCnt,
-                   flowTreeStat.activeNodes, Allocated);
+                   flowTreeStat.activeNodes, atomic_load(&Allocated));
 
     return flowCnt + fragCnt;
 }  // End of Expire_FlowTree
 
-/* Node list functions */
+/*
+ * Node list functions
+ * Each producer thread collects its nodes in a local batch and hands over full
+ * batches through its own ring to the consumer - the flow thread. A partial batch
+ * is handed over on every cache check, sync, flush and done node. Both sides spin
+ * shortly before they sleep, the consumer blocks on c_list when all rings are empty.
+ */
+static __thread NodeList_t *batchList = NULL;
+static __thread nodeRing_t *batchRing = NULL;
+static __thread struct FlowNode *batchHead = NULL;
+static __thread struct FlowNode *batchTail = NULL;
+static __thread uint32_t batchLength = 0;
+
+// adaptive wait - spin first, then yield the CPU, then sleep
+static inline void Backoff(unsigned *spin) {
+    if (*spin < 64) {
+        (*spin)++;
+    } else if (*spin < 128) {
+        (*spin)++;
+        sched_yield();
+    } else {
+        struct timespec ts = {0, 50000};
+        nanosleep(&ts, NULL);
+    }
+
+}  // End of Backoff
+
 NodeList_t *NewNodeList(void) {
     NodeList_t *NodeList;
 
-    NodeList = (NodeList_t *)malloc(sizeof(NodeList_t));
+    NodeList = (NodeList_t *)calloc(1, sizeof(NodeList_t));
     if (!NodeList) {
         LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return NULL;
     }
-    NodeList->list = NULL;
-    NodeList->last = NULL;
-    NodeList->length = 0;
-    NodeList->waiting = 0;
-    NodeList->waits = 0;
     pthread_mutex_init(&NodeList->m_list, NULL);
     pthread_cond_init(&NodeList->c_list, NULL);
 
@@ -424,77 +894,161 @@ NodeList_t *NewNodeList(void) {
 void DisposeNodeList(NodeList_t *NodeList) {
     if (!NodeList) return;
 
-    if (NodeList->length) {
+    if (atomic_load(&NodeList->length) || NodeList->current) {
         LogError("Try to free non empty NodeList");
         return;
     }
+    for (int i = 0; i < MaxNodeRings; i++) free(atomic_load(&NodeList->ring[i]));
     free(NodeList);
 
 }  // End of DisposeNodeList
 
 static void DumpTreeStat(NodeList_t *NodeList) {
-    LogInfo("Nodes: in use: %u, Flows: %u, Frag: %u, Nodes list length: %u, Waiting for freelist: %u", Allocated, flowTreeStat.activeNodes,
-            flowTreeStat.fragNodes, NodeList->length, EmptyFreeListEvents);
+    LogInfo("Nodes: in use: %u, Flows: %u, Frag: %u, Nodes list length: %u, Producer stalls: %llu, Consumer waits: %llu, Waiting for freelist: %u",
+            atomic_load(&Allocated), flowTreeStat.activeNodes, flowTreeStat.fragNodes, atomic_load(&NodeList->length),
+            (long long unsigned)atomic_exchange(&NodeList->stalls, 0), (long long unsigned)NodeList->waits, EmptyFreeListEvents);
     EmptyFreeListEvents = 0;
+
+    LogInfo("Fragments: nodes: %u, memory: %zu, inserted: %u, completed: %u, timed out: %u, evicted: %u, dropped: %u", flowTreeStat.fragNodes,
+            fragMemory, fragStat.inserted, fragStat.completed, fragStat.timedOut, fragStat.evicted, fragStat.dropped);
+    memset((void *)&fragStat, 0, sizeof(fragStat_t));
+
+    LogInfo("Payload: slots in use: %d, memory: %zu, dropped: %u", atomic_load(&PayloadInUse), PayloadMemory, atomic_exchange(&PayloadDropped, 0));
 }  // End of DumpTreeStat
 
-void Push_Node(NodeList_t *NodeList, struct FlowNode *node) {
-    pthread_mutex_lock(&NodeList->m_list);
-    if (NodeList->length == 0) {
-        // empty list
-        NodeList->list = node;
-        node->left = NULL;
-        node->right = NULL;
-    } else {
-        NodeList->last->right = node;
-        node->left = NodeList->last;
-        node->right = NULL;
+// get a ring for the calling producer thread
+static void RegisterProducer(NodeList_t *NodeList) {
+    nodeRing_t *ring = calloc(1, sizeof(nodeRing_t));
+    if (!ring) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        abort();
+    }
+
+    uint32_t index = atomic_fetch_add(&NodeList->numRings, 1);
+    if (index >= MaxNodeRings) {
+        LogError("Too many node list producers: %u", index + 1);
+        abort();
+    }
+    atomic_store(&NodeList->ring[index], ring);
+
+    batchList = NodeList;
+    batchRing = ring;
+
+}  // End of RegisterProducer
+
+// hand over the local batch to the consumer
+void Publish_NodeBatch(NodeList_t *NodeList) {
+    if (batchLength == 0) return;
+    dbg_assert(batchList == NodeList);
+
+    nodeRing_t *ring = batchRing;
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if ((head - atomic_load(&ring->tail)) == NodeRingSize) {
+        atomic_fetch_add_explicit(&NodeList->stalls, 1, memory_order_relaxed);
+        unsigned spin = 0;
+        while ((head - atomic_load(&ring->tail)) == NodeRingSize) Backoff(&spin);
     }
-    NodeList->last = node;
-    NodeList->length++;
 
-    //	dbg_printf("pushed node 0x%llx proto: %u, length: %u first: %llx, last: %llx\n",
-    //		(unsigned long long)node, node->proto, NodeList->length,
-    //		(unsigned long long)NodeList->list, (unsigned long long)NodeList->last);
+    ring->slot[head & (NodeRingSize - 1)] = (nodeBatch_t){.list = batchHead, .length = batchLength};
+    atomic_fetch_add(&NodeList->length, batchLength);
+    atomic_store(&ring->head, head + 1);
+
+    batchHead = NULL;
+    batchTail = NULL;
+    batchLength = 0;
 
-    int waiting = NodeList->waiting;
-    pthread_mutex_unlock(&NodeList->m_list);
-    if (waiting) {
+    if (atomic_load(&NodeList->waiting)) {
+        pthread_mutex_lock(&NodeList->m_list);
         pthread_cond_signal(&NodeList->c_list);
+        pthread_mutex_unlock(&NodeList->m_list);
     }
 
+}  // End of Publish_NodeBatch
+
+void Push_Node(NodeList_t *NodeList, struct FlowNode *node) {
+    if (batchList != NodeList) RegisterProducer(NodeList);
+
+    node->left = NULL;
+    node->right = NULL;
+    if (batchTail)
+        batchTail->right = node;
+    else
+        batchHead = node;
+    batchTail = node;
+
+    if (++batchLength == NodeBatchLength) Publish_NodeBatch(NodeList);
+
 }  // End of Push_Node
 
-struct FlowNode *Pop_Node(NodeList_t *NodeList) {
-    struct FlowNode *node;
+// take the next batch from the producer rings - round robin
+static struct FlowNode *TakeBatch(NodeList_t *NodeList) {
+    uint32_t numRings = atomic_load(&NodeList->numRings);
+    if (numRings > MaxNodeRings) numRings = MaxNodeRings;
+
+    for (uint32_t i = 0; i < numRings; i++) {
+        uint32_t index = (NodeList->nextRing + i) % numRings;
+        nodeRing_t *ring = atomic_load(&NodeList->ring[index]);
+        if (!ring) continue;
 
-    pthread_mutex_lock(&NodeList->m_list);
-    while (NodeList->length == 0) {
-        NodeList->waiting = 1;
-        pthread_cond_wait(&NodeList->c_list, &NodeList->m_list);
-        // wake up
-        NodeList->waiting = 0;
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        if (tail == atomic_load(&ring->head)) continue;
+
+        nodeBatch_t batch = ring->slot[tail & (NodeRingSize - 1)];
+        atomic_store(&ring->tail, tail + 1);
+        atomic_fetch_sub(&NodeList->length, batch.length);
+        NodeList->nextRing = index + 1;
+        return batch.list;
     }
 
-    node = NodeList->list;
-    NodeList->list = node->right;
-    if (NodeList->list)
-        NodeList->list->left = NULL;
-    else
-        NodeList->last = NULL;
+    return NULL;
+
+}  // End of TakeBatch
+
+// pop the next node - wait until the deadline or forever, if deadline is NULL
+static struct FlowNode *WaitNode(NodeList_t *NodeList, const struct timespec *deadline) {
+    struct FlowNode *node = NodeList->current;
+
+    if (node == NULL) {
+        unsigned spin = 0;
+        while ((node = TakeBatch(NodeList)) == NULL && spin < 128) Backoff(&spin);
+
+        if (node == NULL) {
+            pthread_mutex_lock(&NodeList->m_list);
+            atomic_store(&NodeList->waiting, 1);
+            while ((node = TakeBatch(NodeList)) == NULL) {
+                NodeList->waits++;
+                if (deadline == NULL) {
+                    pthread_cond_wait(&NodeList->c_list, &NodeList->m_list);
+                } else if (pthread_cond_timedwait(&NodeList->c_list, &NodeList->m_list, deadline) == ETIMEDOUT) {
+                    node = TakeBatch(NodeList);
+                    break;
+                }
+            }
+            atomic_store(&NodeList->waiting, 0);
+            pthread_mutex_unlock(&NodeList->m_list);
+            if (node == NULL) return NULL;
+        }
+    }
 
+    NodeList->current = node->right;
     node->left = NULL;
     node->right = NULL;
 
-    NodeList->length--;
-    pthread_mutex_unlock(&NodeList->m_list);
-
-    //	dbg_printf("popped node 0x%llx proto: %u, length: %u first: %llx, last: %llx\n",
-    //		(unsigned long long)node, node->proto, NodeList->length,
-    //		(unsigned long long)NodeList->list, (unsigned long long)NodeList->last);
+    //	dbg_printf("popped node 0x%llx proto: %u\n", (unsigned long long)node, node->flowKey.proto);
 
     return node;
-}  // End of Pop_Node
+}  // End of WaitNode
+
+struct FlowNode *Pop_Node(NodeList_t *NodeList) { return WaitNode(NodeList, NULL); }  // End of Pop_Node
+
+// Pop_Node, but wait at most timeout seconds - returns NULL, if no node arrived in time
+struct FlowNode *Pop_NodeTimeout(NodeList_t *NodeList, int timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout;
+    return WaitNode(NodeList, &deadline);
+
+}  // End of Pop_NodeTimeout
 
 void Push_SyncNode(NodeList_t *NodeList, time_t timestamp) {
     struct FlowNode *Node = New_Node();
@@ -502,6 +1056,46 @@ void Push_SyncNode(NodeList_t *NodeList, time_t timestamp) {
     Node->nodeType = SIGNAL_NODE;
     Node->signal = SIGNAL_SYNC;
     Push_Node(NodeList, Node);
+    Publish_NodeBatch(NodeList);
+    Flush_NodeBatch();
     DumpTreeStat(NodeList);
 
 }  // End of Push_SyncNode
+
+// hand over the local batch, after the consumer took the nodes of all other producers
+static void Publish_LastBatch(NodeList_t *NodeList) {
+    unsigned spin = 0;
+    while (atomic_load(&NodeList->length)) Backoff(&spin);
+    Publish_NodeBatch(NodeList);
+
+}  // End of Publish_LastBatch
+
+// sync node, which follows all nodes pushed so far and precedes all nodes pushed later by any producer
+void Sync_NodeList(NodeList_t *NodeList, time_t timestamp) {
+    struct FlowNode *Node = New_Node();
+    Node->timestamp = timestamp;
+    Node->nodeType = SIGNAL_NODE;
+    Node->signal = SIGNAL_SYNC;
+    Push_Node(NodeList, Node);
+    Publish_LastBatch(NodeList);
+    Flush_NodeBatch();
+
+    // wait until the consumer took the sync node
+    unsigned spin = 0;
+    while (atomic_load(&NodeList->length)) Backoff(&spin);
+
+}  // End of Sync_NodeList
+
+// signal the flow thread to close the last file and terminate
+void Push_DoneNode(NodeList_t *NodeList, time_t timestamp) {
+    struct FlowNode *Node = New_Node();
+    Node->timestamp = timestamp;
+    Node->nodeType = SIGNAL_NODE;
+    Node->signal = SIGNAL_DONE;
+    Push_Node(NodeList, Node);
+
+    // the done node must be the last node
+    Publish_LastBatch(NodeList);
+    Flush_NodeBatch();
+
+}  // End of Push_DoneNode
@@ -42,20 +42,55 @@
 #include "config.h"
 #include "nfdump.h"
 #include "nfxV3.h"
-#include "rbtree.h"
 
 #define v4 ip_addr._v4
 #define v6 ip_addr._v6
 
+// interval to expire the flow cache - packet time in seconds
+#define EXPIREINTERVALL 10
+
+// default max payload length per flow
+#define DefaultPayloadLength 512
+
 typedef struct flowTreeStat_s {
     size_t activeNodes;
     size_t flowNodes;
     size_t fragNodes;
 } flowTreeStat_t;
 
+typedef struct fragStat_s {
+    uint32_t inserted;
+    uint32_t completed;
+    uint32_t timedOut;
+    uint32_t evicted;
+    uint32_t dropped;
+} fragStat_t;
+
+// rarely used flow data - allocated on demand by NodeExt()
+struct nodeExt_s {
+    // tunnel data
+    ip_addr_t tun_src_addr;
+    ip_addr_t tun_dst_addr;
+    uint8_t tun_proto;
+    uint8_t tun_ip_version;
+
+    uint32_t mpls[10];
+
+    struct latency_s {
+        uint64_t client;
+        uint64_t server;
+        uint64_t application;
+        uint32_t flag;
+        struct timeval t_request;
+    } latency;
+};
+
 struct FlowNode {
-    // tree
-    RB_ENTRY(FlowNode) entry;
+    // flow table timer lists
+    struct FlowNode *lruPrev;  // ordered by last packet
+    struct FlowNode *lruNext;
+    struct FlowNode *agePrev;  // ordered by first packet
+    struct FlowNode *ageNext;
 
     // linked list
     struct FlowNode *left;
@@ -89,21 +124,11 @@ struct FlowNode {
     uint8_t signal;  //    1: fin received - end of flow
                      //  254: empty node - used to rotate file
                      //  255: empty node - used to terminate flow thread
+    uint8_t sampled;  // flow passed the early sampling filter
 
     // vlan label
     uint32_t vlanID;
 
-    // tunnel data
-    ip_addr_t tun_src_addr;
-    ip_addr_t tun_dst_addr;
-    uint8_t tun_proto;
-    uint8_t tun_ip_version;
-
-    // pf data
-    uint8_t action;
-    uint8_t reason;
-    uint32_t ruleNr;
-
     // flow stat data
     union {
         struct timeval t_first;  // used for file rotation
@@ -117,41 +142,58 @@ struct FlowNode {
     void *pflog;
     void *payload;         // payload
     uint32_t payloadSize;  // Size of payload
-    uint32_t mpls[10];
     uint64_t srcMac;
     uint64_t dstMac;
 
     struct FlowNode *rev_node;
-    struct latency_s {
-        uint64_t client;
-        uint64_t server;
-        uint64_t application;
-        uint32_t flag;
-        struct timeval t_request;
-    } latency;
+    struct nodeExt_s *ext;  // tunnel, mpls and latency data or NULL
 };
 
-typedef struct NodeList_s {
+// max number of -T packet threads
+#define MAXWORKERS 64
+
+// nodes per batch, batches per producer ring - power of 2 - and max producers:
+// the packet threads, the -r -T reader thread and the main thread with the done node
+#define NodeBatchLength 256
+#define NodeRingSize 256
+#define MaxNodeRings (MAXWORKERS + 2)
+
+typedef struct nodeBatch_s {
     struct FlowNode *list;
-    struct FlowNode *last;
-    pthread_mutex_t m_list;
-    pthread_cond_t c_list;
     uint32_t length;
-    uint32_t waiting;
-    uint64_t waits;
-} NodeList_t;
+} nodeBatch_t;
+
+// single producer single consumer ring of node batches
+typedef struct nodeRing_s {
+    _Atomic uint32_t head;  // next slot to fill - producer
+    uint8_t _pad1[60];
+    _Atomic uint32_t tail;  // next slot to take - consumer
+    uint8_t _pad2[60];
+    nodeBatch_t slot[NodeRingSize];
+} nodeRing_t;
 
-/* flow tree type */
-typedef RB_HEAD(FlowTree, FlowNode) FlowTree_t;
+typedef struct NodeList_s {
+    // one ring per producer thread
+    _Atomic(nodeRing_t *) ring[MaxNodeRings];
+    _Atomic uint32_t numRings;
+
+    // consumer
+    struct FlowNode *current;  // remaining nodes of the current batch
+    uint32_t nextRing;
+    pthread_mutex_t m_list;
+    pthread_cond_t c_list;
+    _Atomic uint32_t waiting;
 
-// Insert the RB prototypes here
-RB_PROTOTYPE(FlowTree, FlowNode, entry, FlowNodeCMP);
+    _Atomic uint32_t length;  // nodes in the rings
+    uint64_t waits;           // consumer blocked on empty rings
+    _Atomic uint64_t stalls;  // producer found its ring full
+} NodeList_t;
 
 int Init_FlowTree(uint32_t CacheSize, int32_t expireActive, int32_t expireInactive);
 
 void Dispose_FlowTree(void);
 
-uint32_t Flush_FlowTree(NodeList_t *NodeList, time_t when);
+uint32_t Flush_FlowTree(NodeList_t *NodeList);
 
 uint32_t Expire_FlowTree(NodeList_t *NodeList, time_t when);
 
@@ -161,6 +203,14 @@ struct FlowNode *New_Node(void);
 
 void Free_Node(struct FlowNode *node);
 
+struct nodeExt_s *NodeExt(struct FlowNode *node);
+
+int Init_PayloadPool(uint32_t maxLength);
+
+int Add_NodePayload(struct FlowNode *node, void *data, uint32_t length);
+
+void Flush_NodeBatch(void);
+
 void CacheCheck(NodeList_t *NodeList, time_t when);
 
 int AddNodeData(struct FlowNode *node, uint32_t seq, void *payload, uint32_t size);
@@ -171,6 +221,17 @@ void Remove_Node(struct FlowNode *node);
 
 int Link_RevNode(struct FlowNode *node);
 
+// IPv4 fragment table
+struct FlowNode *Lookup_FragNode(struct FlowNode *node);
+
+struct FlowNode *Insert_FragNode(struct FlowNode *node);
+
+void Remove_FragNode(struct FlowNode *node);
+
+int Add_FragData(struct FlowNode *node, uint32_t offset, void *data, uint32_t length);
+
+void Complete_FragNode(struct FlowNode *node, uint32_t size);
+
 // Node list functions
 NodeList_t *NewNodeList(void);
 
@@ -180,8 +241,16 @@ void Push_Node(NodeList_t *NodeList, struct FlowNode *node);
 
 struct FlowNode *Pop_Node(NodeList_t *NodeList);
 
+struct FlowNode *Pop_NodeTimeout(NodeList_t *NodeList, int timeout);
+
 void Push_SyncNode(NodeList_t *NodeList, time_t timestamp);
 
+void Sync_NodeList(NodeList_t *NodeList, time_t timestamp);
+
+void Publish_NodeBatch(NodeList_t *NodeList);
+
+void Push_DoneNode(NodeList_t *NodeList, time_t timestamp);
+
 void DumpList(NodeList_t *NodeList);
 
 #endif  // _FLOWTREE_H
@@ -83,6 +83,7 @@
 #include "pcaproc.h"
 #include "pidfile.h"
 #include "repeater.h"
+#include "samplefilter.h"
 #include "util.h"
 #include "version.h"
 
@@ -92,6 +93,9 @@
 #define FILTER "ip"
 #define TO_MS 100
 
+// stdio buffer to read a pcap file
+#define FILEBUFFSIZE (16 * 1024 * 1024)
+
 static int verbose = 0;
 static int done = 0;
 /*
@@ -102,6 +106,7 @@ static int done = 0;
 static int launcher_pid;
 static pthread_mutex_t m_done = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t terminate = PTHREAD_COND_INITIALIZER;
+static void *fileBuffer = NULL;
 
 uint32_t linktype;
 uint32_t linkoffset;
@@ -119,6 +124,8 @@ static void WaitDone(void);
 
 static int scanOptions(flowParam_t *flowParam, char *options);
 
+static char *EarlyFilter(char *filter, char *dropFilter, char *keepFilter, char *sampleFilter);
+
 /*
  * Functions
  */
@@ -135,16 +142,23 @@ static void usage(char *name) {
         "-B num\tset the node cache size. (default 524288)\n"
         "-s snaplen\tset the snapshot length - default 1522\n"
         "-e active,inactive\tset the active,inactive flow expire time (s) - default 300,60\n"
-        "-o options \tAdd flow options, separated with ','. Available: 'fat', 'payload'\n"
+        "-o options \tAdd flow options, separated with ','. Available: 'fat', 'payload[=len]', 'stream', 'lz4'\n"
         "-w flowdir \tset the flow output directory. (no default) \n"
         "-C <file>\tRead optional config file.\n"
         "-H host[/port]\tSend flows to host or IP address/port. Default port 9995.\n"
         "-m socket\t\tEnable metric exporter on socket.\n"
         "-p pcapdir \tset the pcapdir directory. (optional) \n"
+        "-Z\t\tdump the packet ring blocks to pcapdir without copying. Linux only.\n"
+        "-N\t\tstore nanosecond timestamps in the pcap files. Linux only.\n"
         "-S subdir\tSub directory format. see nfcapd(1) for format\n"
         "-I Ident\tset the ident string for stat file. (default 'none')\n"
         "-P pidfile\tset the PID file\n"
         "-t time frame\tset the time window to rotate pcap/nfcapd file\n"
+        "-x num\t\tsample 1:num flows early by a hash of the IP addresses.\n"
+        "-K filter\tkeep packets matching this pcap filter unsampled.\n"
+        "-X filter\tdrop packets matching this pcap filter early.\n"
+        "-T num\t\tcapture with num packet threads in a fanout group. Linux only.\n"
+        "\t\tWith -r, process the file with num flow workers.\n"
         "-z\t\tLZO compress flows in output file.\n"
         "-y\t\tLZ4 compress flows in output file.\n"
         "-j\t\tBZ2 compress flows in output file.\n"
@@ -169,10 +183,22 @@ static int setup_pcap_file(packetParam_t *param, char *pcap_file, char *filter,
 
     dbg_printf("Enter function: %s\n", __FUNCTION__);
 
+    // - reads from stdin, as pcap_open_offline()
+    FILE *fp = strcmp(pcap_file, "-") == 0 ? stdin : fopen(pcap_file, "rb");
+    if (fp == NULL) {
+        LogError("fopen() failed for %s: %s", pcap_file, strerror(errno));
+        return -1;
+    }
+
+    // read large sequential chunks of the file
+    fileBuffer = malloc(FILEBUFFSIZE);
+    if (fileBuffer) setvbuf(fp, fileBuffer, _IOFBF, FILEBUFFSIZE);
+
     errbuf[0] = '\0';
-    handle = pcap_open_offline(pcap_file, errbuf);
+    handle = pcap_fopen_offline(fp, errbuf);
     if (handle == NULL) {
-        LogError("pcap_open_offline() failed: %s", errbuf);
+        LogError("pcap_fopen_offline() failed: %s", errbuf);
+        fclose(fp);
         return -1;
     }
 
@@ -265,6 +291,21 @@ static int scanOptions(flowParam_t *flowParam, char *options) {
         } else if (strncasecmp(option, "payload", 8) == 0) {
             flowParam->addPayload = 1;
             dbg_printf("Found payload option\n");
+        } else if (strncasecmp(option, "payload=", 8) == 0) {
+            int length = atoi(option + 8);
+            if (length <= 0 || length > 65535) {
+                LogError("Payload length out of range: %s", option + 8);
+                return -1;
+            }
+            flowParam->addPayload = 1;
+            flowParam->payloadLength = length;
+            dbg_printf("Found payload option - length: %d\n", length);
+        } else if (strncasecmp(option, "stream", 7) == 0) {
+            flowParam->stream = SEND_STREAM;
+            dbg_printf("Found stream option\n");
+        } else if (strncasecmp(option, "lz4", 4) == 0) {
+            flowParam->stream = SEND_STREAM_LZ4;
+            dbg_printf("Found lz4 stream option\n");
         } else {
             LogError("Unknown option: %s", option);
             return -1;
@@ -276,17 +317,66 @@ static int scanOptions(flowParam_t *flowParam, char *options) {
 
 }  // End of scanOption
 
+/*
+ * Build the early filter stage: the pcap filter, the drop filter and the 1:N flow sampling
+ * are combined into one filter, which is attached to the socket. The kernel drops the
+ * packets before they are copied to the packet ring. Non IP packets are not sampled.
+ */
+static char *EarlyFilter(char *filter, char *dropFilter, char *keepFilter, char *sampleFilter) {
+    char *sample = "";
+    if (sampleFilter) {
+        size_t len = strlen(sampleFilter) + 32;
+        sample = malloc(len);
+        if (!sample) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return NULL;
+        }
+        snprintf(sample, len, "(%s or (not ip and not ip6))", sampleFilter);
+    }
+
+    size_t len = strlen(sample) + 64;
+    if (filter) len += strlen(filter);
+    if (dropFilter) len += strlen(dropFilter);
+    if (keepFilter) len += strlen(keepFilter);
+    char *earlyFilter = malloc(len);
+    if (!earlyFilter) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    char *s = earlyFilter;
+    char *and = "";
+    if (filter) {
+        s += snprintf(s, len - (s - earlyFilter), "(%s)", filter);
+        and = " and ";
+    }
+    if (dropFilter) {
+        s += snprintf(s, len - (s - earlyFilter), "%snot (%s)", and, dropFilter);
+        and = " and ";
+    }
+    if (sampleFilter) {
+        if (keepFilter)
+            snprintf(s, len - (s - earlyFilter), "%s((%s) or %s)", and, keepFilter, sample);
+        else
+            snprintf(s, len - (s - earlyFilter), "%s%s", and, sample);
+        free(sample);
+    }
+
+    return earlyFilter;
+
+}  // End of EarlyFilter
+
 int main(int argc, char *argv[]) {
     sigset_t signal_set;
     struct sigaction sa;
     int c, snaplen, bufflen, err, do_daemonize;
     int subdir_index, compress, expire, cache_size, buff_size;
-    int activeTimeout, inactiveTimeout, metricInterval;
+    int activeTimeout, inactiveTimeout, metricInterval, numWorkers, zeroCopy, nanoSec, sampleRate;
     dirstat_t *dirstat;
     repeater_t *sendHost;
     time_t t_win;
     char *device, *pcapfile, *filter, *datadir, *pcap_datadir, *pidfile, *configFile, *options;
-    char *Ident, *userid, *groupid, *metricsocket;
+    char *Ident, *userid, *groupid, *metricsocket, *dropFilter, *keepFilter, *sampleFilter;
     char *time_extension;
 
     snaplen = 1522;
@@ -316,7 +406,13 @@ int main(int argc, char *argv[]) {
     buff_size = 20;
     activeTimeout = 0;
     inactiveTimeout = 0;
-    while ((c = getopt(argc, argv, "b:B:C:De:g:hH:I:i:j:l:m:o:p:P:r:s:S:T:t:u:vVw:yz")) != EOF) {
+    numWorkers = 1;
+    zeroCopy = 0;
+    nanoSec = 0;
+    sampleRate = 1;
+    dropFilter = NULL;
+    keepFilter = NULL;
+    while ((c = getopt(argc, argv, "b:B:C:De:g:hH:I:i:j:K:l:m:No:p:P:r:s:S:T:t:u:vVw:x:X:yzZ")) != EOF) {
         switch (c) {
             struct stat fstat;
             case 'h':
@@ -502,7 +598,30 @@ int main(int argc, char *argv[]) {
                 subdir_index = atoi(optarg);
                 break;
             case 'T':
-                printf("Option -T no longer supported and ignored\n");
+                numWorkers = atoi(optarg);
+                if (numWorkers < 1 || numWorkers > MAXWORKERS) {
+                    LogError("Number of packet threads out of range 1..%d", MAXWORKERS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'N':
+                nanoSec = 1;
+                break;
+            case 'x':
+                sampleRate = atoi(optarg);
+                if (sampleRate < 1 || sampleRate > 65536) {
+                    LogError("Sampling rate out of range 1..65536");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'K':
+                keepFilter = optarg;
+                break;
+            case 'X':
+                dropFilter = optarg;
+                break;
+            case 'Z':
+                zeroCopy = 1;
                 break;
             case 'v':
                 if (verbose < 4) verbose++;
@@ -541,9 +660,54 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (numWorkers > 1 && !pcapfile) {
+#ifdef USE_TPACKETV3
+        if (pcap_datadir) {
+            LogError("-T can not be combined with -p for live capture");
+            exit(EXIT_FAILURE);
+        }
+#else
+        LogError("-T is not supported for live capture on this platform");
+        exit(EXIT_FAILURE);
+#endif
+    }
+
+    if (keepFilter && sampleRate == 1) {
+        LogError("-K requires sampling with -x");
+        exit(EXIT_FAILURE);
+    }
+
+    sampleFilter = NULL;
+    if (sampleRate > 1) {
+        sampleFilter = SampleFilter(sampleRate);
+        if (!sampleFilter) exit(EXIT_FAILURE);
+    }
+
+    if (sampleFilter || dropFilter) {
+        filter = EarlyFilter(filter, dropFilter, keepFilter, sampleFilter);
+        if (!filter) exit(EXIT_FAILURE);
+        dbg_printf("Early filter: %s\n", filter);
+    }
+
+    if (zeroCopy || nanoSec) {
+#ifdef USE_TPACKETV3
+        if (pcapfile || !pcap_datadir) {
+            LogError("-Z and -N require an interface and -p");
+            exit(EXIT_FAILURE);
+        }
+#else
+        LogError("-Z and -N are not supported on this platform");
+        exit(EXIT_FAILURE);
+#endif
+    }
+
     flushParam_t flushParam = {0};
-    packetParam_t packetParam = {0};
     flowParam_t flowParam = {0};
+    packetParam_t *packetParam = calloc(numWorkers, sizeof(packetParam_t));
+    if (!packetParam) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
     flushParam.extensionFormat = time_extension;
     flowParam.extensionFormat = time_extension;
 
@@ -556,13 +720,27 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (flowParam.stream && !sendHost) {
+        LogError("Option stream requires a remote host -H.");
+        exit(EXIT_FAILURE);
+    }
+
+    // the sampler records are only written into local flow files
+    if (sampleRate > 1 && sendHost) {
+        LogError("Sampling -x can not be combined with -H.");
+        exit(EXIT_FAILURE);
+    }
+
     if (sendHost) {
         int p = atoi(sendHost->port);
         if (p <= 0 || p > 655535) {
             LogError("ERROR: Port to send flows is not a regular port.");
             exit(EXIT_FAILURE);
         }
-        sendHost->sockfd = Unicast_send_socket(sendHost->hostname, sendHost->port, AF_UNSPEC, bufflen, &(sendHost->addr), &(sendHost->addrlen));
+        if (flowParam.stream)
+            sendHost->sockfd = Stream_send_socket(sendHost->hostname, sendHost->port, AF_UNSPEC);
+        else
+            sendHost->sockfd = Unicast_send_socket(sendHost->hostname, sendHost->port, AF_UNSPEC, bufflen, &(sendHost->addr), &(sendHost->addrlen));
         if (sendHost->sockfd <= 0) exit(EXIT_FAILURE);
         dbg_printf("Replay flows to host: %s port: %s\n", sendHost->hostname, sendHost->port);
         flowParam.sendHost = sendHost;
@@ -570,22 +748,34 @@ int main(int argc, char *argv[]) {
 
     int buffsize = 64 * 1024;
     int ret;
+    int numThreads = numWorkers;
     void *(*packet_thread)(void *) = NULL;
     if (pcapfile) {
-        packetParam.live = 0;
-        ret = setup_pcap_file(&packetParam, pcapfile, filter, snaplen);
-        packet_thread = pcap_packet_thread;
+        packetParam->live = 0;
+        ret = setup_pcap_file(packetParam, pcapfile, filter, snaplen);
+        // a single reader thread distributes the packets to the flow workers
+        packetParam->numWorkers = numWorkers;
+        packet_thread = numWorkers > 1 ? pcap_parallel_thread : pcap_packet_thread;
+        numThreads = 1;
     } else {
-        packetParam.live = 1;
+        packetParam->live = 1;
 #ifdef USE_BPFSOCKET
-        packetParam.bpfBufferSize = buffsize;
-        ret = setup_bpf_live(&packetParam, device, filter, snaplen, buffsize, TO_MS);
+        packetParam->bpfBufferSize = buffsize;
+        ret = setup_bpf_live(packetParam, device, filter, snaplen, buffsize, TO_MS);
         packet_thread = bpf_packet_thread;
 #elif USE_TPACKETV3
-        ret = setup_linux_live(&packetParam, device, filter, snaplen, buffsize, TO_MS);
+        // with multiple packet threads, each thread reads its own ring of the fanout group
+        for (int i = 0; i < numWorkers; i++) {
+            packetParam[i].live = 1;
+            packetParam[i].fanout = numWorkers > 1 ? getpid() & 0xffff : 0;
+            packetParam[i].zeroCopy = zeroCopy;
+            packetParam[i].nanoSec = nanoSec;
+            ret = setup_linux_live(&packetParam[i], device, filter, snaplen, buffsize, TO_MS);
+            if (ret < 0) break;
+        }
         packet_thread = linux_packet_thread;
 #else
-        ret = setup_pcap_live(&packetParam, device, filter, snaplen, buffsize, TO_MS);
+        ret = setup_pcap_live(packetParam, device, filter, snaplen, buffsize, TO_MS);
         packet_thread = pcap_packet_thread;
 #endif
     }
@@ -594,6 +784,21 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // flows are sampled, if their first packet passed the sample part of the early filter
+    // and not the keep filter. Non IP packets pass the early filter unsampled
+    struct bpf_program sampleCode = {0};
+    struct bpf_program keepCode = {0};
+    if (sampleFilter) {
+        pcap_t *p = pcap_open_dead(packetParam->linktype, snaplen);
+        if (!p || pcap_compile(p, &sampleCode, sampleFilter, 1, PCAP_NETMASK_UNKNOWN) ||
+            (keepFilter && pcap_compile(p, &keepCode, keepFilter, 1, PCAP_NETMASK_UNKNOWN))) {
+            LogError("Couldn't parse sample or keep filter: %s", p ? pcap_geterr(p) : "pcap_open_dead() failed");
+            exit(EXIT_FAILURE);
+        }
+        pcap_close(p);
+    }
+    flowParam.sampleRate = sampleRate;
+
     SetPriv(userid, groupid);
 
     FlowSource_t *fs = NULL;
@@ -616,7 +821,7 @@ int main(int argc, char *argv[]) {
         if (!Init_nffile(NULL)) exit(EXIT_FAILURE);
 
         if (subdir_index && !InitHierPath(subdir_index)) {
-            pcap_close(packetParam.pcap_dev);
+            pcap_close(packetParam->pcap_dev);
             exit(EXIT_FAILURE);
         }
 
@@ -631,8 +836,13 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (flowParam.payloadLength && !Init_PayloadPool(flowParam.payloadLength)) {
+        LogError("Init_PayloadPool() failed.");
+        exit(EXIT_FAILURE);
+    }
+
     if (!InitLog(do_daemonize, argv[0], SYSLOG_FACILITY, verbose)) {
-        pcap_close(packetParam.pcap_dev);
+        pcap_close(packetParam->pcap_dev);
         exit(EXIT_FAILURE);
     }
 
@@ -641,7 +851,7 @@ int main(int argc, char *argv[]) {
     }
 
     if (pidfile) {
-        if (check_pid(pidfile) != 0 || write_pid(pidfile) == 0) pcap_close(packetParam.pcap_dev);
+        if (check_pid(pidfile) != 0 || write_pid(pidfile) == 0) pcap_close(packetParam->pcap_dev);
         exit(EXIT_FAILURE);
     }
 
@@ -672,14 +882,14 @@ int main(int argc, char *argv[]) {
 
     // fire pcap dump flush thread
     if (pcap_datadir) {
-        flushParam.pcap_dev = packetParam.pcap_dev;
+        flushParam.pcap_dev = packetParam->pcap_dev;
         flushParam.archivedir = pcap_datadir;
         flushParam.subdir_index = subdir_index;
         if (InitBufferQueues(&flushParam) < 0) {
             exit(EXIT_FAILURE);
         }
-        packetParam.bufferQueue = flushParam.bufferQueue;
-        packetParam.flushQueue = flushParam.flushQueue;
+        packetParam->bufferQueue = flushParam.bufferQueue;
+        packetParam->flushQueue = flushParam.flushQueue;
         flushParam.parent = pthread_self();
 
         int err = pthread_create(&flushParam.tid, NULL, flush_thread, (void *)&flushParam);
@@ -710,34 +920,44 @@ int main(int argc, char *argv[]) {
     }
     dbg_printf("Started flow thread[%lu]", (long unsigned)flowParam.tid);
 
-    packetParam.parent = pthread_self();
-    packetParam.NodeList = flowParam.NodeList;
-    packetParam.extendedFlow = flowParam.extendedFlow;
-    packetParam.addPayload = flowParam.addPayload;
-    packetParam.t_win = t_win;
-    packetParam.done = &done;
-    err = pthread_create(&packetParam.tid, NULL, packet_thread, (void *)&packetParam);
-    if (err) {
-        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < numThreads; i++) {
+        packetParam[i].parent = pthread_self();
+        packetParam[i].NodeList = flowParam.NodeList;
+        packetParam[i].extendedFlow = flowParam.extendedFlow;
+        packetParam[i].addPayload = flowParam.addPayload;
+        packetParam[i].sampleRate = sampleRate;
+        packetParam[i].sampleFilter = sampleFilter ? &sampleCode : NULL;
+        packetParam[i].keepFilter = keepFilter ? &keepCode : NULL;
+        packetParam[i].t_win = t_win;
+        packetParam[i].done = &done;
+        err = pthread_create(&packetParam[i].tid, NULL, packet_thread, (void *)&packetParam[i]);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        dbg_printf("Started packet thread[%lu]\n", (long unsigned)packetParam[i].tid);
     }
-    dbg_printf("Started packet thread[%lu]\n", (long unsigned)packetParam.tid);
 
     // Wait till done
     WaitDone();
 
-    dbg_printf("Signal packet thread to terminate\n");
-    pthread_kill(packetParam.tid, SIGUSR2);
-    pthread_join(packetParam.tid, NULL);
-    dbg_printf("Packet thread joined\n");
+    // the packet threads flush their flow trees, when terminating
+    dbg_printf("Signal packet threads to terminate\n");
+    time_t t_last = 0;
+    for (int i = 0; i < numThreads; i++) {
+        pthread_kill(packetParam[i].tid, SIGUSR2);
+        pthread_join(packetParam[i].tid, NULL);
+        if (packetParam[i].t_win > t_last) t_last = packetParam[i].t_win;
+    }
+    dbg_printf("Packet threads joined\n");
 
     if (pcap_datadir) {
         pthread_join(flushParam.tid, NULL);
         dbg_printf("Pcap flush thread joined\n");
     }
 
-    dbg_printf("Flush flow tree\n");
-    Flush_FlowTree(flowParam.NodeList, packetParam.t_win);
+    dbg_printf("Close flow thread\n");
+    Push_DoneNode(flowParam.NodeList, t_last);
 
     // flow thread terminates on end of node queue
     pthread_join(flowParam.tid, NULL);
@@ -754,8 +974,17 @@ int main(int argc, char *argv[]) {
 
     CloseMetric();
 
-    LogInfo("Total: Processed: %u, skipped: %u, short caplen: %u, unknown: %u\n", packetParam.proc_stat.packets, packetParam.proc_stat.skipped,
-            packetParam.proc_stat.short_snap, packetParam.proc_stat.unknown);
+    proc_stat_t proc_stat = {0};
+    for (int i = 0; i < numThreads; i++) {
+        proc_stat.packets += packetParam[i].proc_stat.packets;
+        proc_stat.skipped += packetParam[i].proc_stat.skipped;
+        proc_stat.short_snap += packetParam[i].proc_stat.short_snap;
+        proc_stat.unknown += packetParam[i].proc_stat.unknown;
+    }
+    free(packetParam);
+    if (fileBuffer) free(fileBuffer);
+    LogInfo("Total: Processed: %u, skipped: %u, short caplen: %u, unknown: %u\n", proc_stat.packets, proc_stat.skipped, proc_stat.short_snap,
+            proc_stat.unknown);
 
     if (pidfile) remove_pid(pidfile);
 
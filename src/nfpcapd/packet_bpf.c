@@ -359,6 +359,9 @@ void __attribute__((noreturn)) * bpf_packet_thread(void *args) {
     CloseSocket(packetParam);
     packetParam->t_win = t_start;
 
+    // push all remaining flows of this thread to the flow thread
+    Flush_FlowTree(packetParam->NodeList);
+
     // Tell parent we are gone
     pthread_kill(packetParam->parent, SIGUSR1);
     pthread_exit(NULL);
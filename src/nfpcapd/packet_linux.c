@@ -68,10 +68,13 @@ static int setup_pcap_filter(packetParam_t *param, char *filter);
 
 static void ReportStat(packetParam_t *param);
 
-static inline void PcapDump(packetBuffer_t *packetBuffer, struct tpacket3_hdr *ppd);
+static inline void PcapDump(packetBuffer_t *packetBuffer, struct tpacket3_hdr *ppd, int nanoSec);
 
-static struct tpacket_stats_v3 last_stat = {0};
-static proc_stat_t proc_stat = {0};
+static inline void PcapDumpIOV(packetBuffer_t *packetBuffer, struct tpacket3_hdr *ppd, int nanoSec);
+
+// each packet thread reports the stat of its own ring
+static __thread struct tpacket_stats_v3 last_stat = {0};
+static __thread proc_stat_t proc_stat = {0};
 
 /*
  * Functions
@@ -90,7 +93,8 @@ static void CloseSocket(packetParam_t *param) {
 // Initialize the socket rx ring buffer
 static int InitRing(packetParam_t *param, char *device) {
     unsigned int blocksiz = 1 << 22, framesiz = 1 << 11;
-    unsigned int blocknum = 64;
+    // the rings of a fanout group share the traffic
+    unsigned int blocknum = param->fanout ? 16 : 64;
 
     struct ring *ring = &(param->ring);
     memset(&ring->req, 0, sizeof(ring->req));
@@ -173,7 +177,8 @@ int setup_linux_live(packetParam_t *param, char *device, char *filter, int snapl
     param->linktype = DLT_EN10MB;
 
     // pcap handle for dumper
-    pcap_t *p = pcap_open_dead(DLT_EN10MB, 1 << 16);
+    pcap_t *p = param->nanoSec ? pcap_open_dead_with_tstamp_precision(DLT_EN10MB, 1 << 16, PCAP_TSTAMP_PRECISION_NANO)
+                               : pcap_open_dead(DLT_EN10MB, 1 << 16);
     param->pcap_dev = p;
 
     if (filter && !setup_pcap_filter(param, filter)) {
@@ -181,6 +186,18 @@ int setup_linux_live(packetParam_t *param, char *device, char *filter, int snapl
         return -1;
     }
 
+    // join the fanout group after the filter is set. The flow hash is symmetric, so both
+    // directions of a flow and all fragments of a packet end up in the same ring
+    if (param->fanout) {
+        int fanout = param->fanout | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        if (setsockopt(param->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+            LogError("setsockopt(PACKET_FANOUT) failed: %s", strerror(errno));
+            CloseSocket(param);
+            pcap_close(param->pcap_dev);
+            return -1;
+        }
+    }
+
     return 0;
 
 } /* setup_pcap_live */
@@ -228,11 +245,11 @@ static void ReportStat(packetParam_t *param) {
 
 }  // End of ReportStat
 
-static inline void PcapDump(packetBuffer_t *packetBuffer, struct tpacket3_hdr *ppd) {
+static inline void PcapDump(packetBuffer_t *packetBuffer, struct tpacket3_hdr *ppd, int nanoSec) {
     // caller checks for enough space in buffer
     struct pcap_sf_pkthdr sf_hdr;
     sf_hdr.ts.tv_sec = ppd->tp_sec;
-    sf_hdr.ts.tv_usec = ppd->tp_nsec / 1000;
+    sf_hdr.ts.tv_usec = nanoSec ? ppd->tp_nsec : ppd->tp_nsec / 1000;
     sf_hdr.caplen = ppd->tp_snaplen;
     sf_hdr.len = ppd->tp_len;
 
@@ -247,6 +264,36 @@ static inline void PcapDump(packetBuffer_t *packetBuffer, struct tpacket3_hdr *p
 
 }  // End of PcapDump
 
+// zero copy dump - add the record header to the buffer and reference the packet in the ring block
+static inline void PcapDumpIOV(packetBuffer_t *packetBuffer, struct tpacket3_hdr *ppd, int nanoSec) {
+    // caller checks for enough space in buffer
+    if ((packetBuffer->iovCnt + 2) > packetBuffer->iovSize) {
+        uint32_t iovSize = packetBuffer->iovSize ? 2 * packetBuffer->iovSize : 4096;
+        struct iovec *iov = realloc(packetBuffer->iov, iovSize * sizeof(struct iovec));
+        if (!iov) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return;
+        }
+        packetBuffer->iov = iov;
+        packetBuffer->iovSize = iovSize;
+    }
+
+    struct pcap_sf_pkthdr *sf_hdr = (struct pcap_sf_pkthdr *)(packetBuffer->buffer + packetBuffer->bufferSize);
+    sf_hdr->ts.tv_sec = ppd->tp_sec;
+    sf_hdr->ts.tv_usec = nanoSec ? ppd->tp_nsec : ppd->tp_nsec / 1000;
+    sf_hdr->caplen = ppd->tp_snaplen;
+    sf_hdr->len = ppd->tp_len;
+    packetBuffer->bufferSize += sizeof(struct pcap_sf_pkthdr);
+
+    struct iovec *iov = packetBuffer->iov + packetBuffer->iovCnt;
+    iov[0].iov_base = (void *)sf_hdr;
+    iov[0].iov_len = sizeof(struct pcap_sf_pkthdr);
+    iov[1].iov_base = (void *)ppd + ppd->tp_mac;
+    iov[1].iov_len = ppd->tp_snaplen;
+    packetBuffer->iovCnt += 2;
+
+}  // End of PcapDumpIOV
+
 void __attribute__((noreturn)) * linux_packet_thread(void *args) {
     packetParam_t *packetParam = (packetParam_t *)args;
 
@@ -256,6 +303,8 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
 
     int done = *(packetParam->done);
     int DoPacketDump = packetParam->bufferQueue != NULL;
+    int ZeroCopyDump = DoPacketDump && packetParam->zeroCopy;
+    int nanoSec = packetParam->nanoSec;
 
     packetBuffer_t *packetBuffer = NULL;
     if (DoPacketDump) packetBuffer = queue_pop(packetParam->bufferQueue);
@@ -324,7 +373,7 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
                 t_start = t_packet - (t_packet % t_win);
             }
 
-            size_t size = sizeof(struct pcap_sf_pkthdr) + ppd->tp_len;
+            size_t size = sizeof(struct pcap_sf_pkthdr) + (ZeroCopyDump ? 0 : ppd->tp_len);
             if (DoPacketDump) {
                 if ((packetBuffer->bufferSize + size) > BUFFSIZE) {
                     packetBuffer->timeStamp = 0;
@@ -332,7 +381,10 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
                     queue_push(packetParam->flushQueue, packetBuffer);
                     packetBuffer = queue_pop(packetParam->bufferQueue);
                 }
-                PcapDump(packetBuffer, ppd);
+                if (ZeroCopyDump)
+                    PcapDumpIOV(packetBuffer, ppd, nanoSec);
+                else
+                    PcapDump(packetBuffer, ppd, nanoSec);
             }
             struct pcap_pkthdr phdr;
             phdr.ts.tv_sec = ppd->tp_sec;
@@ -345,8 +397,16 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
         }
         done = done || *(packetParam->done);
 
-        pbd->h1.block_status = TP_STATUS_KERNEL;
-        block_num = (block_num + 1) % 64;
+        if (ZeroCopyDump) {
+            // the flush thread returns the block to the kernel after writing its packets
+            packetBuffer->blockStatus = (_Atomic uint32_t *)&pbd->h1.block_status;
+            packetBuffer->timeStamp = 0;
+            queue_push(packetParam->flushQueue, packetBuffer);
+            packetBuffer = queue_pop(packetParam->bufferQueue);
+        } else {
+            pbd->h1.block_status = TP_STATUS_KERNEL;
+        }
+        block_num = (block_num + 1) % packetParam->ring.req.tp_block_nr;
     }
 
     // flush buffer
@@ -359,6 +419,10 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
 
     ReportStat(packetParam);
     CloseSocket(packetParam);
+    packetParam->t_win = t_start;
+
+    // push all remaining flows of this thread to the flow thread
+    Flush_FlowTree(packetParam->NodeList);
 
     // Tell parent we are gone
     pthread_kill(packetParam->parent, SIGUSR1);
@@ -233,19 +233,17 @@ void __attribute__((noreturn)) * pcap_packet_thread(void *args) {
 
     time_t t_win = packetParam->t_win;
     time_t now = 0;
+    struct pcap_pkthdr *hdr;
+    const u_char *data;
+    int firstRet = 0;
     if (packetParam->live) {
         // start time is now for live capture
         now = time(NULL);
     } else {
-        struct pcap_pkthdr *hdr;
-        const u_char *data;
-        // start time is time of 1st packet for file reading
-        long pos = ftell(pcap_file(packetParam->pcap_dev));
-        if (pcap_next_ex(packetParam->pcap_dev, &hdr, &data) == 1) {
-            now = hdr->ts.tv_sec;
-        }
-        // reset file to 1st packet
-        fseek(pcap_file(packetParam->pcap_dev), pos, SEEK_SET);
+        // start time is time of 1st packet for file reading. The file may be a pipe,
+        // so the packet is not read again, but processed first in the loop
+        firstRet = pcap_next_ex(packetParam->pcap_dev, &hdr, &data);
+        if (firstRet == 1) now = hdr->ts.tv_sec;
     }
     time_t t_start = now - (now % t_win);
 
@@ -256,10 +254,8 @@ void __attribute__((noreturn)) * pcap_packet_thread(void *args) {
     if (DoPacketDump) packetBuffer = queue_pop(packetParam->bufferQueue);
 
     while (!done) {
-        struct pcap_pkthdr *hdr;
-        const u_char *data;
-
-        int ret = pcap_next_ex(packetParam->pcap_dev, &hdr, &data);
+        int ret = firstRet ? firstRet : pcap_next_ex(packetParam->pcap_dev, &hdr, &data);
+        firstRet = 0;
         time_t t_packet = 0;
         switch (ret) {
             case 1: {
@@ -341,9 +337,377 @@ void __attribute__((noreturn)) * pcap_packet_thread(void *args) {
     ReportStat(packetParam);
     packetParam->t_win = t_start;
 
+    // push all remaining flows of this thread to the flow thread
+    Flush_FlowTree(packetParam->NodeList);
+
     // Tell parent we are gone
     pthread_kill(packetParam->parent, SIGUSR1);
     pthread_exit("leave pcap_loop()");
     /* NOTREACHED */
 
 } /* End of packet_thread */
+
+/*
+ * Parallel processing of a pcap file
+ * The reader thread hands over the packets in batches to the flow workers. The packets
+ * are distributed by a symmetric hash of the IP addresses, so all packets of a flow and
+ * all fragments of a packet are processed by the same worker. The flow cache expiry and
+ * the flow file rotation follow the packet time of the reader, as in pcap_packet_thread()
+ */
+#define WORKERBUFFSIZE (1024 * 1024)
+#define WORKERBUFFERS 8
+
+// batch of packet records - struct pcap_pkthdr followed by the packet, 8 byte aligned
+typedef struct packetBatch_s {
+    time_t expire;  // expire the flow cache after the packets
+    uint32_t sync;  // report to the reader after the packets
+    uint32_t numPackets;
+    size_t size;
+    uint8_t data[WORKERBUFFSIZE];
+} packetBatch_t;
+
+#define PacketRecordSize(caplen) ((sizeof(struct pcap_pkthdr) + (caplen) + 7) & ~(size_t)7)
+
+typedef struct packetWorker_s {
+    packetParam_t packetParam;
+    queue_t *batchQueue;   // batches to process
+    queue_t *freeQueue;    // processed batches
+    packetBatch_t *batch;  // batch filled by the reader
+    _Atomic uint32_t *synced;
+} packetWorker_t;
+
+static inline uint64_t Load64(const u_char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}  // End of Load64
+
+static inline uint32_t Load32(const u_char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}  // End of Load32
+
+// hash of the IP address pair - the same for both directions
+static uint32_t PacketHash(uint32_t linktype, const u_char *data, uint32_t caplen) {
+    uint32_t offset = 0;
+    uint32_t type = 0;
+
+    switch (linktype) {
+        case DLT_EN10MB:
+            offset = 14;
+            if (caplen < offset) return 0;
+            type = (data[12] << 8) | data[13];
+            while ((type == 0x8100 || type == 0x88a8) && caplen >= (offset + 4)) {
+                type = (data[offset + 2] << 8) | data[offset + 3];
+                offset += 4;
+            }
+            break;
+        case DLT_LINUX_SLL:
+            offset = 16;
+            if (caplen < offset) return 0;
+            type = (data[14] << 8) | data[15];
+            break;
+        case DLT_RAW:
+            offset = 0;
+            break;
+        case DLT_NULL:
+        case DLT_LOOP:
+            offset = 4;
+            break;
+        default:
+            // all packets to the first worker
+            return 0;
+    }
+
+    if (caplen <= offset) return 0;
+    const u_char *ip = data + offset;
+    if (type == 0) {
+        // no ethertype - check IP version
+        type = (ip[0] >> 4) == 6 ? 0x86dd : 0x0800;
+    }
+
+    uint64_t a, b;
+    if (type == 0x0800 && caplen >= (offset + 20)) {
+        a = Load32(ip + 12);
+        b = Load32(ip + 16);
+    } else if (type == 0x86dd && caplen >= (offset + 40)) {
+        a = Load64(ip + 8) ^ Load64(ip + 16);
+        b = Load64(ip + 24) ^ Load64(ip + 32);
+    } else {
+        return 0;
+    }
+
+    uint64_t h = (a ^ b) + (a + b) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (uint32_t)h;
+
+}  // End of PacketHash
+
+static void *pcap_worker_thread(void *args) {
+    packetWorker_t *worker = (packetWorker_t *)args;
+    packetParam_t *packetParam = &worker->packetParam;
+
+    while (1) {
+        packetBatch_t *batch = queue_pop(worker->batchQueue);
+        if (batch == QUEUE_CLOSED) break;
+
+        uint8_t *p = batch->data;
+        for (uint32_t i = 0; i < batch->numPackets; i++) {
+            struct pcap_pkthdr *hdr = (struct pcap_pkthdr *)p;
+            ProcessPacket(packetParam, hdr, p + sizeof(struct pcap_pkthdr));
+            p += PacketRecordSize(hdr->caplen);
+        }
+
+        if (batch->expire) {
+            Expire_FlowTree(packetParam->NodeList, batch->expire);
+            Publish_NodeBatch(packetParam->NodeList);
+        }
+        if (batch->sync) {
+            Publish_NodeBatch(packetParam->NodeList);
+            atomic_fetch_add(worker->synced, 1);
+        }
+
+        batch->expire = 0;
+        batch->sync = 0;
+        batch->numPackets = 0;
+        batch->size = 0;
+        queue_push(worker->freeQueue, batch);
+    }
+
+    // push all remaining flows of this worker to the flow thread
+    Flush_FlowTree(packetParam->NodeList);
+
+    pthread_exit(NULL);
+
+}  // End of pcap_worker_thread
+
+static void DispatchBatch(packetWorker_t *worker) {
+    queue_push(worker->batchQueue, worker->batch);
+    worker->batch = queue_pop(worker->freeQueue);
+}  // End of DispatchBatch
+
+// wait until all workers processed their packets so far
+static void SyncWorkers(packetWorker_t *workers, uint32_t numWorkers, _Atomic uint32_t *synced) {
+    atomic_store(synced, 0);
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        workers[i].batch->sync = 1;
+        DispatchBatch(&workers[i]);
+    }
+
+    struct timespec ts = {0, 1000};
+    while (atomic_load(synced) < numWorkers) {
+        nanosleep(&ts, NULL);
+        if (ts.tv_nsec < 1000000) ts.tv_nsec <<= 1;
+    }
+
+}  // End of SyncWorkers
+
+static void SumWorkerStat(packetParam_t *packetParam, packetWorker_t *workers, uint32_t numWorkers) {
+    proc_stat_t stat = {0};
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        stat.packets += workers[i].packetParam.proc_stat.packets;
+        stat.skipped += workers[i].packetParam.proc_stat.skipped;
+        stat.short_snap += workers[i].packetParam.proc_stat.short_snap;
+        stat.unknown += workers[i].packetParam.proc_stat.unknown;
+    }
+    packetParam->proc_stat = stat;
+
+}  // End of SumWorkerStat
+
+static packetWorker_t *StartWorkers(packetParam_t *packetParam, _Atomic uint32_t *synced) {
+    uint32_t numWorkers = packetParam->numWorkers;
+    packetWorker_t *workers = calloc(numWorkers, sizeof(packetWorker_t));
+    if (!workers) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        packetWorker_t *worker = &workers[i];
+        worker->packetParam = *packetParam;
+        worker->packetParam.extExpire = 1;
+        memset((void *)&worker->packetParam.proc_stat, 0, sizeof(proc_stat_t));
+        worker->synced = synced;
+        worker->batchQueue = queue_init(WORKERBUFFERS);
+        worker->freeQueue = queue_init(WORKERBUFFERS);
+        if (!worker->batchQueue || !worker->freeQueue) {
+            LogError("queue_init() failed for worker %u", i);
+            return NULL;
+        }
+        for (int j = 0; j < WORKERBUFFERS; j++) {
+            packetBatch_t *batch = malloc(sizeof(packetBatch_t));
+            if (!batch) {
+                LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                return NULL;
+            }
+            batch->expire = 0;
+            batch->sync = 0;
+            batch->numPackets = 0;
+            batch->size = 0;
+            queue_push(worker->freeQueue, batch);
+        }
+        worker->batch = queue_pop(worker->freeQueue);
+
+        int err = pthread_create(&worker->packetParam.tid, NULL, pcap_worker_thread, (void *)worker);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            return NULL;
+        }
+        dbg_printf("Started flow worker[%lu]\n", (long unsigned)worker->packetParam.tid);
+    }
+    LogVerbose("Started %u flow workers", numWorkers);
+
+    return workers;
+
+}  // End of StartWorkers
+
+static void StopWorkers(packetWorker_t *workers, uint32_t numWorkers) {
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        packetWorker_t *worker = &workers[i];
+        if (worker->batch->numPackets)
+            queue_push(worker->batchQueue, worker->batch);
+        else
+            queue_push(worker->freeQueue, worker->batch);
+        worker->batch = NULL;
+        queue_close(worker->batchQueue);
+    }
+
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        packetWorker_t *worker = &workers[i];
+        pthread_join(worker->packetParam.tid, NULL);
+
+        queue_close(worker->freeQueue);
+        void *batch;
+        while ((batch = queue_pop(worker->freeQueue)) != QUEUE_CLOSED) free(batch);
+        queue_free(worker->freeQueue);
+        queue_free(worker->batchQueue);
+    }
+
+}  // End of StopWorkers
+
+void __attribute__((noreturn)) * pcap_parallel_thread(void *args) {
+    packetParam_t *packetParam = (packetParam_t *)args;
+    uint32_t numWorkers = packetParam->numWorkers;
+
+    time_t t_win = packetParam->t_win;
+    time_t now = 0;
+    struct pcap_pkthdr *hdr;
+    const u_char *data;
+    // start time is time of 1st packet - processed first in the loop, as the file may be a pipe
+    int firstRet = pcap_next_ex(packetParam->pcap_dev, &hdr, &data);
+    if (firstRet == 1) now = hdr->ts.tv_sec;
+    time_t t_start = now - (now % t_win);
+
+    _Atomic uint32_t synced = 0;
+    packetWorker_t *workers = StartWorkers(packetParam, &synced);
+    if (!workers) {
+        LogError("Failed to start flow workers");
+        pthread_kill(packetParam->parent, SIGUSR1);
+        pthread_exit("leave pcap_parallel_thread()");
+    }
+
+    int done = *(packetParam->done);
+    int DoPacketDump = packetParam->bufferQueue != NULL;
+
+    packetBuffer_t *packetBuffer = NULL;
+    if (DoPacketDump) packetBuffer = queue_pop(packetParam->bufferQueue);
+
+    // cache expiry with the same packet timing as ProcessPacket() and CacheCheck()
+    time_t lastRun = 0;
+    time_t lastExpire = 0;
+    while (!done) {
+        int ret = firstRet ? firstRet : pcap_next_ex(packetParam->pcap_dev, &hdr, &data);
+        firstRet = 0;
+        switch (ret) {
+            case 1: {
+                // packet read ok
+                time_t t_packet = hdr->ts.tv_sec;
+                if ((t_packet - t_start) >= t_win) {
+                    if (DoPacketDump) {
+                        // Rote dump file - close old - open new
+                        packetBuffer->timeStamp = t_start;
+                        queue_push(packetParam->flushQueue, packetBuffer);
+                        packetBuffer = queue_pop(packetParam->bufferQueue);
+                    }
+                    // Rotate flow file, after all workers handed over their flows
+                    SyncWorkers(workers, numWorkers, &synced);
+                    SumWorkerStat(packetParam, workers, numWorkers);
+                    ReportStat(packetParam);
+                    Sync_NodeList(packetParam->NodeList, t_start);
+                    t_start = t_packet - (t_packet % t_win);
+                }
+
+                if (DoPacketDump) {
+                    size_t size = sizeof(struct pcap_sf_pkthdr) + hdr->caplen;
+                    if ((packetBuffer->bufferSize + size) > BUFFSIZE) {
+                        packetBuffer->timeStamp = 0;
+                        queue_push(packetParam->flushQueue, packetBuffer);
+                        packetBuffer = queue_pop(packetParam->bufferQueue);
+                    }
+                    PcapDump(packetBuffer, hdr, data);
+                }
+
+                packetWorker_t *worker = &workers[PacketHash(packetParam->linktype, data, hdr->caplen) % numWorkers];
+                size_t recordSize = PacketRecordSize(hdr->caplen);
+                if ((worker->batch->size + recordSize) > WORKERBUFFSIZE) DispatchBatch(worker);
+                packetBatch_t *batch = worker->batch;
+                memcpy(batch->data + batch->size, (void *)hdr, sizeof(struct pcap_pkthdr));
+                memcpy(batch->data + batch->size + sizeof(struct pcap_pkthdr), (void *)data, hdr->caplen);
+                batch->size += recordSize;
+                batch->numPackets++;
+
+                if ((t_packet - lastRun) > 1) {
+                    if (lastExpire == 0) {
+                        lastExpire = t_packet;
+                    } else if ((t_packet - lastExpire) > EXPIREINTERVALL) {
+                        for (uint32_t i = 0; i < numWorkers; i++) {
+                            workers[i].batch->expire = t_packet;
+                            DispatchBatch(&workers[i]);
+                        }
+                        lastExpire = t_packet;
+                    }
+                    lastRun = t_packet;
+                }
+            } break;
+            case -2:  // End of packet file
+                dbg_printf("pcap_next_ex() eof\n");
+                done = 1;
+                break;
+            case -1:
+                LogError("pcap_next_ex() read error: '%s'", pcap_geterr(packetParam->pcap_dev));
+                done = 1;
+                break;
+            default:
+                LogError("Unexpected pcap_next_ex() return value: %i", ret);
+                done = 1;
+        }
+        done = done || *(packetParam->done);
+    }
+
+    dbg_printf("Done reading file - stop workers\n");
+    StopWorkers(workers, numWorkers);
+    SumWorkerStat(packetParam, workers, numWorkers);
+    free(workers);
+
+    if (DoPacketDump) {
+        packetBuffer->timeStamp = t_start;
+        queue_push(packetParam->flushQueue, packetBuffer);
+        queue_close(packetParam->flushQueue);
+    }
+
+    CloseSocket(packetParam);
+    ReportStat(packetParam);
+    packetParam->t_win = t_start;
+
+    // Tell parent we are gone
+    pthread_kill(packetParam->parent, SIGUSR1);
+    pthread_exit("leave pcap_parallel_thread()");
+    /* NOTREACHED */
+
+}  // End of pcap_parallel_thread
@@ -33,6 +33,7 @@
 
 #include <pcap.h>
 #include <pthread.h>
+#include <sys/uio.h>
 
 #include "flowtree.h"
 #include "queue.h"
@@ -45,7 +46,7 @@
 
 struct pcap_timeval {
     int32_t tv_sec;  /* seconds */
-    int32_t tv_usec; /* microseconds */
+    int32_t tv_usec; /* microseconds - nanoseconds in nano pcap files */
 };
 
 struct pcap_sf_pkthdr {
@@ -58,6 +59,12 @@ typedef struct packetBuffer_s {
     time_t timeStamp;
     size_t bufferSize;
     void *buffer;
+    // zero copy dump - the buffer holds the record headers, the iovecs point
+    // to the headers and the packets in the ring block
+    struct iovec *iov;
+    uint32_t iovCnt;
+    uint32_t iovSize;
+    _Atomic uint32_t *blockStatus;  // ring block to return to the kernel or NULL
 } packetBuffer_t;
 
 typedef struct proc_stat_s {
@@ -89,6 +96,9 @@ typedef struct packetParam_s {
 #endif
 #ifdef USE_TPACKETV3
     int fd;
+    int fanout;    // PACKET_FANOUT group id or 0
+    int zeroCopy;  // dump the ring blocks without copying the packets
+    int nanoSec;   // dump nanosecond timestamps
     struct ring ring;
 #endif
 
@@ -101,9 +111,14 @@ typedef struct packetParam_s {
     uint32_t linktype;
 
     uint32_t live;
+    uint32_t numWorkers;  // flow workers of the offline reader
+    uint32_t extExpire;   // flow cache expiry driven by the offline reader
     uint32_t fat;
     uint32_t extendedFlow;
     uint32_t addPayload;
+    uint32_t sampleRate;               // early filter samples 1:sampleRate flows
+    struct bpf_program *sampleFilter;  // sample part of the early filter
+    struct bpf_program *keepFilter;    // packets kept unsampled by the early filter
     proc_stat_t proc_stat;
 } packetParam_t;
 
@@ -111,6 +126,8 @@ int setup_pcap_live(packetParam_t *param, char *device, char *filter, int snaple
 
 void __attribute__((noreturn)) * pcap_packet_thread(void *args);
 
+void __attribute__((noreturn)) * pcap_parallel_thread(void *args);
+
 #ifdef USE_BPFSOCKET
 int setup_bpf_live(packetParam_t *param, char *device, char *filter, int snaplen, int buffsize, int to_ms);
 
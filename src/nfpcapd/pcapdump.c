@@ -32,6 +32,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -41,6 +42,7 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -53,6 +55,10 @@
 #define PCAP_TMP "pcap.current"
 #define MAXBUFFERS 8
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 static char pcap_dumpfile[MAXPATHLEN];
 
 /*
@@ -132,16 +138,17 @@ static pcap_dumper_t *pcap_dump_open_append(pcap_t *p, const char *fname) {
 }
 #endif
 
-static int appendPcap(char *existFile, char *appendFile) {
+static int appendPcap(char *existFile, char *appendFile, int precision) {
     char errbuff[256];
-    pcap_t *pcapAppend = pcap_open_offline(appendFile, errbuff);
+    // keep the timestamp precision of the dump files
+    pcap_t *pcapAppend = pcap_open_offline_with_tstamp_precision(appendFile, precision, errbuff);
     if (!pcapAppend) {
         LogError("Failed to open existing pcap");
         return 0;
     }
 
     int snaplen = pcap_snapshot(pcapAppend);
-    pcap_t *pcapExist = pcap_open_dead(DLT_EN10MB, snaplen);
+    pcap_t *pcapExist = pcap_open_dead_with_tstamp_precision(DLT_EN10MB, snaplen, precision);
     pcap_dumper_t *dumper = pcap_dump_open_append(pcapExist, existFile);
     if (dumper == NULL) {
         printf("Append failed: %s\n", pcap_geterr(pcapExist));
@@ -196,7 +203,7 @@ static int CloseDumpFile(flushParam_t *param, time_t t_start) {
     } else if (fileStat == PATH_OK) {
         // file exists - append pcap
         dbg_printf("CloseDumpFile() append %s -> %s\n", pcap_dumpfile, datefile);
-        if (!appendPcap(datefile, pcap_dumpfile)) {
+        if (!appendPcap(datefile, pcap_dumpfile, pcap_get_tstamp_precision(param->pcap_dev))) {
             LogError("Failed to append pcapfile");
         }
         unlink(pcap_dumpfile);
@@ -208,6 +215,32 @@ static int CloseDumpFile(flushParam_t *param, time_t t_start) {
 
 }  // End of CloseDumpFile
 
+// write all iovecs - writev() may write less than requested
+static int WriteIOV(int fd, struct iovec *iov, int iovCnt) {
+    while (iovCnt > 0) {
+        int cnt = iovCnt > IOV_MAX ? IOV_MAX : iovCnt;
+        ssize_t ret = writev(fd, iov, cnt);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        // skip the written iovecs
+        while (iovCnt && ret >= (ssize_t)iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovCnt--;
+        }
+        if (ret) {
+            iov->iov_base += ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+
+}  // End of WriteIOV
+
 int InitBufferQueues(flushParam_t *flushParam) {
     flushParam->bufferQueue = queue_init(MAXBUFFERS);
     flushParam->flushQueue = queue_init(MAXBUFFERS);
@@ -254,14 +287,26 @@ void __attribute__((noreturn)) * flush_thread(void *args) {
                 /* NOTREACHED */
             }
             dbg_printf("flush_thread() flush buffer\n");
-            if (write(flushParam->pfd, packetBuffer->buffer, packetBuffer->bufferSize) <= 0) {
+            if (packetBuffer->iovCnt) {
+                if (WriteIOV(flushParam->pfd, packetBuffer->iov, packetBuffer->iovCnt) < 0) {
+                    LogError("writev() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+                }
+            } else if (write(flushParam->pfd, packetBuffer->buffer, packetBuffer->bufferSize) <= 0) {
                 LogError("write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
             }
-
-            // return buffer
-            packetBuffer->bufferSize = 0;
-            queue_push(flushParam->bufferQueue, packetBuffer);
         }
+        if (packetBuffer->blockStatus) {
+            // return the ring block to the kernel - TP_STATUS_KERNEL
+            atomic_store_explicit(packetBuffer->blockStatus, 0, memory_order_release);
+            packetBuffer->blockStatus = NULL;
+        }
+
+        // return buffer
+        packetBuffer->bufferSize = 0;
+        packetBuffer->iovCnt = 0;
+        packetBuffer->timeStamp = 0;
+        queue_push(flushParam->bufferQueue, packetBuffer);
+
         if (timeStamp) {
             // rotate file
             dbg_printf("flush_thread() CloseDumpFile\n");
@@ -271,7 +316,6 @@ void __attribute__((noreturn)) * flush_thread(void *args) {
                 pthread_exit("CloseDumpFile failed.");
                 /* NOTREACHED */
             }
-            packetBuffer->timeStamp = 0;
         }
     }
 
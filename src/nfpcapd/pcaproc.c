@@ -93,7 +93,7 @@ typedef struct vlan_hdr_s {
     uint16_t type;
 } vlan_hdr_t;
 
-static time_t lastRun = 0;  // remember last run to idle cache
+static __thread time_t lastRun = 0;  // remember last run to idle cache
 
 static inline void SetServer_latency(struct FlowNode *node);
 
@@ -216,10 +216,10 @@ static inline void SetServer_latency(struct FlowNode *node) {
     latency = ((uint64_t)node->t_first.tv_sec * (uint64_t)1000000 + (uint64_t)node->t_first.tv_usec) -
               ((uint64_t)Client_node->t_first.tv_sec * (uint64_t)1000000 + (uint64_t)Client_node->t_first.tv_usec);
 
-    node->latency.server = latency;
-    Client_node->latency.server = latency;
+    NodeExt(node)->latency.server = latency;
+    NodeExt(Client_node)->latency.server = latency;
     // set flag, to calc client latency with nex packet from client
-    Client_node->latency.flag = 1;
+    Client_node->ext->latency.flag = 1;
     dbg_printf("Server latency: %llu\n", (long long unsigned)latency);
 
 }  // End of SetServerClient_latency
@@ -235,13 +235,13 @@ static inline void SetClient_latency(struct FlowNode *node, struct timeval *t_pa
     latency = ((uint64_t)t_packet->tv_sec * (uint64_t)1000000 + (uint64_t)t_packet->tv_usec) -
               ((uint64_t)Server_node->t_first.tv_sec * (uint64_t)1000000 + (uint64_t)Server_node->t_first.tv_usec);
 
-    node->latency.client = latency;
-    Server_node->latency.client = latency;
+    NodeExt(node)->latency.client = latency;
+    NodeExt(Server_node)->latency.client = latency;
     // reset flag
-    node->latency.flag = 0;
+    node->ext->latency.flag = 0;
     // set flag, to calc application latency with nex packet from server
-    Server_node->latency.flag = 2;
-    Server_node->latency.t_request = *t_packet;
+    Server_node->ext->latency.flag = 2;
+    Server_node->ext->latency.t_request = *t_packet;
     dbg_printf("Client latency: %llu\n", (long long unsigned)latency);
 
 }  // End of SetClient_latency
@@ -255,12 +255,12 @@ void SetApplication_latency(struct FlowNode *node, struct timeval *t_packet) {
     if (!Client_node) return;
 
     latency = ((uint64_t)t_packet->tv_sec * (uint64_t)1000000 + (uint64_t)t_packet->tv_usec) -
-              ((uint64_t)node->latency.t_request.tv_sec * (uint64_t)1000000 + (uint64_t)node->latency.t_request.tv_usec);
+              ((uint64_t)node->ext->latency.t_request.tv_sec * (uint64_t)1000000 + (uint64_t)node->ext->latency.t_request.tv_usec);
 
-    node->latency.application = latency;
-    Client_node->latency.application = latency;
+    node->ext->latency.application = latency;
+    NodeExt(Client_node)->latency.application = latency;
     // reset flag
-    node->latency.flag = 0;
+    node->ext->latency.flag = 0;
     dbg_printf("Application latency: %llu\n", (long long unsigned)latency);
 
 }  // End of SetApplication_latency
@@ -287,20 +287,11 @@ static inline struct FlowNode *ProcessIPfrag(packetParam_t *packetParam, const s
         Node->flowKey.dst_port = 0;
         Node->nodeType = FRAG_NODE;
 
-        if (Insert_Node(Node) != NULL) {
+        if (Insert_FragNode(Node) != NULL) {
             dbg_printf("IP fragment: initial node already exists! Skip!\n");
             Free_Node(Node);
             return NULL;
         }
-
-        // allocate enough memory for udp packet
-        Node->payload = calloc(1, 65536);
-        if (!Node->payload) {
-            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-            Remove_Node(Node);
-            Free_Node(Node);
-            return NULL;
-        }
     } else {
         struct FlowNode FindNode = {0};
         FindNode.flowKey.version = AF_INET;
@@ -310,11 +301,13 @@ static inline struct FlowNode *ProcessIPfrag(packetParam_t *packetParam, const s
         FindNode.flowKey.src_port = ntohs(ip->ip_id);
         FindNode.flowKey.dst_port = 0;
 
-        Node = Lookup_Node(&FindNode);
+        Node = Lookup_FragNode(&FindNode);
         if (!Node) {
             dbg_printf("IP fragment: initial node missing! Skip!\n");
             return NULL;
         }
+        Node->t_last.tv_sec = hdr->ts.tv_sec;
+        Node->t_last.tv_usec = hdr->ts.tv_usec;
 
         if ((ip_off & IP_MF) && frag_offset) dbg_printf("Fragmented packet: middle segment: ip_off: %u, frag_offset: %u\n", ip_off, frag_offset);
     }
@@ -322,21 +315,18 @@ static inline struct FlowNode *ProcessIPfrag(packetParam_t *packetParam, const s
     void *dataptr = (void *)ip + size_ip;
     ptrdiff_t len = eodata - dataptr;
     dbg_printf("IP frag: Insert fragment at offset: %u, length: %td\n", frag_offset, len);
-    if ((frag_offset + len) > 65536) {
-        LogError("IP fragmen too large: %.", frag_offset + len);
-        Remove_Node(Node);
+    if (!Add_FragData(Node, frag_offset, dataptr, len)) {
+        dbg_printf("IP fragment dropped: offset: %u, length: %td\n", frag_offset, len);
+        Remove_FragNode(Node);
         Free_Node(Node);
         return NULL;
     }
 
-    memcpy(Node->payload + frag_offset, dataptr, len);
-
     if ((ip_off & IP_MF) == 0) {
         // last fragment - export node
-        Node->payloadSize = frag_offset + len;
+        Complete_FragNode(Node, frag_offset + len);
         Node->bytes = size_ip + Node->payloadSize;
         dbg_printf("Fragmented packet: last segment: ip_off: %u, frag_offset: %u, total len: %u\n", ip_off, frag_offset, Node->payloadSize);
-        Remove_Node(Node);
         return Node;
     }
 
@@ -344,12 +334,9 @@ static inline struct FlowNode *ProcessIPfrag(packetParam_t *packetParam, const s
 }  // End of ProcessIPfrag
 
 static inline void AddPayload(struct FlowNode *Node, void *payload, size_t payloadSize) {
-    Node->payload = malloc(payloadSize);
-    if (!Node->payload) {
-        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-    } else {
-        memcpy(Node->payload, payload, payloadSize);
-        Node->payloadSize = payloadSize;
+    // truncated to the max payload length - dropped, if the payload pool is exhausted
+    if (!Add_NodePayload(Node, payload, payloadSize)) {
+        dbg_printf("Payload pool exhausted - payload dropped\n");
     }
 }
 
@@ -386,9 +373,9 @@ static inline void ProcessTCPFlow(packetParam_t *packetParam, struct FlowNode *N
     assert(Node->memflag == NODE_IN_USE);
 
     // check for first client ACK for client latency
-    if (Node->latency.flag == 1) {
+    if (Node->ext && Node->ext->latency.flag == 1) {
         SetClient_latency(Node, &(NewNode->t_first));
-    } else if (Node->latency.flag == 2) {
+    } else if (Node->ext && Node->ext->latency.flag == 2) {
         SetApplication_latency(Node, &(NewNode->t_first));
     }
     // update existing flow
@@ -872,13 +859,19 @@ REDO_IPPROTO:
     Node->nodeType = FLOW_NODE;
     Node->pflog = pflog;
 
+    // same decision as the early filter - sampled, if not kept and the sample hash matches
+    if (packetParam->sampleFilter)
+        Node->sampled = (packetParam->keepFilter == NULL || pcap_offline_filter(packetParam->keepFilter, hdr, data) == 0) &&
+                        pcap_offline_filter(packetParam->sampleFilter, hdr, data) != 0;
+
     // bytes = number of bytes on wire - data link data
     dbg_printf("Payload: %td bytes, Full packet: %u bytes\n", eodata - dataptr, Node->bytes);
 
     if (numMPLS) {
+        struct nodeExt_s *ext = NodeExt(Node);
         if (numMPLS > 10) numMPLS = 10;
         for (int i = 0; i < numMPLS; i++) {
-            Node->mpls[i] = *mplsLabel;
+            ext->mpls[i] = *mplsLabel;
             mplsLabel++;
         }
     }
@@ -999,10 +992,11 @@ REDO_IPPROTO:
             }
 
             // move IP to tun IP
-            Node->tun_src_addr = Node->flowKey.src_addr;
-            Node->tun_dst_addr = Node->flowKey.dst_addr;
-            Node->tun_proto = IPPROTO_IPIP;
-            Node->tun_ip_version = Node->flowKey.version;
+            struct nodeExt_s *ext = NodeExt(Node);
+            ext->tun_src_addr = Node->flowKey.src_addr;
+            ext->tun_dst_addr = Node->flowKey.dst_addr;
+            ext->tun_proto = IPPROTO_IPIP;
+            ext->tun_ip_version = Node->flowKey.version;
 
             dbg_printf("  IPIPv6 tunnel - inner IPv6:\n");
 
@@ -1021,10 +1015,11 @@ REDO_IPPROTO:
             }
 
             // move IP to tun IP
-            Node->tun_src_addr = Node->flowKey.src_addr;
-            Node->tun_dst_addr = Node->flowKey.dst_addr;
-            Node->tun_proto = IPPROTO_IPIP;
-            Node->tun_ip_version = Node->flowKey.version;
+            struct nodeExt_s *ext = NodeExt(Node);
+            ext->tun_src_addr = Node->flowKey.src_addr;
+            ext->tun_dst_addr = Node->flowKey.dst_addr;
+            ext->tun_proto = IPPROTO_IPIP;
+            ext->tun_ip_version = Node->flowKey.version;
 
             dbg_printf("  IPIP tunnel - inner IP:\n");
 
@@ -1102,10 +1097,11 @@ REDO_IPPROTO:
                 goto END_FUNC;
             }
             // move IP to tun IP
-            Node->tun_src_addr = Node->flowKey.src_addr;
-            Node->tun_dst_addr = Node->flowKey.dst_addr;
-            Node->tun_proto = IPPROTO_GRE;
-            Node->tun_ip_version = Node->flowKey.version;
+            struct nodeExt_s *ext = NodeExt(Node);
+            ext->tun_src_addr = Node->flowKey.src_addr;
+            ext->tun_dst_addr = Node->flowKey.dst_addr;
+            ext->tun_proto = IPPROTO_GRE;
+            ext->tun_ip_version = Node->flowKey.version;
             // redo IP proto evaluation
             goto REDO_LINK_PROTO;
 
@@ -1130,7 +1126,7 @@ END_FUNC:
         dbg_printf("Defragmented buffer freed for proto %u\n", IPproto);
     }
 
-    if ((hdr->ts.tv_sec - lastRun) > 1) {
+    if (!packetParam->extExpire && (hdr->ts.tv_sec - lastRun) > 1) {
         CacheCheck(packetParam->NodeList, hdr->ts.tv_sec);
         lastRun = hdr->ts.tv_sec;
     }
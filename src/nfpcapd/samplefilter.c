@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2023, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "samplefilter.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+/*
+ * Sample part of the early filter: 1:N flows are sampled by a hash of the sum of the
+ * IP address words and, for unfragmented TCP and UDP packets, the ports and the protocol.
+ * The sums are the same for both directions of a flow. Fragments and all other protocols
+ * are hashed by their addresses only, so all fragments of a datagram are sampled alike.
+ * libpcap evaluates tcp[] and udp[] for IPv4 only, therefore the IPv6 ports are loaded
+ * behind the fixed IPv6 header. Packets with extension headers are hashed by their addresses.
+ */
+#define SAMPLEHASH(sum) "(((" sum ") * 2654435761) >> 16) %% %d = 0"
+#define IP4SUM "ip[12:4] + ip[16:4]"
+#define IP6SUM "ip6[8:4] + ip6[12:4] + ip6[16:4] + ip6[20:4] + ip6[24:4] + ip6[28:4] + ip6[32:4] + ip6[36:4]"
+#define IP6PORTS "ip6[40:2] + ip6[42:2]"
+#define IP4UNFRAG "ip[6:2] & 0x3fff = 0"
+char *SampleFilter(int sampleRate) {
+    size_t len = 2048;
+    char *sampleFilter = malloc(len);
+    if (!sampleFilter) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    snprintf(sampleFilter, len,
+             "(ip and " IP4UNFRAG " and ip[9] = 6 and " SAMPLEHASH(IP4SUM " + tcp[0:2] + tcp[2:2] + 6") ") or "
+             "(ip and " IP4UNFRAG " and ip[9] = 17 and " SAMPLEHASH(IP4SUM " + udp[0:2] + udp[2:2] + 17") ") or "
+             "(ip and not (" IP4UNFRAG " and (ip[9] = 6 or ip[9] = 17)) and " SAMPLEHASH(IP4SUM) ") or "
+             "(ip6 and ip6[6] = 6 and " SAMPLEHASH(IP6SUM " + " IP6PORTS " + 6") ") or "
+             "(ip6 and ip6[6] = 17 and " SAMPLEHASH(IP6SUM " + " IP6PORTS " + 17") ") or "
+             "(ip6 and not ip6[6] = 6 and not ip6[6] = 17 and " SAMPLEHASH(IP6SUM) ")",
+             sampleRate, sampleRate, sampleRate, sampleRate, sampleRate, sampleRate);
+
+    return sampleFilter;
+
+}  // End of SampleFilter
@@ -60,6 +60,7 @@
 #include "collector.h"
 #include "daemon.h"
 #include "flist.h"
+#include "khash.h"
 #include "launch.h"
 #include "metric.h"
 #include "nfconf.h"
@@ -109,7 +110,7 @@ static void signalPrivsepChild(pid_t child_pid, int pfd);
 
 static void IntHandler(int signal);
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss);
+static inline FlowSource_t *GetFlowSource(FlowSource_t *sourceList, struct sockaddr_storage *ss);
 
 static void run(packet_function_t receive_packet, int socket, int pfd, int rfd, time_t twin, time_t t_begin, int use_subdirs, char *time_extension,
                 int compress);
@@ -277,13 +278,17 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
     time_t t_start, t_now;
     uint32_t ignored_packets;
     ssize_t cnt;
-    void *in_buff;
+    void *in_buff = NULL;
 
-    in_buff = malloc(NETWORK_INPUT_BUFF_SIZE);
-    if (!in_buff) {
+    recvBatch_t *recvBatch = NewRecvBatch(RECV_BATCH_SIZE, NETWORK_INPUT_BUFF_SIZE);
+    if (!recvBatch) return;
+#ifdef PCAP
+    void *pcap_buff = malloc(NETWORK_INPUT_BUFF_SIZE);
+    if (!pcap_buff) {
         LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return;
     }
+#endif
 
     // Init each sflow source output data buffer
     fs = FlowSource;
@@ -321,27 +326,31 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
     while (1) {
         struct timeval tv;
 
-        /* read next bunch of data into begin of input buffer */
+        /* get next datagram of the current batch or receive the next batch */
         if (!done) {
 #ifdef PCAP
             // Debug code to read from pcap file, or from socket
-            cnt = receive_packet(socket, in_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&sf_sender, &sf_sender_size);
-
-            // in case of reading from file EOF => -2
-            if (cnt == -2) done = 1;
-#else
-            cnt = recvfrom(socket, in_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&sf_sender, &sf_sender_size);
+            if (receive_packet != recvfrom) {
+                cnt = receive_packet(socket, pcap_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&sf_sender, &sf_sender_size);
+                in_buff = pcap_buff;
+                gettimeofday(&tv, NULL);
+
+                // in case of reading from file EOF => -2
+                if (cnt == -2) done = 1;
+            } else
 #endif
+                cnt = RecvPacket(recvBatch, socket, &in_buff, &sf_sender, &sf_sender_size, &tv);
 
             if (cnt == -1 && errno != EINTR) {
                 LogError("ERROR: recvfrom: %s", strerror(errno));
                 continue;
             }
+        } else {
+            gettimeofday(&tv, NULL);
         }
 
         /* Periodic file renaming, if time limit reached or if we are done.  */
-        // t_now = time(NULL);
-        gettimeofday(&tv, NULL);
+        // one time stamp per received batch
         t_now = tv.tv_sec;
 
         if (((t_now - t_start) >= twin) || done) {
@@ -460,6 +469,8 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
 
             }  // end of while (fs)
 
+            recvStat_t recvStat = RecvStat(recvBatch);
+            LogRecvStat(&recvStat);
             if (ignored_packets) LogInfo("Total ignored packets: %u", ignored_packets);
             ignored_packets = 0;
 
@@ -506,7 +517,7 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
         }
 
         // get flow source record for current packet, identified by sender IP address
-        fs = GetFlowSource(&sf_sender);
+        fs = GetFlowSource(FlowSource, &sf_sender);
         if (fs == NULL) {
             fs = AddDynamicSource(&FlowSource, &sf_sender);
             if (fs == NULL) {
@@ -542,7 +553,10 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
         // now.
     }
 
-    free(in_buff);
+    FreeRecvBatch(recvBatch);
+#ifdef PCAP
+    free(pcap_buff);
+#endif
 
     fs = FlowSource;
     while (fs) {
@@ -833,7 +847,7 @@ int main(int argc, char **argv) {
         if (strcmp(argv[optind], "privsep") == 0) {
             if (strcmp(argv[optind + 1], "launcher") == 0) {
                 dbg_printf("sfcapd privsep launched\n");
-                int ret = StartupLauncher(launch_process, expire);
+                int ret = StartupLauncher(launch_process, NULL, expire);
                 exit(ret);
             } else if (strcmp(argv[optind + 1], "repeater") == 0) {
                 dbg_printf("sfcapd repeater launched\n");
@@ -900,7 +914,7 @@ int main(int argc, char **argv) {
         if (mcastgroup)
         sock = Multicast_receive_socket(mcastgroup, listenport, family, bufflen);
     else
-        sock = Unicast_receive_socket(bindhost, listenport, family, bufflen);
+        sock = Unicast_receive_socket(bindhost, listenport, family, bufflen, 0);
 
     if (sock == -1) {
         LogError("Terminated due to errors");
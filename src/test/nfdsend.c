@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2009-2024, Peter Haag
+ *  Copyright (c) 2004-2008, SWITCH - Teleinformatikdienste fuer Lehre und Forschung
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Send the records of a flow file as nfd stream frames to nfcapd -L, as nfpcapd -o stream
+ * does. The frames are sent in small pieces, so the collector receives partial frames.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "lz4.h"
+#include "nfd_raw.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfnet.h"
+#include "nfxV3.h"
+#include "util.h"
+
+// small frames, to send the test flows in several frames
+#define FRAMESIZE 512
+
+static int SendChunked(int sockfd, void *buff, size_t len, size_t chunk) {
+    while (len) {
+        size_t n = len < chunk ? len : chunk;
+        ssize_t ret = send(sockfd, buff, n, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buff += ret;
+        len -= ret;
+        if (len) usleep(100);
+    }
+    return 1;
+
+}  // End of SendChunked
+
+static int SendFrame(int sockfd, void *frameBuffer, void *lz4Buffer, uint32_t frameLength, uint32_t numRecords, uint32_t sequence, size_t chunk) {
+    nfd_frame_t *frame = (nfd_frame_t *)frameBuffer;
+    uint32_t length = frameLength;
+    uint16_t flags = 0;
+    if (lz4Buffer) {
+        int len = LZ4_compress_default(frameBuffer + sizeof(nfd_frame_t), lz4Buffer + sizeof(nfd_frame_t), frameLength, LZ4_COMPRESSBOUND(FRAMESIZE));
+        if (len <= 0) {
+            fprintf(stderr, "LZ4_compress_default() failed\n");
+            return 0;
+        }
+        frame = (nfd_frame_t *)lz4Buffer;
+        length = len;
+        flags = NFD_FRAME_LZ4;
+    }
+
+    frame->version = htons(NFD_STREAM);
+    frame->flags = htons(flags);
+    frame->length = htonl(length);
+    frame->rawLength = htonl(frameLength);
+    frame->numRecord = htonl(numRecords);
+    frame->sequence = htonl(sequence);
+    frame->exportTime = htonl(time(NULL));
+
+    return SendChunked(sockfd, frame, sizeof(nfd_frame_t) + length, chunk);
+
+}  // End of SendFrame
+
+static void usage(char *name) {
+    printf(
+        "usage %s [options] \n"
+        "-r file\tflow file to send\n"
+        "-p port\tstream port of nfcapd on localhost\n"
+        "-s size\tsend frames in pieces of size bytes\n"
+        "-z\tLZ4 compress frames\n",
+        name);
+}  // End of usage
+
+int main(int argc, char **argv) {
+    char *rfile = NULL;
+    char *port = NULL;
+    size_t chunk = 65536;
+    int compress = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "r:p:s:z")) != EOF) {
+        switch (c) {
+            case 'r':
+                rfile = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 's':
+                chunk = atoi(optarg);
+                if (chunk == 0) {
+                    fprintf(stderr, "Invalid size: %s\n", optarg);
+                    exit(255);
+                }
+                break;
+            case 'z':
+                compress = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(255);
+        }
+    }
+    if (!rfile || !port) {
+        usage(argv[0]);
+        exit(255);
+    }
+
+    if (!Init_nffile(NULL)) exit(254);
+    nffile_t *nffile = OpenFile(rfile, NULL);
+    if (!nffile) exit(255);
+
+    void *frameBuffer = malloc(sizeof(nfd_frame_t) + FRAMESIZE);
+    void *lz4Buffer = compress ? malloc(sizeof(nfd_frame_t) + LZ4_COMPRESSBOUND(FRAMESIZE)) : NULL;
+    if (!frameBuffer || (compress && !lz4Buffer)) {
+        fprintf(stderr, "malloc() error: %s\n", strerror(errno));
+        exit(255);
+    }
+
+    int sockfd = Stream_send_socket("127.0.0.1", port, AF_INET);
+    if (sockfd < 0) exit(255);
+
+    uint32_t frameLength = 0;
+    uint32_t numRecords = 0;
+    uint32_t sequence = 0;
+    uint32_t numFlows = 0;
+    int ok = 1;
+    while (ok && ReadBlock(nffile) > 0) {
+        if (nffile->block_header->type != DATA_BLOCK_TYPE_3) continue;
+
+        recordHeaderV3_t *record = nffile->buff_ptr;
+        for (int i = 0; ok && i < nffile->block_header->NumRecords; i++) {
+            if (record->type == V3Record) {
+                if ((frameLength + record->size) > FRAMESIZE) {
+                    ok = SendFrame(sockfd, frameBuffer, lz4Buffer, frameLength, numRecords, sequence++, chunk);
+                    frameLength = numRecords = 0;
+                }
+                memcpy(frameBuffer + sizeof(nfd_frame_t) + frameLength, (void *)record, record->size);
+                frameLength += record->size;
+                numRecords++;
+                numFlows++;
+            }
+            record = (recordHeaderV3_t *)((void *)record + record->size);
+        }
+    }
+    if (ok && numRecords) ok = SendFrame(sockfd, frameBuffer, lz4Buffer, frameLength, numRecords, sequence++, chunk);
+
+    close(sockfd);
+    CloseFile(nffile);
+    DisposeFile(nffile);
+
+    if (!ok) {
+        fprintf(stderr, "send() error: %s\n", strerror(errno));
+        exit(255);
+    }
+    printf("Sent %u flows in %u frames\n", numFlows, sequence);
+    return 0;
+}
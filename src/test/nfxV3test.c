@@ -0,0 +1,175 @@
+/*
+ *  Copyright (c) 2009-2024, Peter Haag
+ *  Copyright (c) 2004-2008, SWITCH - Teleinformatikdienste fuer Lehre und Forschung
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Compare the compiled sequencer, with and without the SIMD shuffle, against
+ * the sequencer interpreter for a set of fixed length templates.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "nfdump.h"
+#include "nfxV3.h"
+#include "util.h"
+
+#define NUMRECORDS 1000
+#define STACKSIZE 8
+#define OUTSIZE 1024
+
+// run modes of a sequencer
+#define RUN_INTERPRETER 0
+#define RUN_COMPILED 1
+#define RUN_SHUFFLE 2
+
+typedef struct testResult_s {
+    uint8_t out[OUTSIZE];
+    uint64_t stack[STACKSIZE];
+    ptrdiff_t offset[MAXEXTENSIONS];
+} testResult_t;
+
+// v9 like template: addresses, ports, counters, a stacked time stamp, a skipped element and macs
+static sequence_t templateV4[] = {
+    {8, 4, NumberCopy, EXipv4FlowID, OFFsrc4Addr, 4, 0},
+    {12, 4, NumberCopy, EXipv4FlowID, OFFdst4Addr, 4, 0},
+    {7, 2, NumberCopy, EXgenericFlowID, OFFsrcPort, 2, 0},
+    {11, 2, NumberCopy, EXgenericFlowID, OFFdstPort, 2, 0},
+    {4, 1, NumberCopy, EXgenericFlowID, OFFproto, 1, 0},
+    {6, 1, NumberCopy, EXgenericFlowID, OFFtcpFlags, 1, 0},
+    {2, 4, NumberCopy, EXgenericFlowID, OFFinPackets, 8, 0},
+    {1, 8, NumberCopy, EXgenericFlowID, OFFinBytes, 8, 0},
+    {22, 4, NumberCopy, EXnull, 0, 0, 1},
+    {21, 4, NumberCopy, EXnull, 0, 0, 2},
+    {999, 3, NumberCopy, EXnull, 0, 0, 0},
+    {56, 6, NumberCopy, EXmacAddrID, OFFinSrcMac, 8, 0},
+    {57, 6, NumberCopy, EXmacAddrID, OFFoutDstMac, 8, 0},
+};
+
+// IPv6 template with byte copies and a stacked byte copy
+static sequence_t templateV6[] = {
+    {27, 16, NumberCopy, EXipv6FlowID, OFFsrc6Addr, 16, 0},
+    {28, 16, ByteCopy, EXipv6FlowID, OFFdst6Addr, 16, 3},
+    {7, 2, NumberCopy, EXgenericFlowID, OFFsrcPort, 2, 4},
+    {11, 2, NumberCopy, EXgenericFlowID, OFFdstPort, 2, 0},
+    {2, 8, NumberCopy, EXgenericFlowID, OFFinPackets, 8, 0},
+    {1, 5, NumberCopy, EXgenericFlowID, OFFinBytes, 8, 0},
+    {999, 12, NumberCopy, EXnull, 0, 0, 0},
+    {152, 8, NumberCopy, EXgenericFlowID, OFFmsecFirst, 8, 5},
+};
+
+// number longer than 16 bytes - left to the interpreter
+static sequence_t templateLong[] = {
+    {8, 4, NumberCopy, EXipv4FlowID, OFFsrc4Addr, 4, 0},
+    {998, 20, NumberCopy, EXipv6FlowID, OFFsrc6Addr, 16, 6},
+    {2, 4, NumberCopy, EXgenericFlowID, OFFinPackets, 8, 0},
+};
+
+static int RunTemplate(sequence_t *template, uint32_t numSequences, int mode, uint8_t *in, size_t inSize, testResult_t *result) {
+    sequencer_t sequencer;
+    memset((void *)&sequencer, 0, sizeof(sequencer));
+
+    sequence_t *sequenceTable = malloc(numSequences * sizeof(sequence_t));
+    if (!sequenceTable) return 0;
+    memcpy(sequenceTable, template, numSequences * sizeof(sequence_t));
+    uint16_t *extensionList = SetupSequencer(&sequencer, sequenceTable, numSequences);
+    if (!extensionList) return 0;
+    free(extensionList);
+
+    if (mode == RUN_COMPILED && sequencer.opList == NULL && template != templateLong) {
+        printf("**** FAILED **** template not compiled\n");
+        exit(255);
+    }
+
+    // hide the compiled parts not used in this mode
+    void *opList = sequencer.opList;
+    void *shuffle = sequencer.shuffle;
+    if (mode == RUN_INTERPRETER) sequencer.opList = NULL;
+    if (mode != RUN_SHUFFLE) sequencer.shuffle = NULL;
+
+    memset((void *)result, 0, sizeof(testResult_t));
+    AddV3Header(result->out, recordHeader);
+    size_t outSize = CalcOutRecordSize(&sequencer, in, inSize) + sizeof(recordHeaderV3_t);
+    int ret = SequencerRun(&sequencer, in, inSize, result->out, outSize, result->stack);
+    for (int i = 0; i < MAXEXTENSIONS; i++) {
+        result->offset[i] = sequencer.offsetCache[i] ? (uint8_t *)sequencer.offsetCache[i] - result->out : -1;
+    }
+
+    sequencer.opList = opList;
+    sequencer.shuffle = shuffle;
+    ClearSequencer(&sequencer);
+
+    return ret == SEQ_OK;
+
+}  // End of RunTemplate
+
+static void CheckTemplate(char *name, sequence_t *template, uint32_t numSequences) {
+    size_t inSize = 0;
+    for (int i = 0; i < numSequences; i++) inSize += template[i].inputLength;
+
+    uint8_t in[256];
+    for (int n = 0; n < NUMRECORDS; n++) {
+        for (int i = 0; i < inSize; i++) in[i] = random();
+
+        testResult_t expect, result;
+        if (!RunTemplate(template, numSequences, RUN_INTERPRETER, in, inSize, &expect)) {
+            printf("**** FAILED **** %s: interpreter run failed\n", name);
+            exit(255);
+        }
+        for (int mode = RUN_COMPILED; mode <= RUN_SHUFFLE; mode++) {
+            if (!RunTemplate(template, numSequences, mode, in, inSize, &result)) {
+                printf("**** FAILED **** %s: compiled run %d failed\n", name, mode);
+                exit(255);
+            }
+            if (memcmp((void *)&expect, (void *)&result, sizeof(testResult_t)) != 0) {
+                printf("**** FAILED **** %s: compiled run %d differs from interpreter in record %d\n", name, mode, n);
+                exit(255);
+            }
+        }
+    }
+    printf("Success: %s: %d records\n", name, NUMRECORDS);
+
+}  // End of CheckTemplate
+
+int main(int argc, char **argv) {
+    srandom(42);
+
+    CheckTemplate("IPv4 template", templateV4, sizeof(templateV4) / sizeof(sequence_t));
+    CheckTemplate("IPv6 template", templateV6, sizeof(templateV6) / sizeof(sequence_t));
+    CheckTemplate("Long number template", templateLong, sizeof(templateLong) / sizeof(sequence_t));
+
+    printf("All sequencer tests successful\n");
+    return 0;
+}
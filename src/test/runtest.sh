@@ -119,6 +119,66 @@ $NFDUMP -r testdir/nfcapd.* -q -o extended -6 >test.6-2.out
 
 diff test.6-1.out test.6-2.out
 
+# sharded nfcapd files and expire
+mkdir testdir/shard
+echo -n Starting sharded nfcapd ...
+../nfcapd/nfcapd -p 65530 -w testdir/shard -D -P testdir/pidfile -I TestIdent -W 2 -K 2
+sleep 1
+echo done.
+echo -n Replay flows ...
+../nfreplay/nfreplay -r test.flows.nf -v9 -H 127.0.0.1 -p 65530
+echo done.
+sleep 1
+
+echo -n Terminate nfcapd ...
+kill -TERM $(cat testdir/pidfile)
+# the workers terminate within their 1s receive timeout
+i=0
+while [ -f testdir/pidfile ] && [ $i -lt 10 ]; do
+	sleep 1
+	i=$((i + 1))
+done
+echo done.
+
+if [ -f testdir/pidfile ]; then
+	echo nfcapd does not terminate
+	exit 255
+fi
+
+$NFDUMP -R testdir/shard -q -o extended -6 | sort >test.6-3.out
+sort test.6-1.out | diff - test.6-3.out
+../nfexpire/nfexpire -r testdir/shard | grep 'Numfiles:  2'
+../nfexpire/nfexpire -e testdir/shard -s 1b
+if [ -n "$(ls testdir/shard)" ]; then
+	echo nfexpire does not expire sharded files
+	exit 255
+fi
+rm -f testdir/shard/.nfstat
+rmdir testdir/shard
+
+# nfd flow stream frames, plain and LZ4, sent in small pieces
+mkdir testdir/stream
+echo -n Starting stream nfcapd ...
+../nfcapd/nfcapd -p 65530 -L 65531 -w testdir/stream -D -P testdir/pidfile -I TestIdent
+sleep 1
+echo done.
+echo -n Stream flows ...
+./nfdsend -r test.flows.nf -p 65531 -s 1000
+./nfdsend -r test.flows.nf -p 65531 -s 1000 -z
+echo done.
+sleep 1
+
+echo -n Terminate nfcapd ...
+kill -TERM $(cat testdir/pidfile)
+sleep 1
+echo done.
+
+$NFDUMP -r test.flows.nf -q -o extended -6 >test.6-4.out
+cat test.6-4.out test.6-4.out | sort >test.6-5.out
+$NFDUMP -R testdir/stream -q -o extended -6 | sort | diff test.6-5.out -
+rm -f testdir/stream/nfcapd.* testdir/stream/.nfstat
+rmdir testdir/stream
+
 mkdir memck.$$
 # OpenBSD
 export MALLOC_OPTIONS=AFGJS
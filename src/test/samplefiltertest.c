@@ -0,0 +1,170 @@
+/*
+ *  Copyright (c) 2023, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Compile the nfpcapd sample filter and check, that IPv4 and IPv6 TCP and UDP flows
+ * are sampled about 1:N and that both directions of a flow are sampled alike.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pcap.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "samplefilter.h"
+
+#define SAMPLERATE 10
+#define NUMFLOWS 20000
+#define SNAPLEN 128
+
+static uint32_t seed = 2463534242;
+static uint32_t xorshift32(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}  // End of xorshift32
+
+// ethernet, IPv4 or IPv6 and TCP or UDP header of one flow packet
+static size_t BuildPacket(uint8_t *packet, int ipv6, int proto, uint8_t *srcAddr, uint8_t *dstAddr, uint16_t srcPort, uint16_t dstPort) {
+    memset(packet, 0, SNAPLEN);
+    uint8_t *ip = packet + 14;
+    uint8_t *l4;
+    size_t l4Len = proto == IPPROTO_TCP ? 20 : 8;
+    if (ipv6) {
+        packet[12] = 0x86;
+        packet[13] = 0xdd;
+        ip[0] = 0x60;
+        uint16_t payloadLen = htons(l4Len);
+        memcpy(ip + 4, &payloadLen, 2);
+        ip[6] = proto;
+        ip[7] = 64;
+        memcpy(ip + 8, srcAddr, 16);
+        memcpy(ip + 24, dstAddr, 16);
+        l4 = ip + 40;
+    } else {
+        packet[12] = 0x08;
+        packet[13] = 0x00;
+        ip[0] = 0x45;
+        uint16_t totalLen = htons(20 + l4Len);
+        memcpy(ip + 2, &totalLen, 2);
+        ip[8] = 64;
+        ip[9] = proto;
+        memcpy(ip + 12, srcAddr, 4);
+        memcpy(ip + 16, dstAddr, 4);
+        l4 = ip + 20;
+    }
+    srcPort = htons(srcPort);
+    dstPort = htons(dstPort);
+    memcpy(l4, &srcPort, 2);
+    memcpy(l4 + 2, &dstPort, 2);
+    if (proto == IPPROTO_TCP) {
+        l4[12] = 0x50;
+        l4[13] = 0x10;
+    } else {
+        uint16_t udpLen = htons(l4Len);
+        memcpy(l4 + 4, &udpLen, 2);
+    }
+
+    return (l4 - packet) + l4Len;
+
+}  // End of BuildPacket
+
+static int Matches(struct bpf_program *code, uint8_t *packet, size_t len) {
+    struct pcap_pkthdr hdr = {0};
+    hdr.caplen = len;
+    hdr.len = len;
+    return pcap_offline_filter(code, &hdr, packet) != 0;
+}  // End of Matches
+
+static void RunFlows(struct bpf_program *code, int ipv6, int proto) {
+    char *name = ipv6 ? (proto == IPPROTO_TCP ? "IPv6 TCP" : "IPv6 UDP") : (proto == IPPROTO_TCP ? "IPv4 TCP" : "IPv4 UDP");
+    size_t addrLen = ipv6 ? 16 : 4;
+    uint8_t packet[SNAPLEN];
+    uint8_t srcAddr[16], dstAddr[16];
+
+    // a few hosts with many connections, so the ports must be part of the hash
+    uint32_t sampled = 0;
+    for (int i = 0; i < NUMFLOWS; i++) {
+        memset(srcAddr, 0, sizeof(srcAddr));
+        memset(dstAddr, 0, sizeof(dstAddr));
+        srcAddr[0] = 10;
+        srcAddr[addrLen - 1] = xorshift32() % 4;
+        dstAddr[0] = 192;
+        dstAddr[addrLen - 1] = xorshift32() % 4;
+        uint16_t srcPort = 1024 + xorshift32() % 60000;
+        uint16_t dstPort = xorshift32() % 2 ? 53 : 443;
+
+        size_t len = BuildPacket(packet, ipv6, proto, srcAddr, dstAddr, srcPort, dstPort);
+        int forward = Matches(code, packet, len);
+        len = BuildPacket(packet, ipv6, proto, dstAddr, srcAddr, dstPort, srcPort);
+        int reverse = Matches(code, packet, len);
+        if (forward != reverse) {
+            printf("**** FAILED **** %s: directions of flow %d sampled differently\n", name, i);
+            exit(255);
+        }
+        sampled += forward;
+    }
+
+    uint32_t expected = NUMFLOWS / SAMPLERATE;
+    if (sampled < (expected * 8 / 10) || sampled > (expected * 12 / 10)) {
+        printf("**** FAILED **** %s: sampled %u of %d flows, expected about %u\n", name, sampled, NUMFLOWS, expected);
+        exit(255);
+    }
+    printf("Success: %s: sampled %u of %d flows 1:%d\n", name, sampled, NUMFLOWS, SAMPLERATE);
+
+}  // End of RunFlows
+
+int main(void) {
+    char *sampleFilter = SampleFilter(SAMPLERATE);
+    if (!sampleFilter) exit(255);
+
+    struct bpf_program code;
+    pcap_t *p = pcap_open_dead(DLT_EN10MB, SNAPLEN);
+    if (!p || pcap_compile(p, &code, sampleFilter, 1, PCAP_NETMASK_UNKNOWN)) {
+        printf("**** FAILED **** compile sample filter: %s\n", p ? pcap_geterr(p) : "pcap_open_dead() failed");
+        exit(255);
+    }
+
+    RunFlows(&code, 0, IPPROTO_TCP);
+    RunFlows(&code, 0, IPPROTO_UDP);
+    RunFlows(&code, 1, IPPROTO_TCP);
+    RunFlows(&code, 1, IPPROTO_UDP);
+
+    pcap_freecode(&code);
+    pcap_close(p);
+    free(sampleFilter);
+    return 0;
+}